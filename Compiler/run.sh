@@ -10,17 +10,30 @@ fi
 if [ "$1" == "long" ]; then
   bison -d -Wcounterexamples -o src/parser.tab.c src/parser.y
   flex -o src/lex.yy.c src/lexer.l
-  g++ -DLARGE_NUMBER=2147483648 -o compiler src/parser.tab.c src/lex.yy.c -lfl -std=c++11 
+  g++ -DLARGE_NUMBER=2147483648 -o compiler src/parser.tab.c src/lex.yy.c -lfl -std=c++11 -pthread
   echo "Compiler for 'long long'."
 
 elif [ "$1" == "cln" ]; then
   bison -d -Wcounterexamples -o src/parser.tab.c src/parser.y
   flex -o src/lex.yy.c src/lexer.l
-  g++ -DLARGE_NUMBER=4611686018427387904 -o compiler src/parser.tab.c src/lex.yy.c -lfl -std=c++11 
+  g++ -DLARGE_NUMBER=4611686018427387904 -o compiler src/parser.tab.c src/lex.yy.c -lfl -std=c++11 -pthread
   echo "Compiler for 'cln'."
 
+elif [ "$1" == "superopt" ]; then
+  g++ -O2 -o superoptimizer src/superoptimizer.cpp -std=c++11
+  ./superoptimizer > src/rewrite_table.hpp
+  echo "Rewrite table regenerated."
+
+elif [ "$1" == "bench" ]; then
+  shift
+  ./scalability.sh "$@"
+
+elif [ "$1" == "scanbench" ]; then
+  shift
+  ./scanner_bench.sh "$@"
+
 elif [ "$1" == "c" ]; then
-  rm -f src/lex.yy.c src/parser.tab.c src/parser.tab.h compiler
+  rm -f src/lex.yy.c src/parser.tab.c src/parser.tab.h compiler superoptimizer program_generator
   echo "Clean up completed."
 
 else
@@ -0,0 +1,71 @@
+#!/bin/bash
+
+# Compiles synthetic programs of growing size and prints compile time, peak
+# memory and output size for each. Every size doubles the previous one, so the
+# growth column is about 2 where the compiler scales linearly and about 4 where
+# it is quadratic.
+#
+#   ./scalability.sh [shape...]
+#
+# COMPILER (default ./compiler), SIZES (default 1000 to 128000), TIMEOUT
+# (seconds per compilation, default 120) and RESULTS (file the output is also
+# written to, default scalability-results.txt) can be set in the environment.
+
+COMPILER=${COMPILER:-./compiler}
+SIZES=${SIZES:-"1000 2000 4000 8000 16000 32000 64000 128000"}
+TIMEOUT=${TIMEOUT:-120}
+RESULTS=${RESULTS:-scalability-results.txt}
+SHAPES=${*:-"procedures nesting declarations statements calls"}
+
+if [ ! -x "$COMPILER" ]; then
+  echo "No compiler at $COMPILER. Build it with ./run.sh first."
+  exit 1
+fi
+if [ ! -x program_generator ] || [ src/program_generator.cpp -nt program_generator ]; then
+  g++ -O2 -o program_generator src/program_generator.cpp -std=c++11 || exit 1
+fi
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+exec > >(tee "$RESULTS")
+echo "$COMPILER at revision $(git rev-parse --short HEAD 2>/dev/null || echo unknown)$(git diff --quiet HEAD -- src 2>/dev/null || echo ' with local changes'), $(date -u '+%Y-%m-%d %H:%M UTC'), $(uname -sm)"
+
+for shape in $SHAPES; do
+  echo "$shape"
+  printf "%10s %10s %10s %10s %10s %12s %12s %7s\n" size "total ms" "lex ms" "parse ms" "codegen ms" "peak RSS KB" "output B" growth
+  previous=""
+  for size in $SIZES; do
+    ./program_generator "$shape" "$size" > "$WORK/program.imp" || exit 1
+    timeout "$TIMEOUT" "$COMPILER" -ftime-report "$WORK/program" "$WORK/program" > /dev/null 2> "$WORK/report"
+    status=$?
+    if [ $status -ne 0 ]; then
+      if [ $status -eq 124 ]; then
+        reason="timed out after ${TIMEOUT}s"
+      elif [ $status -gt 128 ]; then
+        reason="killed by signal $((status - 128))"
+      else
+        reason=$(grep -m 1 -i "error" "$WORK/report" | sed 's/\x1b\[[0-9;]*m//g')
+      fi
+      printf "%10s %s\n" "$size" "failed: ${reason:-exit code $status}"
+      break
+    fi
+    # phases are "<name> <ms> <allocations> <peak RSS>", then the total and the counters
+    read -r total lexing parsing codegen rss bytes < <(awk '
+      /^Phase/ { phases = 1; next }
+      phases && $1 == "total" { total = $2; phases = 0; next }
+      phases && NF >= 4 {
+        ms = $(NF - 2)
+        if ($1 == "lexing") lexing += ms
+        else if ($1 == "parsing") parsing += ms
+        else if ($1 == "codegen") codegen += ms
+        if ($NF > rss) rss = $NF
+      }
+      /^output bytes/ { bytes = $NF }
+      END { printf "%s %.3f %.3f %.3f %d %d\n", total, lexing, parsing, codegen, rss, bytes }
+    ' "$WORK/report")
+    growth=$(awk -v now="$total" -v before="$previous" 'BEGIN { if (before > 0) printf "%.2f", now / before; else print "-" }')
+    printf "%10s %10s %10s %10s %10s %12s %12s %7s\n" "$size" "$total" "$lexing" "$parsing" "$codegen" "$rss" "$bytes" "$growth"
+    previous=$total
+  done
+  echo
+done
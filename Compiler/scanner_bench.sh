@@ -0,0 +1,68 @@
+#!/bin/bash
+
+# Compares the scanner of this tree with the one of another git revision: the
+# compiler is built from both sources and each compiles the same synthetic
+# programs, and the lexing time -ftime-report gives is printed side by side.
+#
+#   ./scanner_bench.sh <revision> [shape]
+#
+# The shape defaults to statements, the one with the most tokens per line.
+# SIZES (default 1000 to 128000), RUNS (compilations per size, of which the
+# fastest counts, default 3) and RESULTS (file the output is also written to,
+# default scanner-bench-results.txt) can be set in the environment.
+
+if [ -z "$1" ]; then
+  echo "Usage: $0 <revision> [shape]"
+  exit 1
+fi
+REVISION=$1
+SHAPE=${2:-statements}
+SIZES=${SIZES:-"1000 2000 4000 8000 16000 32000 64000 128000"}
+RUNS=${RUNS:-3}
+RESULTS=${RESULTS:-scanner-bench-results.txt}
+
+if [ ! -x program_generator ] || [ src/program_generator.cpp -nt program_generator ]; then
+  g++ -O2 -o program_generator src/program_generator.cpp -std=c++11 || exit 1
+fi
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+# the same steps as ./run.sh cln, on a copy of the sources
+build() {
+  (
+    cd "$1" &&
+      bison -d -o parser.tab.c parser.y &&
+      flex -o lex.yy.c lexer.l &&
+      g++ -DLARGE_NUMBER=4611686018427387904 -o compiler parser.tab.c lex.yy.c -lfl -std=c++11 -pthread
+  ) > "$1.log" 2>&1 || { echo "Could not build the compiler in $1:"; cat "$1.log"; exit 1; }
+}
+
+mkdir -p "$WORK/before" "$WORK/after"
+git archive "$REVISION" src | tar -x --strip-components=1 -C "$WORK/before" || exit 1
+cp src/*.hpp src/*.y src/*.l "$WORK/after/"
+build "$WORK/before" || exit 1
+build "$WORK/after" || exit 1
+
+# fastest lexing time of RUNS compilations
+lexing() {
+  local best=""
+  for run in $(seq "$RUNS"); do
+    "$1" -ftime-report "$WORK/program" "$WORK/program" > /dev/null 2> "$WORK/report" || return 1
+    ms=$(awk '$1 == "lexing" { print $2; exit }' "$WORK/report")
+    best=$(awk -v ms="$ms" -v best="$best" 'BEGIN { print (best == "" || ms < best) ? ms : best }')
+  done
+  echo "$best"
+}
+
+exec > >(tee "$RESULTS")
+echo "$REVISION ($(git rev-parse --short "$REVISION" 2>/dev/null || echo unknown)) against revision $(git rev-parse --short HEAD 2>/dev/null || echo unknown)$(git diff --quiet HEAD -- src 2>/dev/null || echo ' with local changes'), $(date -u '+%Y-%m-%d %H:%M UTC'), $(uname -sm)"
+echo "$SHAPE: lexing ms of $REVISION and of this tree"
+printf "%10s %12s %12s %8s\n" size before after ratio
+for size in $SIZES; do
+  ./program_generator "$SHAPE" "$size" > "$WORK/program.imp" || exit 1
+  before=$(lexing "$WORK/before/compiler") || { printf "%10s %s\n" "$size" "failed with $REVISION"; break; }
+  after=$(lexing "$WORK/after/compiler") || { printf "%10s %s\n" "$size" "failed with this tree"; break; }
+  ratio=$(awk -v a="$after" -v b="$before" 'BEGIN { if (b > 0) printf "%.2f", a / b; else print "-" }')
+  printf "%10s %12s %12s %8s\n" "$size" "$before" "$after" "$ratio"
+done
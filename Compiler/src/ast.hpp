@@ -5,20 +5,53 @@
 #include <vector>
 #include <string>
 
+// Tag identifying the concrete class of a node, so passes can dispatch with
+// a single switch instead of probing with dynamic_cast.
+enum class NodeKind
+{
+    Identifier,
+    Value,
+    Argument,
+    ArgumentsDeclaration,
+    ProcedureHead,
+    ProcedureCallArguments,
+    BinaryExpression,
+    Condition,
+    Declarations,
+    Commands,
+    Assign,
+    If,
+    While,
+    RepeatUntil,
+    ForTo,
+    ForDownTo,
+    ProcedureCall,
+    Write,
+    Read,
+    Main,
+    Procedure,
+    Procedures,
+    Program
+};
+
 class AstNode
 {
 public:
-    AstNode() : lineNumber(0) {}
+    explicit AstNode(NodeKind k) : kind(k), lineNumber(0) {}
     virtual ~AstNode() = default;
     
     void setLineNumber(int line) { lineNumber = line; }
     int getLineNumber() const { return lineNumber; }
+    NodeKind getKind() const { return kind; }
+
+    const NodeKind kind;
     int lineNumber = 0;
 };
 
 class ExpressionNode : public AstNode
 {
 public:
+    explicit ExpressionNode(NodeKind k) : AstNode(k) {}
     // ~ExpressionNode() override = default;
 };
 
@@ -26,25 +59,24 @@ class IdentifierNode : public ExpressionNode
 {
 public:
     explicit IdentifierNode(std::string *varName) // zmienna
-        : name(varName)
+        : ExpressionNode(NodeKind::Identifier), name(varName)
     {
     }
     IdentifierNode(std::string *varName, IdentifierNode *idx) // zmienna[zmienna]
-        : name(varName), index_var(idx), isElement(true)
+        : ExpressionNode(NodeKind::Identifier), name(varName), index_var(idx), isElement(true)
     {
     }
     IdentifierNode(std::string *varName, long long idx) // zmienna[liczba]
-        : name(varName), index_const(idx), isElement(true)
+        : ExpressionNode(NodeKind::Identifier), name(varName), index_const(idx), isElement(true)
     {
     }
     IdentifierNode(std::string *varName, long long startIdx, long long endIdx) // zmienna[st:kon]
-        : name(varName), start(startIdx), end(endIdx), isArray(true)
+        : ExpressionNode(NodeKind::Identifier), name(varName), start(startIdx), end(endIdx), isArray(true)
     {
     }
 
     ~IdentifierNode()
     {
-        delete name;
         delete index_var;
     }
 
@@ -69,7 +101,7 @@ public:
     }
 
      
-    std::string *name;
+    std::string *name; // names are interned by the ParseContext, which owns them
     IdentifierNode *index_var = nullptr;
     long long index_const = 0;
     long long start = 0, end = 0;
@@ -80,8 +112,13 @@ public:
 class ValueNode : public ExpressionNode
 {
 public:
-    ValueNode(long long val, int minus = 1) : value(val * minus), identifier(nullptr) {}
-    ValueNode(IdentifierNode *id) : value(0), identifier(id) {}
+    ValueNode(long long val, int minus = 1) : ExpressionNode(NodeKind::Value), value(val * minus), identifier(nullptr) {}
+    ValueNode(IdentifierNode *id) : ExpressionNode(NodeKind::Value), value(0), identifier(id) {}
+
+    ~ValueNode()
+    {
+        delete identifier;
+    }
 
     long long value;
     IdentifierNode *identifier;
@@ -91,14 +128,9 @@ class ArgumentNode : public AstNode
 {
 public:
     explicit ArgumentNode(std::string *varName)
-        : argumentName(varName) {}
+        : AstNode(NodeKind::Argument), argumentName(varName) {}
     ArgumentNode(std::string *varName, bool isArr)
-        : argumentName(varName), isArray(isArr) {}
-
-    ~ArgumentNode()
-    {
-        delete argumentName;
-    }
+        : AstNode(NodeKind::Argument), argumentName(varName), isArray(isArr) {}
 
     const std::string *getArgumentName() const
     {
@@ -117,6 +149,7 @@ public:
 class ArgumentsDeclarationNode : public AstNode
 {
 public:
+    ArgumentsDeclarationNode() : AstNode(NodeKind::ArgumentsDeclaration) {}
     void addVariableArgument(std::string *varName)
     {
         arguments.push_back(new ArgumentNode(varName));
@@ -145,11 +178,10 @@ public:
 class ProcedureHeadNode : public AstNode
 {
 public:
-    explicit ProcedureHeadNode(std::string *procName, ArgumentsDeclarationNode *args) : procedureName(procName), arguments(args) {}
+    explicit ProcedureHeadNode(std::string *procName, ArgumentsDeclarationNode *args) : AstNode(NodeKind::ProcedureHead), procedureName(procName), arguments(args) {}
 
     ~ProcedureHeadNode()
     {
-        delete procedureName;
         delete arguments;
     }
 
@@ -170,6 +202,7 @@ public:
 class ProcedureCallArguments : public AstNode
 {
 public:
+    ProcedureCallArguments() : AstNode(NodeKind::ProcedureCallArguments) {}
     ~ProcedureCallArguments()
     {
         for (auto arg : arguments)
@@ -194,7 +227,7 @@ public:
 class BinaryExpressionNode : public ExpressionNode
 {
 public:
-    BinaryExpressionNode(ValueNode *lhs, const std::string &operator_, ValueNode *rhs) : left(lhs), op(operator_), right(rhs) {}
+    BinaryExpressionNode(ValueNode *lhs, const std::string &operator_, ValueNode *rhs) : ExpressionNode(NodeKind::BinaryExpression), left(lhs), op(operator_), right(rhs) {}
 
     ~BinaryExpressionNode()
     {
@@ -210,7 +243,7 @@ public:
 class ConditionNode : public AstNode
 {
 public:
-    ConditionNode(ValueNode *lhs, const std::string &operator_, ValueNode *rhs) : left(lhs), op(operator_), right(rhs) {}
+    ConditionNode(ValueNode *lhs, const std::string &operator_, ValueNode *rhs) : AstNode(NodeKind::Condition), left(lhs), op(operator_), right(rhs) {}
 
     ~ConditionNode()
     {
@@ -226,6 +259,7 @@ public:
 class DeclarationsNode : public AstNode
 {
 public:
+    DeclarationsNode() : AstNode(NodeKind::Declarations) {}
     ~DeclarationsNode()
     {
         for (auto decl : declarations)
@@ -244,9 +278,12 @@ public:
         declarations.push_back(new IdentifierNode(varName, startIdx, endIdx));
     }
 
+    // Takes the bounds, which are only needed for their values.
     void addArrayDeclaration(std::string *varName, ValueNode *startIdx, ValueNode *endIdx)
     {
         declarations.push_back(new IdentifierNode(varName, startIdx->value, endIdx->value));
+        delete startIdx;
+        delete endIdx;
     }
 
     const std::vector<IdentifierNode *> &getDeclarations() const
@@ -260,12 +297,15 @@ public:
 
 class CommandNode : public AstNode
 {
+public:
+    explicit CommandNode(NodeKind k) : AstNode(k) {}
     //~CommandNode() override = default;
 };
 
 class CommandsNode : public AstNode
 {
 public:
+    CommandsNode() : AstNode(NodeKind::Commands) {}
     ~CommandsNode()
     {
         for (auto cmd : commands)
@@ -289,10 +329,26 @@ public:
     std::vector<CommandNode *> commands;
 };
 
+// Commands lent by their owner, such as a loop body that an unrolled loop
+// repeats; deleting the node leaves them alone.
+class BorrowedCommands : public CommandsNode
+{
+public:
+    explicit BorrowedCommands(const std::vector<CommandNode *> &lent)
+    {
+        commands = lent;
+    }
+
+    ~BorrowedCommands()
+    {
+        commands.clear();
+    }
+};
+
 class AssignNode : public CommandNode
 {
 public:
-    explicit AssignNode(IdentifierNode *id, ExpressionNode *exp, bool ign=false) : identifier(id), expression(exp), ignore(ign) {}
+    explicit AssignNode(IdentifierNode *id, ExpressionNode *exp, bool ign=false) : CommandNode(NodeKind::Assign), identifier(id), expression(exp), ignore(ign) {}
 
     ~AssignNode()
     {
@@ -322,7 +378,7 @@ class IfNode : public CommandNode
 {
 public:
     IfNode(ConditionNode *cond, CommandsNode *thenCmds, CommandsNode *elseCmds = nullptr)
-        : condition(cond), thenCommands(thenCmds), elseCommands(elseCmds) {}
+        : CommandNode(NodeKind::If), condition(cond), thenCommands(thenCmds), elseCommands(elseCmds) {}
 
     ~IfNode()
     {
@@ -352,7 +408,7 @@ class WhileNode : public CommandNode
 {
 public:
     explicit WhileNode(ConditionNode *cond, CommandsNode *cmds)
-        : condition(cond), commands(cmds) {}
+        : CommandNode(NodeKind::While), condition(cond), commands(cmds) {}
 
     ~WhileNode()
     {
@@ -374,7 +430,7 @@ class RepeatUntilNode : public CommandNode
 {
 public:
     explicit RepeatUntilNode(ConditionNode *cond, CommandsNode *comms)
-        : condition(cond), commands(comms) {}
+        : CommandNode(NodeKind::RepeatUntil), condition(cond), commands(comms) {}
 
     ~RepeatUntilNode()
     {
@@ -396,7 +452,7 @@ public:
 class ForToNode : public CommandNode
 {
 public:
-    explicit ForToNode(std::string *pid, ValueNode *fromVal, ValueNode *toVal, CommandsNode *comms) : pidentifier(new IdentifierNode(pid)), fromValue(fromVal), toValue(toVal), commands(comms) {}
+    explicit ForToNode(std::string *pid, ValueNode *fromVal, ValueNode *toVal, CommandsNode *comms) : CommandNode(NodeKind::ForTo), pidentifier(new IdentifierNode(pid)), fromValue(fromVal), toValue(toVal), commands(comms) {}
 
     ~ForToNode()
     {
@@ -423,7 +479,7 @@ public:
 class ForDownToNode : public CommandNode
 {
 public:
-    explicit ForDownToNode(std::string *pid, ValueNode *fromVal, ValueNode *toVal, CommandsNode *comms) : pidentifier(new IdentifierNode(pid)), fromValue(fromVal), toValue(toVal), commands(comms) {}
+    explicit ForDownToNode(std::string *pid, ValueNode *fromVal, ValueNode *toVal, CommandsNode *comms) : CommandNode(NodeKind::ForDownTo), pidentifier(new IdentifierNode(pid)), fromValue(fromVal), toValue(toVal), commands(comms) {}
     ~ForDownToNode()
     {
         delete pidentifier;
@@ -446,10 +502,9 @@ public:
 class ProcedureCallNode : public CommandNode
 {
 public:
-    explicit ProcedureCallNode(std::string *pidentifier, ProcedureCallArguments *args) : procedureName(pidentifier), arguments(args) {}
+    explicit ProcedureCallNode(std::string *pidentifier, ProcedureCallArguments *args) : CommandNode(NodeKind::ProcedureCall), procedureName(pidentifier), arguments(args) {}
     ~ProcedureCallNode()
     {
-        delete procedureName;
         delete arguments;
     }
 
@@ -473,7 +528,7 @@ public:
 class WriteNode : public CommandNode
 {
 public:
-    WriteNode(ValueNode *nd) : node(nd) {}
+    WriteNode(ValueNode *nd) : CommandNode(NodeKind::Write), node(nd) {}
     ~WriteNode()
     {
         delete node;
@@ -487,7 +542,7 @@ public:
 class ReadNode : public CommandNode
 {
 public:
-    explicit ReadNode(IdentifierNode *val) : identifier(val) {}
+    explicit ReadNode(IdentifierNode *val) : CommandNode(NodeKind::Read), identifier(val) {}
 
     ~ReadNode()
     {
@@ -507,8 +562,8 @@ public:
 class MainNode : public AstNode
 {
 public:
-    explicit MainNode(DeclarationsNode *decl, CommandsNode *cmds) : declarations(decl), commands(cmds) {}
-    explicit MainNode(CommandsNode *cmds) : declarations(nullptr), commands(cmds) {}
+    explicit MainNode(DeclarationsNode *decl, CommandsNode *cmds) : AstNode(NodeKind::Main), declarations(decl), commands(cmds) {}
+    explicit MainNode(CommandsNode *cmds) : AstNode(NodeKind::Main), declarations(nullptr), commands(cmds) {}
     ~MainNode()
     {
         delete declarations;
@@ -535,7 +590,7 @@ public:
 class ProcedureNode : public AstNode
 {
 public:
-    explicit ProcedureNode(ProcedureHeadNode *args, DeclarationsNode *decls, CommandsNode *comms = nullptr) : arguments(args), declarations(decls), commands(comms) {}
+    explicit ProcedureNode(ProcedureHeadNode *args, DeclarationsNode *decls, CommandsNode *comms = nullptr) : AstNode(NodeKind::Procedure), arguments(args), declarations(decls), commands(comms) {}
     ~ProcedureNode()
     {
         delete arguments;
@@ -561,11 +616,13 @@ public:
     ProcedureHeadNode *arguments;
     DeclarationsNode *declarations;
     CommandsNode *commands;
+    bool unused = false; // every call goes to a clone; kept only to report its errors
 };
 
 class ProceduresNode : public AstNode
 {
 public:
+    ProceduresNode() : AstNode(NodeKind::Procedures) {}
     ~ProceduresNode()
     {
         for (auto proc : procedures)
@@ -590,7 +647,7 @@ public:
 class ProgramNode : public AstNode
 {
 public:
-    ProgramNode() : main(nullptr), procedures(nullptr) {}
+    ProgramNode() : AstNode(NodeKind::Program), main(nullptr), procedures(nullptr) {}
     void addProcedures(ProceduresNode *procs)
     {
         procedures = procs;
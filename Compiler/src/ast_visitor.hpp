@@ -0,0 +1,247 @@
+#ifndef AST_VISITOR_HPP
+#define AST_VISITOR_HPP
+
+#include <string>
+
+#include "ast.hpp"
+
+// Base class for passes walking the AST. visit() dispatches on the node kind;
+// every visit_* method walks the children by default, so a pass overrides only
+// the nodes it cares about. procName follows the same convention as the code
+// generator: procedure name inside a procedure, "" inside the main program.
+class AstVisitor
+{
+public:
+    std::string procName;
+
+    virtual ~AstVisitor() = default;
+
+    void visit(AstNode *node)
+    {
+        if (!node)
+        {
+            return;
+        }
+
+        switch (node->kind)
+        {
+        case NodeKind::Identifier:
+            visit_identifier(static_cast<IdentifierNode *>(node));
+            break;
+        case NodeKind::Value:
+            visit_value(static_cast<ValueNode *>(node));
+            break;
+        case NodeKind::Argument:
+            visit_argument(static_cast<ArgumentNode *>(node));
+            break;
+        case NodeKind::ArgumentsDeclaration:
+            visit_arguments_declaration(static_cast<ArgumentsDeclarationNode *>(node));
+            break;
+        case NodeKind::ProcedureHead:
+            visit_procedure_head(static_cast<ProcedureHeadNode *>(node));
+            break;
+        case NodeKind::ProcedureCallArguments:
+            visit_procedure_call_arguments(static_cast<ProcedureCallArguments *>(node));
+            break;
+        case NodeKind::BinaryExpression:
+            visit_binary_expression(static_cast<BinaryExpressionNode *>(node));
+            break;
+        case NodeKind::Condition:
+            visit_condition(static_cast<ConditionNode *>(node));
+            break;
+        case NodeKind::Declarations:
+            visit_declarations(static_cast<DeclarationsNode *>(node));
+            break;
+        case NodeKind::Commands:
+            visit_commands(static_cast<CommandsNode *>(node));
+            break;
+        case NodeKind::Assign:
+            visit_assign(static_cast<AssignNode *>(node));
+            break;
+        case NodeKind::If:
+            visit_if(static_cast<IfNode *>(node));
+            break;
+        case NodeKind::While:
+            visit_while(static_cast<WhileNode *>(node));
+            break;
+        case NodeKind::RepeatUntil:
+            visit_repeat_until(static_cast<RepeatUntilNode *>(node));
+            break;
+        case NodeKind::ForTo:
+            visit_for_to(static_cast<ForToNode *>(node));
+            break;
+        case NodeKind::ForDownTo:
+            visit_for_downto(static_cast<ForDownToNode *>(node));
+            break;
+        case NodeKind::ProcedureCall:
+            visit_procedure_call(static_cast<ProcedureCallNode *>(node));
+            break;
+        case NodeKind::Write:
+            visit_write(static_cast<WriteNode *>(node));
+            break;
+        case NodeKind::Read:
+            visit_read(static_cast<ReadNode *>(node));
+            break;
+        case NodeKind::Main:
+            visit_main(static_cast<MainNode *>(node));
+            break;
+        case NodeKind::Procedure:
+            visit_procedure(static_cast<ProcedureNode *>(node));
+            break;
+        case NodeKind::Procedures:
+            visit_procedures(static_cast<ProceduresNode *>(node));
+            break;
+        case NodeKind::Program:
+            visit_program(static_cast<ProgramNode *>(node));
+            break;
+        }
+    }
+
+    virtual void visit_identifier(IdentifierNode *node)
+    {
+        visit(node->index_var);
+    }
+
+    virtual void visit_value(ValueNode *node)
+    {
+        visit(node->identifier);
+    }
+
+    virtual void visit_argument(ArgumentNode *) {}
+
+    virtual void visit_arguments_declaration(ArgumentsDeclarationNode *node)
+    {
+        for (const auto &arg : node->arguments)
+        {
+            visit(arg);
+        }
+    }
+
+    virtual void visit_procedure_head(ProcedureHeadNode *node)
+    {
+        visit(node->arguments);
+    }
+
+    virtual void visit_procedure_call_arguments(ProcedureCallArguments *node)
+    {
+        for (const auto &arg : node->arguments)
+        {
+            visit(arg);
+        }
+    }
+
+    virtual void visit_binary_expression(BinaryExpressionNode *node)
+    {
+        visit(node->left);
+        visit(node->right);
+    }
+
+    virtual void visit_condition(ConditionNode *node)
+    {
+        visit(node->left);
+        visit(node->right);
+    }
+
+    virtual void visit_declarations(DeclarationsNode *node)
+    {
+        for (const auto &decl : node->declarations)
+        {
+            visit(decl);
+        }
+    }
+
+    virtual void visit_commands(CommandsNode *node)
+    {
+        for (const auto &cmd : node->commands)
+        {
+            visit(cmd);
+        }
+    }
+
+    virtual void visit_assign(AssignNode *node)
+    {
+        visit(node->identifier);
+        visit(node->expression);
+    }
+
+    virtual void visit_if(IfNode *node)
+    {
+        visit(node->condition);
+        visit(node->thenCommands);
+        visit(node->elseCommands);
+    }
+
+    virtual void visit_while(WhileNode *node)
+    {
+        visit(node->condition);
+        visit(node->commands);
+    }
+
+    virtual void visit_repeat_until(RepeatUntilNode *node)
+    {
+        visit(node->commands);
+        visit(node->condition);
+    }
+
+    virtual void visit_for_to(ForToNode *node)
+    {
+        visit(node->pidentifier);
+        visit(node->fromValue);
+        visit(node->toValue);
+        visit(node->commands);
+    }
+
+    virtual void visit_for_downto(ForDownToNode *node)
+    {
+        visit(node->pidentifier);
+        visit(node->fromValue);
+        visit(node->toValue);
+        visit(node->commands);
+    }
+
+    virtual void visit_procedure_call(ProcedureCallNode *node)
+    {
+        visit(node->arguments);
+    }
+
+    virtual void visit_write(WriteNode *node)
+    {
+        visit(node->node);
+    }
+
+    virtual void visit_read(ReadNode *node)
+    {
+        visit(node->identifier);
+    }
+
+    virtual void visit_main(MainNode *node)
+    {
+        procName = "";
+        visit(node->declarations);
+        visit(node->commands);
+    }
+
+    virtual void visit_procedure(ProcedureNode *node)
+    {
+        procName = *node->arguments->procedureName;
+        visit(node->arguments);
+        visit(node->declarations);
+        visit(node->commands);
+    }
+
+    virtual void visit_procedures(ProceduresNode *node)
+    {
+        for (const auto &proc : node->procedures)
+        {
+            visit(proc);
+        }
+    }
+
+    virtual void visit_program(ProgramNode *node)
+    {
+        visit(node->procedures);
+        visit(node->main);
+    }
+};
+
+#endif // AST_VISITOR_HPP
@@ -0,0 +1,263 @@
+#ifndef BINARY_PROGRAM_HPP
+#define BINARY_PROGRAM_HPP
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+
+#include "instruction.hpp"
+#include "debug_map.hpp"
+#include "output_writer.hpp"
+
+// Binary encoding of a compiled program (--binary), read back without any
+// tokenizing. Unsigned numbers are LEB128 varints, signed ones are zigzag
+// encoded first so that small negative jumps stay one byte:
+//
+//   "MRB" 1                   magic and format version
+//   <instruction count>
+//   <max memory address>      highest cell the program uses
+//   <flags>                   bit 0: a debug section follows the code
+//                             bit 1: the max address is only a lower bound
+//   <opcode byte> [<operand>] per instruction; HALF and HALT have no operand
+//   <entry count>             debug section, the entries of the -g map:
+//   <index delta> <line> <procedure> <construct>
+//                             strings are a length followed by the bytes
+class BinaryProgram
+{
+public:
+    static const unsigned char VERSION = 1;
+    static const unsigned long long DEBUG_SECTION = 1;
+    static const unsigned long long MAX_ADDRESS_LOWER_BOUND = 2;
+
+    std::vector<Instruction> instructions;
+    long long maxAddress = 0;
+    bool maxAddressLowerBound = false; // from direct_max_address, not the frame layout
+    bool hasDebugMap = false;
+    DebugMap debugMap;
+
+    // Whether the file starts with the binary magic; text programs never do.
+    static bool is_binary(const std::string &fileName)
+    {
+        std::ifstream in(fileName, std::ios::binary);
+        char magic[4] = {};
+        return in.read(magic, 4) && std::string(magic, 3) == "MRB";
+    }
+
+    // Highest cell named directly by an operand. Without the code generator's
+    // frame layout this is all that is known of a program read from text;
+    // cells reached only through LOADI and STOREI may lie above it.
+    static long long direct_max_address(const std::vector<Instruction> &instructions)
+    {
+        long long max = 0;
+        for (const auto &inst : instructions)
+        {
+            if (has_operand(inst.op) && !is_jump(inst.op) && inst.op != Opcode::SET)
+            {
+                max = std::max(max, inst.arg);
+            }
+        }
+        return max;
+    }
+
+    std::string encode() const
+    {
+        std::string out = "MRB";
+        out.push_back(char(VERSION));
+        put_unsigned(out, instructions.size());
+        put_unsigned(out, maxAddress);
+        put_unsigned(out, (hasDebugMap ? DEBUG_SECTION : 0) | (maxAddressLowerBound ? MAX_ADDRESS_LOWER_BOUND : 0));
+        for (const auto &inst : instructions)
+        {
+            out.push_back(char(inst.op));
+            if (has_operand(inst.op))
+            {
+                put_signed(out, inst.arg);
+            }
+        }
+        if (hasDebugMap)
+        {
+            put_unsigned(out, debugMap.entries.size());
+            long long previous = 0;
+            for (const auto &entry : debugMap.entries)
+            {
+                put_unsigned(out, entry.index - previous);
+                put_unsigned(out, entry.line);
+                put_string(out, entry.procedure);
+                put_string(out, entry.construct);
+                previous = entry.index;
+            }
+        }
+        return out;
+    }
+
+    // Returns the size of the file.
+    long long write(const std::string &fileName) const
+    {
+        OutputWriter out(fileName);
+        out.write_bytes(encode());
+        out.close();
+        return out.bytesWritten();
+    }
+
+    static BinaryProgram decode(const std::string &bytes, const std::string &fileName)
+    {
+        Decoder in(bytes, fileName);
+        if (bytes.size() < 4 || bytes.compare(0, 3, "MRB") != 0)
+        {
+            in.fail();
+        }
+        if ((unsigned char)bytes[3] != VERSION)
+        {
+            throw std::runtime_error("Unsupported binary program version " + std::to_string((unsigned char)bytes[3]) +
+                                     " in " + fileName);
+        }
+        in.position = 4;
+
+        BinaryProgram program;
+        unsigned long long count = in.get_unsigned();
+        program.maxAddress = in.get_unsigned();
+        unsigned long long flags = in.get_unsigned();
+        program.hasDebugMap = (flags & DEBUG_SECTION) != 0;
+        program.maxAddressLowerBound = (flags & MAX_ADDRESS_LOWER_BOUND) != 0;
+        // every instruction takes at least its opcode byte
+        if (count > bytes.size() - in.position)
+        {
+            in.fail();
+        }
+        program.instructions.reserve(count);
+        for (unsigned long long i = 0; i < count; i++)
+        {
+            unsigned char op = in.get_byte();
+            if (op > (unsigned char)Opcode::HALT)
+            {
+                in.fail();
+            }
+            Instruction inst = {Opcode(op), 0};
+            if (has_operand(inst.op))
+            {
+                inst.arg = in.get_signed();
+            }
+            program.instructions.push_back(inst);
+        }
+        if (program.hasDebugMap)
+        {
+            unsigned long long entries = in.get_unsigned();
+            long long index = 0;
+            for (unsigned long long i = 0; i < entries; i++)
+            {
+                DebugEntry entry;
+                index += in.get_unsigned();
+                entry.index = index;
+                entry.line = in.get_unsigned();
+                entry.procedure = in.get_string();
+                entry.construct = in.get_string();
+                program.debugMap.entries.push_back(entry);
+            }
+        }
+        if (in.position != bytes.size())
+        {
+            in.fail();
+        }
+        return program;
+    }
+
+    static BinaryProgram read(const std::string &fileName)
+    {
+        std::ifstream in(fileName, std::ios::binary);
+        if (!in)
+        {
+            throw std::runtime_error("Could not open program " + fileName);
+        }
+        std::ostringstream bytes;
+        bytes << in.rdbuf();
+        return decode(bytes.str(), fileName);
+    }
+
+private:
+    static void put_unsigned(std::string &out, unsigned long long value)
+    {
+        while (value >= 0x80)
+        {
+            out.push_back(char((value & 0x7f) | 0x80));
+            value >>= 7;
+        }
+        out.push_back(char(value));
+    }
+
+    static void put_signed(std::string &out, long long value)
+    {
+        put_unsigned(out, ((unsigned long long)value << 1) ^ (unsigned long long)(value >> 63));
+    }
+
+    static void put_string(std::string &out, const std::string &text)
+    {
+        put_unsigned(out, text.size());
+        out += text;
+    }
+
+    struct Decoder
+    {
+        const std::string &bytes;
+        const std::string &fileName;
+        size_t position = 0;
+
+        Decoder(const std::string &bytes, const std::string &fileName) : bytes(bytes), fileName(fileName) {}
+
+        void fail() const
+        {
+            throw std::runtime_error("Malformed binary program " + fileName + " at byte: " + std::to_string(position));
+        }
+
+        unsigned char get_byte()
+        {
+            if (position >= bytes.size())
+            {
+                fail();
+            }
+            return bytes[position++];
+        }
+
+        unsigned long long get_unsigned()
+        {
+            unsigned long long value = 0;
+            for (int shift = 0; shift < 64; shift += 7)
+            {
+                unsigned char byte = get_byte();
+                if (shift == 63 && byte > 1)
+                {
+                    fail(); // more than 64 bits
+                }
+                value |= (unsigned long long)(byte & 0x7f) << shift;
+                if (!(byte & 0x80))
+                {
+                    return value;
+                }
+            }
+            fail();
+            return 0;
+        }
+
+        long long get_signed()
+        {
+            unsigned long long value = get_unsigned();
+            return (long long)(value >> 1) ^ -(long long)(value & 1);
+        }
+
+        std::string get_string()
+        {
+            unsigned long long size = get_unsigned();
+            if (size > bytes.size() - position)
+            {
+                fail();
+            }
+            std::string text = bytes.substr(position, size);
+            position += size;
+            return text;
+        }
+    };
+};
+
+#endif // BINARY_PROGRAM_HPP
@@ -0,0 +1,411 @@
+#ifndef C_GENERATOR_HPP
+#define C_GENERATOR_HPP
+
+#include <string>
+#include <sstream>
+#include <unordered_map>
+#include <utility>
+#include <stdexcept>
+
+#include "ast.hpp"
+#include "symbol_table.hpp"
+
+class CGeneratorError : public std::runtime_error
+{
+public:
+    CGeneratorError(const std::string &message, int line)
+        : std::runtime_error("\e[0;31mError:\e[0m " + message + " at line: " + std::to_string(line)) {}
+};
+
+// Second backend (--emit-c, --native): translates the program to C for a
+// native build. Scalars become C locals the C compiler keeps in registers,
+// procedures become functions taking scalar parameters by pointer and array
+// parameters as a pointer to their first element with that element's index.
+// Arrays are static, as there is no recursion. Division rounds down and the
+// remainder takes the sign of the divisor, dividing by 0 gives 0 and values
+// wrap around at 64 bits (the output is meant to be built with -fwrapv).
+// Array indices are not checked.
+class CGenerator
+{
+public:
+    explicit CGenerator(SymbolTable *symbolTable) : symbolTable(symbolTable) {}
+
+    std::string generate(ProgramNode *root)
+    {
+        code << "/* Generated by the compiler; build with: cc -O2 -fwrapv */\n"
+                "#include <stdio.h>\n"
+                "#include <stdlib.h>\n"
+                "\n"
+                "static long long imp_read(void)\n"
+                "{\n"
+                "    long long value;\n"
+                "    if (scanf(\"%lld\", &value) != 1)\n"
+                "    {\n"
+                "        fprintf(stderr, \"Missing input\\n\");\n"
+                "        exit(1);\n"
+                "    }\n"
+                "    return value;\n"
+                "}\n"
+                "\n"
+                "static long long imp_div(long long a, long long b)\n"
+                "{\n"
+                "    if (b == 0)\n"
+                "        return 0;\n"
+                "    if (b == -1)\n"
+                "        return -a;\n"
+                "    long long q = a / b;\n"
+                "    return (a % b != 0 && (a % b < 0) != (b < 0)) ? q - 1 : q;\n"
+                "}\n"
+                "\n"
+                "static long long imp_mod(long long a, long long b)\n"
+                "{\n"
+                "    if (b == 0 || b == -1)\n"
+                "        return 0;\n"
+                "    long long r = a % b;\n"
+                "    return (r != 0 && (r < 0) != (b < 0)) ? r + b : r;\n"
+                "}\n";
+
+        if (root->procedures)
+        {
+            for (const auto &proc : root->procedures->procedures)
+            {
+                generate_procedure(proc);
+            }
+        }
+        code << "\nint main(void)\n{\n";
+        if (root->main)
+        {
+            generate_declarations(root->main->declarations, "");
+            generate_commands(root->main->commands, "", 1);
+        }
+        code << "    return 0;\n}\n";
+        return code.str();
+    }
+
+private:
+    SymbolTable *symbolTable;
+    std::ostringstream code;
+    std::unordered_map<std::string, long long> arrayStart;     // local arrays: index of their first element
+    std::unordered_map<std::string, std::string> iterators;    // FOR loops being generated: C name
+    std::unordered_map<std::string, int> declaredProcedures;   // name -> number of parameters
+    int loops = 0;
+
+    static std::string getName(const std::string &func, const std::string &var)
+    {
+        return func + "::" + var;
+    }
+
+    static std::string indent(int depth)
+    {
+        return std::string(4 * depth, ' ');
+    }
+
+    void generate_procedure(ProcedureNode *proc)
+    {
+        std::string procName = *proc->arguments->procedureName;
+        code << "\nstatic void p_" << procName << "(";
+        int count = 0;
+        if (proc->arguments->arguments)
+        {
+            for (const auto &arg : proc->arguments->arguments->arguments)
+            {
+                code << (count++ ? ", " : "");
+                if (arg->isArray)
+                {
+                    code << "long long *v_" << *arg->argumentName << ", long long s_" << *arg->argumentName;
+                }
+                else
+                {
+                    code << "long long *v_" << *arg->argumentName;
+                }
+            }
+        }
+        code << (count ? ")\n{\n" : "void)\n{\n");
+        generate_declarations(proc->declarations, procName);
+        generate_commands(proc->commands, procName, 1);
+        code << "}\n";
+        declaredProcedures[procName] = count;
+    }
+
+    void generate_declarations(DeclarationsNode *decls, const std::string &procName)
+    {
+        if (!decls)
+        {
+            return;
+        }
+        for (const auto &decl : decls->declarations)
+        {
+            if (decl->isArray)
+            {
+                arrayStart[getName(procName, *decl->name)] = decl->start;
+                long long size = decl->end >= decl->start ? decl->end - decl->start + 1 : 1;
+                code << "    static long long v_" << *decl->name << "[" << size << "];\n";
+            }
+            else
+            {
+                code << "    long long v_" << *decl->name << " = 0;\n";
+            }
+        }
+    }
+
+    // C lvalue of an identifier.
+    std::string reference(IdentifierNode *id, const std::string &procName, int line)
+    {
+        std::string name = getName(procName, id->getName());
+        try
+        {
+            if (id->isElement)
+            {
+                std::string index = id->index_var ? reference(id->index_var, procName, line)
+                                                  : std::to_string(id->index_const);
+                if (symbolTable->getArrPid(name).second)
+                {
+                    return "v_" + id->getName() + "[" + index + " - s_" + id->getName() + "]";
+                }
+                return "v_" + id->getName() + "[" + index + " - (" + std::to_string(arrayStart[name]) + ")]";
+            }
+            auto it = iterators.find(name);
+            if (it != iterators.end())
+            {
+                return it->second;
+            }
+            if (symbolTable->getPid(name).second)
+            {
+                return "(*v_" + id->getName() + ")";
+            }
+            return "v_" + id->getName();
+        }
+        catch (const CGeneratorError &)
+        {
+            throw;
+        }
+        catch (const std::runtime_error &e)
+        {
+            throw CGeneratorError(e.what(), line);
+        }
+    }
+
+    std::string value(ValueNode *node, const std::string &procName, int line)
+    {
+        if (node->identifier)
+        {
+            return reference(node->identifier, procName, line);
+        }
+        return literal(node->value);
+    }
+
+    // LLONG_MIN has no literal of its own
+    static std::string literal(long long value)
+    {
+        if (value == -9223372036854775807LL - 1)
+        {
+            return "(-9223372036854775807LL - 1)";
+        }
+        return std::to_string(value) + "LL";
+    }
+
+    std::string target(IdentifierNode *id, const std::string &procName, int line)
+    {
+        if (!id->isElement && iterators.count(getName(procName, id->getName())))
+        {
+            throw CGeneratorError("Cannot modify iterator: " + getName(procName, id->getName()), line);
+        }
+        return reference(id, procName, line);
+    }
+
+    std::string condition(ConditionNode *cond, const std::string &procName, int line)
+    {
+        std::string op = cond->op == "=" ? "==" : cond->op;
+        return value(cond->left, procName, line) + " " + op + " " + value(cond->right, procName, line);
+    }
+
+    void generate_commands(CommandsNode *cmds, const std::string &procName, int depth)
+    {
+        if (!cmds)
+        {
+            return;
+        }
+        for (const auto &cmd : cmds->commands)
+        {
+            generate_command(cmd, procName, depth);
+        }
+    }
+
+    void generate_command(CommandNode *cmd, const std::string &procName, int depth)
+    {
+        int line = cmd->getLineNumber();
+        std::string pad = indent(depth);
+        switch (cmd->kind)
+        {
+        case NodeKind::Assign:
+        {
+            AssignNode *assign = static_cast<AssignNode *>(cmd);
+            std::string expr;
+            if (assign->expression->kind == NodeKind::BinaryExpression)
+            {
+                BinaryExpressionNode *binary = static_cast<BinaryExpressionNode *>(assign->expression);
+                std::string left = value(binary->left, procName, line);
+                std::string right = value(binary->right, procName, line);
+                if (binary->op == "/")
+                {
+                    expr = "imp_div(" + left + ", " + right + ")";
+                }
+                else if (binary->op == "%")
+                {
+                    expr = "imp_mod(" + left + ", " + right + ")";
+                }
+                else
+                {
+                    expr = left + " " + binary->op + " " + right;
+                }
+            }
+            else
+            {
+                expr = value(static_cast<ValueNode *>(assign->expression), procName, line);
+            }
+            code << pad << target(assign->identifier, procName, line) << " = " << expr << ";\n";
+            break;
+        }
+        case NodeKind::If:
+        {
+            IfNode *ifNode = static_cast<IfNode *>(cmd);
+            code << pad << "if (" << condition(ifNode->condition, procName, line) << ")\n" << pad << "{\n";
+            generate_commands(ifNode->thenCommands, procName, depth + 1);
+            code << pad << "}\n";
+            if (ifNode->elseCommands)
+            {
+                code << pad << "else\n" << pad << "{\n";
+                generate_commands(ifNode->elseCommands, procName, depth + 1);
+                code << pad << "}\n";
+            }
+            break;
+        }
+        case NodeKind::While:
+        {
+            WhileNode *whileNode = static_cast<WhileNode *>(cmd);
+            code << pad << "while (" << condition(whileNode->condition, procName, line) << ")\n" << pad << "{\n";
+            generate_commands(whileNode->commands, procName, depth + 1);
+            code << pad << "}\n";
+            break;
+        }
+        case NodeKind::RepeatUntil:
+        {
+            RepeatUntilNode *repeat = static_cast<RepeatUntilNode *>(cmd);
+            code << pad << "do\n" << pad << "{\n";
+            generate_commands(repeat->commands, procName, depth + 1);
+            code << pad << "} while (!(" << condition(repeat->condition, procName, line) << "));\n";
+            break;
+        }
+        case NodeKind::ForTo:
+        {
+            ForToNode *forNode = static_cast<ForToNode *>(cmd);
+            generate_for(forNode->pidentifier, forNode->fromValue, forNode->toValue, forNode->commands, false, procName, depth, line);
+            break;
+        }
+        case NodeKind::ForDownTo:
+        {
+            ForDownToNode *forNode = static_cast<ForDownToNode *>(cmd);
+            generate_for(forNode->pidentifier, forNode->fromValue, forNode->toValue, forNode->commands, true, procName, depth, line);
+            break;
+        }
+        case NodeKind::ProcedureCall:
+            generate_procedure_call(static_cast<ProcedureCallNode *>(cmd), procName, depth);
+            break;
+        case NodeKind::Read:
+            code << pad << target(static_cast<ReadNode *>(cmd)->identifier, procName, line) << " = imp_read();\n";
+            break;
+        case NodeKind::Write:
+            code << pad << "printf(\"%lld\\n\", " << value(static_cast<WriteNode *>(cmd)->node, procName, line) << ");\n";
+            break;
+        default:
+            break;
+        }
+    }
+
+    // The bound is fixed on entry, like in the generated code.
+    void generate_for(IdentifierNode *iterator, ValueNode *fromValue, ValueNode *toValue, CommandsNode *commands,
+                      bool down, const std::string &procName, int depth, int line)
+    {
+        std::string name = getName(procName, iterator->getName());
+        std::string number = std::to_string(loops++);
+        std::string cName = "i_" + iterator->getName() + "_" + number;
+        std::string bound = "e_" + number;
+        std::string pad = indent(depth);
+        code << pad << "for (long long " << cName << " = " << value(fromValue, procName, line) << ", " << bound << " = "
+             << value(toValue, procName, line) << "; " << cName << (down ? " >= " : " <= ") << bound << "; "
+             << cName << (down ? "--" : "++") << ")\n"
+             << pad << "{\n";
+
+        auto outer = iterators.find(name);
+        bool hides = outer != iterators.end();
+        std::string outerName = hides ? outer->second : "";
+        iterators[name] = cName;
+        generate_commands(commands, procName, depth + 1);
+        if (hides)
+        {
+            iterators[name] = outerName;
+        }
+        else
+        {
+            iterators.erase(name);
+        }
+        code << pad << "}\n";
+    }
+
+    void generate_procedure_call(ProcedureCallNode *call, const std::string &procName, int depth)
+    {
+        int line = call->getLineNumber();
+        std::string name = *call->procedureName;
+        auto declared = declaredProcedures.find(name);
+        if (declared == declaredProcedures.end())
+        {
+            throw CGeneratorError("Procedure " + name + " not declared", line);
+        }
+        const auto &params = symbolTable->funkcja_param[name];
+        size_t count = call->arguments ? call->arguments->getArguments().size() : 0;
+        if (count != params.size())
+        {
+            throw CGeneratorError("Wrong param in procedure " + name, line);
+        }
+        code << indent(depth) << "p_" << name << "(";
+        for (size_t i = 0; i < count; i++)
+        {
+            IdentifierNode *arg = call->arguments->getArguments()[i];
+            std::string argName = getName(procName, arg->getName());
+            code << (i ? ", " : "");
+            try
+            {
+                if (params[i].second)
+                {
+                    if (symbolTable->getArrPid(argName).second)
+                    {
+                        code << "v_" << arg->getName() << ", s_" << arg->getName();
+                    }
+                    else
+                    {
+                        code << "v_" << arg->getName() << ", " << literal(arrayStart[argName]);
+                    }
+                }
+                else if (iterators.count(argName))
+                {
+                    code << "&" << iterators[argName];
+                }
+                else if (symbolTable->getPid(argName).second)
+                {
+                    code << "v_" << arg->getName();
+                }
+                else
+                {
+                    code << "&v_" << arg->getName();
+                }
+            }
+            catch (const std::runtime_error &e)
+            {
+                throw CGeneratorError("Wrong param in procedure " + name, line);
+            }
+        }
+        code << ");\n";
+    }
+};
+
+#endif // C_GENERATOR_HPP
@@ -0,0 +1,39 @@
+#ifndef CALL_GRAPH_HPP
+#define CALL_GRAPH_HPP
+
+#include <string>
+#include <set>
+#include <unordered_map>
+
+#include "ast.hpp"
+#include "ast_visitor.hpp"
+
+// Procedures called directly from the body of every procedure ("" for the
+// main program). Procedures are declared before they are called, so the
+// graph has no cycles and callees always precede their callers.
+class CallGraph : public AstVisitor
+{
+public:
+    std::unordered_map<std::string, std::set<std::string>> callees;
+
+    void visit_procedure(ProcedureNode *node) override
+    {
+        procName = *node->arguments->procedureName;
+        callees[procName];
+        visit(node->commands);
+    }
+
+    void visit_main(MainNode *node) override
+    {
+        procName = "";
+        callees[procName];
+        visit(node->commands);
+    }
+
+    void visit_procedure_call(ProcedureCallNode *node) override
+    {
+        callees[procName].insert(*node->procedureName);
+    }
+};
+
+#endif // CALL_GRAPH_HPP
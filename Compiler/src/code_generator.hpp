@@ -5,8 +5,21 @@
 #include <vector>
 #include <string>
 #include <unordered_set>
+#include <algorithm>
+#include <climits>
 
 #include "ast.hpp"
+#include "instruction.hpp"
+#include "output_writer.hpp"
+#include "stats.hpp"
+#include "debug_map.hpp"
+#include "profile_data.hpp"
+#include "pass_manager.hpp"
+#include "procedure_cloning.hpp"
+#include "parameter_analysis.hpp"
+#include "call_graph.hpp"
+#include "mod_ref.hpp"
+#include "loop_info.hpp"
 #include "symbol_table.hpp"
 
 
@@ -21,10 +34,114 @@ public:
 class CodeGenerator
 {
 public:
-    std::vector<std::string> instructions;
+    std::vector<Instruction> instructions;
     std::unordered_map<std::string, long long> function_start;
     std::unordered_set<std::string> declared_functions;
     SymbolTable *symbolTable;
+    CompileStats *stats = nullptr; // -ftime-report
+    long long patchedJumps = 0;
+    std::vector<long long> nestedEmitted;
+    DebugMap *debugMap = nullptr; // -g
+    std::vector<DebugEntry> debugScopes;
+    BlockMap *blockMap = nullptr;           // -fprofile-generate
+    const ProfileData *profile = nullptr;   // -fprofile-use
+    std::unordered_map<const AstNode *, int> nodeIds;
+
+    // Arm of an if moved behind the end of its procedure (-fprofile-use). It is
+    // generated with the variables visible at the if, as FOR loops generated
+    // in between may rebind iterator names.
+    struct OutOfLineArm
+    {
+        IfNode *ifNode;
+        CommandsNode *commands;
+        long long jump;   // conditional jump entering the arm
+        long long resume; // first instruction after the if
+        std::unordered_map<std::string, long long> variables;
+        long long forDepth;
+        std::unordered_map<std::string, long long> constants;
+    };
+    std::vector<OutOfLineArm> outOfLineArms;
+    PassManager *passes = nullptr;          // instruction passes run on every procedure; none without
+    std::vector<long long> returnAddressSets; // SETs whose operand is a code address
+    bool overlayFrames = true;              // -fno-frame-overlay gives every procedure cells of its own
+    CallGraph callGraph;
+    ModRefSummary modRef;                   // parameters every procedure may read and write
+    std::unordered_map<std::string, long long> frameEnd;
+    long long frameTemporaries = 0;         // first temporary of the procedure being generated
+    long long memoryHighWater = SymbolTable::FIRST_CELL;
+    long long memoryWithoutOverlay = SymbolTable::FIRST_CELL;
+    std::vector<long long> loopCells;       // iterator, bound and unrolling limit of the FOR loops at each depth
+    long long forDepth = 0;
+    static const long long LOOP_CELLS = 3;
+    bool unrollLoops = true;                // -fno-unroll-loops
+    long long unrollFactor = 4;             // -funroll-factor=<n>
+    long long unrollBudget = 256;           // -funroll-budget=<n>, instructions
+    std::unordered_map<std::string, long long> constantIterators; // iterators of fully unrolled loops
+    std::unordered_map<const CommandNode *, const AstNode *> iterationCounters; // increments of FOR loops -> the loop
+    std::unordered_set<long long> nonNegativeIterators;           // cells of iterators of the loops being generated that stay >= 0
+    bool copyInOut = true;                                     // -fno-copy-in-out turns it off
+    std::unordered_map<std::string, long long> parameterCopies; // parameter -> local copy
+    std::pair<long long, long long> divmodCells;                // quotient and remainder of the last division
+    bool sharedDivmod = false;                                  // the next division or modulo reuses them
+
+    // -fprofile-use: arithmetic the profile never saw run calls one of these
+    // shared routines instead of being expanded in place.
+    struct ArithmeticRoutine
+    {
+        long long start;                         // -1 unless emitted
+        std::pair<long long, long long> results; // quotient and remainder left by divmod
+
+        ArithmeticRoutine() : start(-1), results(0, 0) {}
+    };
+    ArithmeticRoutine multiplyRoutine;
+    ArithmeticRoutine divmodRoutine;
+    long long routineOperands[3] = {0, 0, 0};                   // left, right and return address of either
+    bool outOfLineArithmetic = false;                           // the assignment being generated calls them
+    const std::string arithmeticFrame = "#arithmetic";
+    long long targetCell = 0;                                   // address of the array element being assigned,
+    bool targetDirect = false;                                  // or the element itself
+    IdentifierNode *addressedElement = nullptr;                 // element whose address is in targetCell while its value is computed
+
+    // Records in the debug map which source construct the instructions emitted
+    // while it is alive belong to. Nodes without a line inherit the enclosing one.
+    class DebugScope
+    {
+    public:
+        DebugScope(CodeGenerator *generator, const AstNode *node, const std::string &procName, const char *construct)
+            : generator(generator->debugMap ? generator : nullptr)
+        {
+            if (!this->generator)
+            {
+                return;
+            }
+            auto &scopes = generator->debugScopes;
+            int line = node ? node->getLineNumber() : 0;
+            if (line == 0 && !scopes.empty())
+            {
+                line = scopes.back().line;
+            }
+            scopes.push_back({(long long)generator->instructions.size(), line, procName, construct});
+            generator->debugMap->add(generator->instructions.size(), line, procName, construct);
+        }
+
+        ~DebugScope()
+        {
+            if (!generator)
+            {
+                return;
+            }
+            auto &scopes = generator->debugScopes;
+            scopes.pop_back();
+            if (!scopes.empty())
+            {
+                const DebugEntry &outer = scopes.back();
+                generator->debugMap->add(generator->instructions.size(), outer.line, outer.procedure, outer.construct);
+            }
+        }
+
+    private:
+        CodeGenerator *generator;
+    };
 
     std::string
     getName(std::string func, std::string var)
@@ -32,108 +149,248 @@ public:
         return func + "::" + var;
     }
 
-    bool generate_load_to_RAX(ValueNode *node, std::string procName)
+    long long emit(Opcode op, long long arg = 0)
     {
-        if (node->identifier)
+        instructions.push_back({op, arg});
+        return instructions.size() - 1;
+    }
+
+    // fills in the operand of an instruction emitted before its target was known
+    void patch(long long idx, long long arg)
+    {
+        instructions[idx].arg = arg;
+        patchedJumps++;
+    }
+
+    // -fprofile-generate: the counter is read off the next emitted instruction
+    void record_block(const AstNode *node, const char *counter)
+    {
+        if (!blockMap)
         {
-            std::string name = getName(procName, node->identifier->getName());
-            if (node->identifier->isElement)
-            {
-                if (node->identifier->index_var)
-                {
-                    ValueNode *vn = new ValueNode(node->identifier->index_var);
-                    generate_load_to_RAX(vn, procName);
-                }
-                else
-                {
-                    instructions.push_back("SET " + std::to_string(node->identifier->index_const));
-                }
-                instructions.push_back("STORE 1");
-                std::pair<long long, bool> pid = symbolTable->getArrPid(name);
-                if (pid.second)
-                {
-                    instructions.push_back("LOAD " + std::to_string(pid.first));
-                }
-                else
-                {
-                    instructions.push_back("SET " + std::to_string(pid.first));
-                }
-                instructions.push_back("ADD 1");
-                instructions.push_back("LOADI 0");
-            }
-            else
+            return;
+        }
+        auto it = nodeIds.find(node);
+        if (it != nodeIds.end())
+        {
+            blockMap->counters.push_back({it->second, counter, (long long)instructions.size()});
+        }
+    }
+
+    // -fprofile-use: -1 when there is no profile for the node
+    long long profile_count(const AstNode *node, const char *counter) const
+    {
+        if (!profile)
+        {
+            return -1;
+        }
+        auto it = nodeIds.find(node);
+        return it == nodeIds.end() ? -1 : profile->get(it->second, counter);
+    }
+
+    // Like SymbolTable::getPid, but a parameter passed by copy-in/copy-out is
+    // its local copy, accessed directly.
+    std::pair<long long, bool> variable_pid(const std::string &name)
+    {
+        std::pair<long long, bool> pid = symbolTable->getPid(name);
+        if (pid.second)
+        {
+            auto it = parameterCopies.find(name);
+            if (it != parameterCopies.end())
             {
-                std::pair<long long, bool> pid = symbolTable->getPid(name);
-                if (pid.second)
-                {
-                    instructions.push_back("LOADI " + std::to_string(pid.first));
-                }
-                else
-                {
-                    instructions.push_back("LOAD " + std::to_string(pid.first));
-                }
+                return {it->second, false};
             }
         }
+        return pid;
+    }
+
+    static const char *construct_name(NodeKind kind)
+    {
+        switch (kind)
+        {
+        case NodeKind::Assign:
+            return "assignment";
+        case NodeKind::ProcedureCall:
+            return "procedure call";
+        case NodeKind::Read:
+            return "read";
+        case NodeKind::Write:
+            return "write";
+        case NodeKind::If:
+            return "if";
+        case NodeKind::While:
+            return "while";
+        case NodeKind::ForTo:
+            return "for to";
+        case NodeKind::ForDownTo:
+            return "for downto";
+        case NodeKind::RepeatUntil:
+            return "repeat until";
+        default:
+            return "other";
+        }
+    }
+
+    bool generate_load_to_RAX(ValueNode *node, std::string procName)
+    {
+        DebugScope scope(this, node, procName, "load");
+        if (node->identifier)
+        {
+            generate_load_identifier(node->identifier, procName);
+        }
         else
         {
-            instructions.push_back("SET " + std::to_string(node->value));
+            emit(Opcode::SET, node->value);
         }
         return true;
     }
 
-    bool generate_save_from_RAX(ValueNode *node, std::string procName, bool ignore=false)
+    void generate_load_identifier(IdentifierNode *identifier, std::string procName)
     {
-        std::string name = getName(procName, node->identifier->getName());
-        if (node->identifier->isElement)
+        std::string name = getName(procName, identifier->getName());
+        if (identifier->isElement && addressedElement && same_element(identifier, addressedElement))
         {
-            instructions.push_back("STORE 2");
-            if (node->identifier->index_var)
-            {
-                ValueNode *vn = new ValueNode(node->identifier->index_var);
-                generate_load_to_RAX(vn, procName);
-            }
-            else
-            {
-                instructions.push_back("SET " + std::to_string(node->identifier->index_const));
-            }
-            instructions.push_back("STORE 1");
-            std::pair<long long, bool> pid = symbolTable->getArrPid(name);
+            emit(Opcode::LOADI, targetCell);
+        }
+        else if (identifier->isElement)
+        {
+            generate_element_address(identifier, name, procName);
+            emit(Opcode::LOADI, 0);
+        }
+        else if (constantIterators.count(name))
+        {
+            emit(Opcode::SET, constantIterators[name]);
+        }
+        else
+        {
+            std::pair<long long, bool> pid = variable_pid(name);
             if (pid.second)
             {
-                instructions.push_back("LOAD " + std::to_string(pid.first));
+                emit(Opcode::LOADI, pid.first);
             }
             else
             {
-                instructions.push_back("SET " + std::to_string(pid.first));
+                emit(Opcode::LOAD, pid.first);
             }
-            instructions.push_back("ADD 1");
-            instructions.push_back("STORE 1");
-            instructions.push_back("LOAD 2");
-            instructions.push_back("STOREI 1");
+        }
+    }
+
+    bool generate_save_from_RAX(IdentifierNode *identifier, std::string procName, bool ignore=false)
+    {
+        DebugScope scope(this, identifier, procName, "store");
+        std::string name = getName(procName, identifier->getName());
+        if (identifier->isElement)
+        {
+            // the address was computed by generate_target_address
+            emit(targetDirect ? Opcode::STORE : Opcode::STOREI, targetCell);
+            addressedElement = nullptr;
         }
         else
         {
-            std::pair<long long, bool> pid = symbolTable->getPid(name);
+            std::pair<long long, bool> pid = variable_pid(name);
 
-            if (!ignore && (symbolTable->iterator_pid.find(pid.first) != symbolTable->iterator_pid.end()))
+            if (!ignore && (constantIterators.count(name) || symbolTable->iterator_pid.find(pid.first) != symbolTable->iterator_pid.end()))
             {
                 throw std::runtime_error("Cannot modify iterator: " + name);
             }
 
             if (pid.second)
             {
-                instructions.push_back("STOREI " + std::to_string(pid.first));
+                emit(Opcode::STOREI, pid.first);
             }
             else
             {
-                instructions.push_back("STORE " + std::to_string(pid.first));
+                emit(Opcode::STORE, pid.first);
             }
         }
         return true;
     }
 
+    // Address of an array element in the accumulator; cell 1 holds the index.
+    void generate_element_address(IdentifierNode *element, const std::string &name, std::string procName)
+    {
+        if (element->index_var)
+        {
+            DebugScope scope(this, element->index_var, procName, "load");
+            generate_load_identifier(element->index_var, procName);
+        }
+        else
+        {
+            emit(Opcode::SET, element->index_const);
+        }
+        emit(Opcode::STORE, 1);
+        std::pair<long long, bool> pid = symbolTable->getArrPid(name);
+        if (pid.second)
+        {
+            emit(Opcode::LOAD, pid.first);
+        }
+        else
+        {
+            emit(Opcode::SET, pid.first);
+        }
+        emit(Opcode::ADD, 1);
+    }
+
+    static bool same_element(const IdentifierNode *first, const IdentifierNode *second)
+    {
+        if (first->getName() != second->getName() || !first->index_var != !second->index_var)
+        {
+            return false;
+        }
+        return first->index_var ? first->index_var->getName() == second->index_var->getName()
+                                 : first->index_const == second->index_const;
+    }
+
+    static bool is_element(const ValueNode *value)
+    {
+        return value->identifier && value->identifier->isElement;
+    }
+
+    static bool loads_elements(ExpressionNode *expression)
+    {
+        if (expression->kind == NodeKind::Value)
+        {
+            return is_element(static_cast<ValueNode *>(expression));
+        }
+        if (expression->kind == NodeKind::BinaryExpression)
+        {
+            BinaryExpressionNode *binary = static_cast<BinaryExpressionNode *>(expression);
+            return is_element(binary->left) || is_element(binary->right);
+        }
+        return false;
+    }
+
+    // An array element is assigned through an address computed before its
+    // value, so the value can be stored straight from the accumulator. The
+    // address goes to cell 1 unless computing the value loads array elements,
+    // which use cell 1 for their index, and to cell 2 otherwise; loads of the
+    // assigned element itself then use it. An element of a local array at a
+    // constant index is stored to directly.
+    void generate_target_address(IdentifierNode *target, std::string procName, bool loadsElements)
+    {
+        if (!target->isElement)
+        {
+            return;
+        }
+        DebugScope scope(this, target, procName, "store");
+        std::string name = getName(procName, target->getName());
+        std::pair<long long, bool> pid = symbolTable->getArrPid(name);
+        long long address;
+        targetDirect = !target->index_var && !pid.second &&
+                       !__builtin_add_overflow(pid.first, target->index_const, &address) && address >= SymbolTable::FIRST_CELL;
+        if (targetDirect)
+        {
+            targetCell = address;
+            return;
+        }
+        generate_element_address(target, name, procName);
+        targetCell = loadsElements ? 2 : 1;
+        emit(Opcode::STORE, targetCell);
+        addressedElement = loadsElements ? target : nullptr;
+    }
+
     bool generate_binary_expression(BinaryExpressionNode *expr, std::string procName)
     {
+        size_t before = instructions.size();
         if (expr->op == "+")
         {
             generate_addition(expr->left, expr->right, procName);
@@ -155,280 +412,616 @@ public:
             generate_modulo(expr->left, expr->right, procName);
         }
 
+        if (stats)
+        {
+            stats->count("instructions in expressions " + expr->op, instructions.size() - before);
+        }
         return true;
     }
 
     bool generate_substract(ValueNode *left, ValueNode *right, std::string procName)
     {
+        DebugScope scope(this, left, procName, "subtraction");
         generate_load_to_RAX(right, procName);
-        // instructions.push_back("PUT 0");
+        // emit(Opcode::PUT, 0);
         long long tmpPid = symbolTable->getNewPid();
-        instructions.push_back("STORE " + std::to_string(tmpPid));
+        emit(Opcode::STORE, tmpPid);
         generate_load_to_RAX(left, procName);
-        // instructions.push_back("PUT 0");
-        instructions.push_back("SUB " + std::to_string(tmpPid));
+        // emit(Opcode::PUT, 0);
+        emit(Opcode::SUB, tmpPid);
         // po wykonaniu operacji wynik jest w RAX
         return true;
     }
 
     bool generate_addition(ValueNode *left, ValueNode *right, std::string procName)
     {
+        DebugScope scope(this, left, procName, "addition");
         generate_load_to_RAX(right, procName);
         long long tmpPid = symbolTable->getNewPid();
-        instructions.push_back("STORE " + std::to_string(tmpPid));
+        emit(Opcode::STORE, tmpPid);
         generate_load_to_RAX(left, procName);
-        instructions.push_back("ADD " + std::to_string(tmpPid));
+        emit(Opcode::ADD, tmpPid);
         // po wykonaniu operacji wynik jest w RAX
         return true;
     }
 
-    bool generate_sign(long long currPid, long long signPid)
+    // Product of two values. With a constant factor the other one is shifted
+    // and added along the bits of the constant; otherwise the smaller magnitude
+    // drives a shift-and-add loop over its bits, and the sign is only tracked
+    // for operands not known at compile time.
+    bool generate_multiplication(ValueNode *left, ValueNode *right, std::string procName)
     {
-        instructions.push_back("JNEG 2");
-        instructions.push_back("JUMP 6");
-        instructions.push_back("SET 1");
-        instructions.push_back("ADD " + std::to_string(signPid));
-        instructions.push_back("STORE " + std::to_string(signPid));
-        instructions.push_back("SET 0");
-        instructions.push_back("SUB " + std::to_string(currPid));
-        instructions.push_back("STORE " + std::to_string(currPid));
+        DebugScope scope(this, left, procName, "multiplication");
+        long long leftValue, rightValue;
+        bool leftConstant = constant_value(left, procName, leftValue);
+        bool rightConstant = constant_value(right, procName, rightValue);
+        long long product;
+        if (leftConstant && rightConstant && !__builtin_mul_overflow(leftValue, rightValue, &product))
+        {
+            emit(Opcode::SET, product);
+            return true;
+        }
+        if (rightConstant && rightValue != LLONG_MIN)
+        {
+            generate_multiplication_by_constant(left, rightValue, procName);
+            return true;
+        }
+        if (leftConstant && leftValue != LLONG_MIN)
+        {
+            generate_multiplication_by_constant(right, leftValue, procName);
+            return true;
+        }
+        if (outOfLineArithmetic && multiplyRoutine.start >= 0)
+        {
+            call_arithmetic_routine(multiplyRoutine, left, right, procName);
+            return true;
+        }
+
+        long long aPid = symbolTable->getNewPid();
+        long long bPid = symbolTable->getNewPid();
+        long long halfPid = symbolTable->getNewPid();
+        long long resultPid = symbolTable->getNewPid();
+        std::vector<long long> signs;
+        generate_magnitude(right, bPid, procName, signs);
+        generate_magnitude(left, aPid, procName, signs);
+
+        // the smaller magnitude is the multiplier
+        emit(Opcode::SUB, bPid);
+        emit(Opcode::JPOS, 7);
+        emit(Opcode::LOAD, bPid);
+        emit(Opcode::STORE, halfPid);
+        emit(Opcode::LOAD, aPid);
+        emit(Opcode::STORE, bPid);
+        emit(Opcode::LOAD, halfPid);
+        emit(Opcode::STORE, aPid);
+        emit(Opcode::SET, 0);
+        emit(Opcode::STORE, resultPid);
+
+        // two bits per trip, the multiplier alternating between its two cells
+        long long loopIdx = instructions.size();
+        std::vector<long long> doneJumps;
+        for (long long from : {bPid, halfPid})
+        {
+            long long to = from == bPid ? halfPid : bPid;
+            emit(Opcode::LOAD, from);
+            doneJumps.push_back(emit(Opcode::JZERO));
+            emit(Opcode::HALF);
+            emit(Opcode::STORE, to);
+            emit(Opcode::ADD, 0);
+            emit(Opcode::SUB, from);
+            emit(Opcode::JZERO, 4);
+            emit(Opcode::LOAD, resultPid);
+            emit(Opcode::ADD, aPid);
+            emit(Opcode::STORE, resultPid);
+            emit(Opcode::LOAD, aPid);
+            emit(Opcode::ADD, 0);
+            emit(Opcode::STORE, aPid);
+        }
+        emit(Opcode::JUMP, loopIdx - (long long)instructions.size());
+        for (long long idx : doneJumps)
+        {
+            patch(idx, instructions.size() - idx);
+        }
+
+        std::vector<long long> endJumps;
+        generate_product_sign(signs, 0, false, resultPid, endJumps);
+        // the last variant falls through
+        instructions.pop_back();
+        endJumps.pop_back();
+        for (long long idx : endJumps)
+        {
+            patch(idx, instructions.size() - idx);
+        }
         return true;
     }
 
-    bool generate_multiplication(ValueNode *left, ValueNode *right, std::string procName)
+    // Stores |value| in pid, leaving it in the accumulator too. Unless the
+    // value is known not to be negative, the cell keeping its sign is added to
+    // signs.
+    void generate_magnitude(ValueNode *value, long long pid, std::string procName, std::vector<long long> &signs)
     {
+        generate_load_to_RAX(value, procName);
+        if (known_non_negative(value, procName))
+        {
+            emit(Opcode::STORE, pid);
+            return;
+        }
         long long signPid = symbolTable->getNewPid();
-        instructions.push_back("SET 0");
-        instructions.push_back("STORE " + std::to_string(signPid));
+        emit(Opcode::STORE, signPid);
+        emit(Opcode::JPOS, 3);
+        emit(Opcode::SET, 0);
+        emit(Opcode::SUB, signPid);
+        emit(Opcode::STORE, pid);
+        signs.push_back(signPid);
+    }
+
+    // One variant of the result for every combination of the operands' signs,
+    // each ending with a jump to be patched to the end.
+    void generate_product_sign(const std::vector<long long> &signs, size_t k, bool negate, long long resultPid,
+                               std::vector<long long> &endJumps)
+    {
+        if (k == signs.size())
+        {
+            if (negate)
+            {
+                emit(Opcode::SET, 0);
+                emit(Opcode::SUB, resultPid);
+            }
+            else
+            {
+                emit(Opcode::LOAD, resultPid);
+            }
+            endJumps.push_back(emit(Opcode::JUMP));
+            return;
+        }
+        emit(Opcode::LOAD, signs[k]);
+        long long negativeIdx = emit(Opcode::JNEG);
+        generate_product_sign(signs, k + 1, negate, resultPid, endJumps);
+        patch(negativeIdx, instructions.size() - negativeIdx);
+        generate_product_sign(signs, k + 1, !negate, resultPid, endJumps);
+    }
+
+    // value * factor as a chain of doublings and additions, most significant
+    // bit first; signed arithmetic keeps the sign of value.
+    void generate_multiplication_by_constant(ValueNode *value, long long factor, std::string procName)
+    {
+        unsigned long long magnitude = factor < 0 ? -factor : factor;
+        if (magnitude == 0)
+        {
+            emit(Opcode::SET, 0);
+            return;
+        }
+        generate_load_to_RAX(value, procName);
+        long long valuePid = symbolTable->getNewPid();
+        if (magnitude != 1 || factor < 0)
+        {
+            emit(Opcode::STORE, valuePid);
+        }
+        int bit = 63 - __builtin_clzll(magnitude);
+        while (bit-- > 0)
+        {
+            emit(Opcode::ADD, 0);
+            if ((magnitude >> bit) & 1)
+            {
+                emit(Opcode::ADD, valuePid);
+            }
+        }
+        if (factor < 0)
+        {
+            emit(Opcode::STORE, valuePid);
+            emit(Opcode::SET, 0);
+            emit(Opcode::SUB, valuePid);
+        }
+    }
+
+    // Floor division and the remainder with the sign of the divisor, computed
+    // together: |a| is divided by |b| by doubling |b| up past |a| and halving it
+    // back, subtracting where it fits, then the signs are fixed up. Dividing by
+    // 0 gives 0 for both. Returns the cells of the quotient and the remainder.
+    std::pair<long long, long long> generate_divmod(ValueNode *left, ValueNode *right, std::string procName)
+    {
+        if (outOfLineArithmetic && divmodRoutine.start >= 0)
+        {
+            call_arithmetic_routine(divmodRoutine, left, right, procName);
+            return divmodRoutine.results;
+        }
+        long long bPid = symbolTable->getNewPid();    // b
+        long long aPid = symbolTable->getNewPid();    // a
+        long long absPid = symbolTable->getNewPid();  // |b|
+        long long restPid = symbolTable->getNewPid(); // |a|, then the remainder
+        long long stepPid = symbolTable->getNewPid(); // |b| * power
+        long long powerPid = symbolTable->getNewPid();
+        long long resultPid = symbolTable->getNewPid();
 
         generate_load_to_RAX(right, procName);
-        long long bPid = symbolTable->getNewPid();
-        instructions.push_back("STORE " + std::to_string(bPid));
-        generate_sign(bPid, signPid);
+        emit(Opcode::STORE, bPid);
+        long long zeroIdx = emit(Opcode::JZERO);
+        emit(Opcode::JPOS, 3);
+        emit(Opcode::SET, 0);
+        emit(Opcode::SUB, bPid);
+        emit(Opcode::STORE, absPid);
+        emit(Opcode::STORE, stepPid);
 
         generate_load_to_RAX(left, procName);
-        long long aPid = symbolTable->getNewPid();
-        instructions.push_back("STORE " + std::to_string(aPid));
-        generate_sign(aPid, signPid);
+        emit(Opcode::STORE, aPid);
+        emit(Opcode::JPOS, 3);
+        emit(Opcode::SET, 0);
+        emit(Opcode::SUB, aPid);
+        emit(Opcode::STORE, restPid);
+        emit(Opcode::SET, 0);
+        emit(Opcode::STORE, resultPid);
+        emit(Opcode::SET, 1);
+        emit(Opcode::STORE, powerPid);
+
+        // double until the step is past |a|
+        emit(Opcode::LOAD, restPid);
+        emit(Opcode::SUB, stepPid);
+        emit(Opcode::JNEG, 8);
+        emit(Opcode::LOAD, stepPid);
+        emit(Opcode::ADD, 0);
+        emit(Opcode::STORE, stepPid);
+        emit(Opcode::LOAD, powerPid);
+        emit(Opcode::ADD, 0);
+        emit(Opcode::STORE, powerPid);
+        emit(Opcode::JUMP, -9);
+
+        // halve back, subtracting every step that fits
+        long long halveIdx = emit(Opcode::LOAD, powerPid);
+        emit(Opcode::HALF);
+        long long doneIdx = emit(Opcode::JZERO);
+        emit(Opcode::STORE, powerPid);
+        emit(Opcode::LOAD, stepPid);
+        emit(Opcode::HALF);
+        emit(Opcode::STORE, stepPid);
+        emit(Opcode::LOAD, restPid);
+        emit(Opcode::SUB, stepPid);
+        emit(Opcode::JNEG, halveIdx - (long long)instructions.size());
+        emit(Opcode::STORE, restPid);
+        emit(Opcode::LOAD, resultPid);
+        emit(Opcode::ADD, powerPid);
+        emit(Opcode::STORE, resultPid);
+        emit(Opcode::JUMP, halveIdx - (long long)instructions.size());
+        patch(doneIdx, instructions.size() - doneIdx);
+
+        // signs: a >= 0, b > 0 is done; a < 0, b < 0 negates the remainder;
+        // otherwise the quotient rounds down and the remainder moves to the
+        // divisor's side, negated again when that is b < 0
+        std::vector<long long> endJumps;
+        emit(Opcode::LOAD, aPid);
+        long long negativeIdx = emit(Opcode::JNEG);
+        emit(Opcode::LOAD, bPid);
+        endJumps.push_back(emit(Opcode::JPOS));
+        generate_divmod_floor(resultPid, restPid, absPid);
+        emit(Opcode::SET, 0);
+        emit(Opcode::SUB, restPid);
+        emit(Opcode::STORE, restPid);
+        endJumps.push_back(emit(Opcode::JUMP));
+
+        patch(negativeIdx, instructions.size() - negativeIdx);
+        emit(Opcode::LOAD, bPid);
+        long long bothIdx = emit(Opcode::JNEG);
+        generate_divmod_floor(resultPid, restPid, absPid);
+        endJumps.push_back(emit(Opcode::JUMP));
+        patch(bothIdx, instructions.size() - bothIdx);
+        emit(Opcode::SET, 0);
+        emit(Opcode::SUB, restPid);
+        emit(Opcode::STORE, restPid);
+        endJumps.push_back(emit(Opcode::JUMP));
+
+        patch(zeroIdx, instructions.size() - zeroIdx);
+        emit(Opcode::STORE, resultPid);
+        emit(Opcode::STORE, restPid);
+
+        for (long long idx : endJumps)
+        {
+            patch(idx, instructions.size() - idx);
+        }
+        return {resultPid, restPid};
+    }
 
-        instructions.push_back("LOAD " + std::to_string(bPid));
-        instructions.push_back("JZERO 2");
-        instructions.push_back("JUMP 5");
-        instructions.push_back("SET 1");
-        instructions.push_back("STORE " + std::to_string(bPid));
-        instructions.push_back("SET 0");
-        instructions.push_back("STORE " + std::to_string(aPid));
+    // quotient = -(quotient + 1) and remainder = |b| - remainder, unless the
+    // division was exact
+    void generate_divmod_floor(long long resultPid, long long restPid, long long absPid)
+    {
+        emit(Opcode::LOAD, restPid);
+        emit(Opcode::JZERO, 6);
+        emit(Opcode::LOAD, absPid);
+        emit(Opcode::SUB, restPid);
+        emit(Opcode::STORE, restPid);
+        emit(Opcode::SET, -1);
+        emit(Opcode::JUMP, 2);
+        emit(Opcode::SET, 0);
+        emit(Opcode::SUB, resultPid);
+        emit(Opcode::STORE, resultPid);
+    }
 
-        long long resultPid = symbolTable->getNewPid();
-        instructions.push_back("SET 0");
-        instructions.push_back("STORE " + std::to_string(resultPid));
-
-        instructions.push_back("LOAD " + std::to_string(bPid));
-        instructions.push_back("JPOS 2");
-        instructions.push_back("JUMP 19");
-
-        instructions.push_back("HALF");
-        instructions.push_back("ADD 0");
-        instructions.push_back("SUB " + std::to_string(bPid));
-        instructions.push_back("JNEG 8");
-
-        instructions.push_back("LOAD " + std::to_string(aPid));
-        instructions.push_back("ADD 0");
-        instructions.push_back("STORE " + std::to_string(aPid));
-        instructions.push_back("LOAD " + std::to_string(bPid));
-        instructions.push_back("HALF");
-        instructions.push_back("STORE " + std::to_string(bPid));
-        instructions.push_back("JUMP -12");
-
-        instructions.push_back("LOAD " + std::to_string(aPid));
-        instructions.push_back("ADD " + std::to_string(resultPid));
-        instructions.push_back("STORE " + std::to_string(resultPid));
-        instructions.push_back("SET -1");
-        instructions.push_back("ADD " + std::to_string(bPid));
-        instructions.push_back("STORE " + std::to_string(bPid));
-        instructions.push_back("JUMP -19");
-
-        instructions.push_back("SET -1");
-        instructions.push_back("ADD " + std::to_string(signPid));
-        instructions.push_back("JZERO 2");
-        instructions.push_back("JUMP 4");
-
-        instructions.push_back("SET 0");
-        instructions.push_back("SUB " + std::to_string(resultPid));
-        instructions.push_back("JUMP 2");
-
-        instructions.push_back("LOAD " + std::to_string(resultPid));
-        return true;
+    // An assignment of a product of two variables, a quotient or a remainder,
+    // the arithmetic expanded into a loop in place.
+    static bool general_arithmetic(const AssignNode *assignCmd)
+    {
+        if (assignCmd->expression->kind != NodeKind::BinaryExpression)
+        {
+            return false;
+        }
+        const BinaryExpressionNode *binary = static_cast<const BinaryExpressionNode *>(assignCmd->expression);
+        if (binary->op == "*")
+        {
+            return binary->left->identifier && binary->right->identifier;
+        }
+        return binary->op == "/" || binary->op == "%";
     }
 
-    bool generate_division(ValueNode *left, ValueNode *right, std::string procName)
+    // Which routines the arithmetic the profile never saw run needs.
+    class ColdArithmetic : public AstVisitor
     {
-        long long signPid = symbolTable->getNewPid();
-        instructions.push_back("SET 0");
-        instructions.push_back("STORE " + std::to_string(signPid));
+    public:
+        bool multiply = false;
+        bool divmod = false;
 
-        generate_load_to_RAX(right, procName);
-        long long bPid = symbolTable->getNewPid();
-        instructions.push_back("STORE " + std::to_string(bPid));
-        generate_sign(bPid, signPid);
+        explicit ColdArithmetic(const CodeGenerator *generator) : generator(generator) {}
 
-        std::string baseName = "#DIVISION_HELPER#";
-        std::string name = getName(procName, baseName);
-        symbolTable->zmienna_pid[name] = bPid;
-        ValueNode *rightCopy = new ValueNode(new IdentifierNode(new std::string(baseName)));
+        void visit_procedure(ProcedureNode *node) override
+        {
+            if (!node->unused)
+            {
+                AstVisitor::visit_procedure(node);
+            }
+        }
+
+        void visit_assign(AssignNode *node) override
+        {
+            if (general_arithmetic(node) && generator->profile_count(node, "runs") == 0)
+            {
+                bool &needed = static_cast<BinaryExpressionNode *>(node->expression)->op == "*" ? multiply : divmod;
+                needed = true;
+            }
+        }
+
+    private:
+        const CodeGenerator *generator;
+    };
+
+    // Emitted ahead of the procedures, in a frame every other one is placed
+    // above. A routine is entered like a procedure, with its operands in
+    // routineOperands, and leaves the product in the accumulator or the
+    // quotient and remainder in its results.
+    void generate_arithmetic_routines(ProgramNode *root)
+    {
+        ColdArithmetic cold(this);
+        cold.visit(root);
+        if (!cold.multiply && !cold.divmod)
+        {
+            return;
+        }
+        begin_frame(arithmeticFrame);
+        std::string names[2] = {"left", "right"};
+        for (int k = 0; k < 3; k++)
+        {
+            routineOperands[k] = symbolTable->getNewPid();
+        }
+        for (int k = 0; k < 2; k++)
+        {
+            symbolTable->zmienna_pid[getName(arithmeticFrame, names[k])] = routineOperands[k];
+        }
+        for (ArithmeticRoutine *routine : {&multiplyRoutine, &divmodRoutine})
+        {
+            bool multiply = routine == &multiplyRoutine;
+            if (!(multiply ? cold.multiply : cold.divmod))
+            {
+                continue;
+            }
+            DebugScope scope(this, nullptr, arithmeticFrame, multiply ? "multiplication" : "division");
+            ValueNode left(new IdentifierNode(&names[0]));
+            ValueNode right(new IdentifierNode(&names[1]));
+            routine->start = instructions.size();
+            if (multiply)
+            {
+                generate_multiplication(&left, &right, arithmeticFrame);
+            }
+            else
+            {
+                routine->results = generate_divmod(&left, &right, arithmeticFrame);
+            }
+            emit(Opcode::RTRN, routineOperands[2]);
+            // the results outlive the routine, so none of its cells is a temporary
+            frameTemporaries = symbolTable->pid;
+            optimize(routine->start);
+        }
+        for (int k = 0; k < 2; k++)
+        {
+            symbolTable->zmienna_pid.erase(getName(arithmeticFrame, names[k]));
+        }
+        end_frame(arithmeticFrame);
+    }
 
+    void call_arithmetic_routine(const ArithmeticRoutine &routine, ValueNode *left, ValueNode *right, std::string procName)
+    {
+        if (stats)
+        {
+            stats->count("arithmetic calling a shared routine (profile)");
+        }
+        generate_load_to_RAX(right, procName);
+        emit(Opcode::STORE, routineOperands[1]);
         generate_load_to_RAX(left, procName);
-        long long aPid = symbolTable->getNewPid();
-        instructions.push_back("STORE " + std::to_string(aPid));
-        generate_sign(aPid, signPid);
-
-        // cheat division by 0
-        instructions.push_back("LOAD " + std::to_string(bPid));
-        instructions.push_back("JZERO 2");
-        instructions.push_back("JUMP 5");
-        instructions.push_back("SET 1");
-        instructions.push_back("STORE " + std::to_string(bPid));
-        instructions.push_back("SET 0");
-        instructions.push_back("STORE " + std::to_string(aPid));
+        emit(Opcode::STORE, routineOperands[0]);
+        returnAddressSets.push_back(emit(Opcode::SET, instructions.size() + 3));
+        emit(Opcode::STORE, routineOperands[2]);
+        emit(Opcode::JUMP, routine.start - (long long)instructions.size());
+    }
+
+    // Operands of a division or modulo as a key, "" unless both are literals or
+    // scalars, whose values two consecutive assignments can share.
+    std::string divmod_key(CommandNode *cmd)
+    {
+        if (cmd->kind != NodeKind::Assign ||
+            static_cast<AssignNode *>(cmd)->expression->kind != NodeKind::BinaryExpression)
+        {
+            return "";
+        }
+        BinaryExpressionNode *binary = static_cast<BinaryExpressionNode *>(static_cast<AssignNode *>(cmd)->expression);
+        if (binary->op != "/" && binary->op != "%")
+        {
+            return "";
+        }
+        std::string key;
+        for (ValueNode *value : {binary->left, binary->right})
+        {
+            if (!value->identifier)
+            {
+                key += "#" + std::to_string(value->value) + " ";
+            }
+            else if (!value->identifier->isElement)
+            {
+                key += value->identifier->getName() + " ";
+            }
+            else
+            {
+                return "";
+            }
+        }
+        return key;
+    }
+
+    // Whether the second of two assignments can take its quotient or remainder
+    // from the divmod of the first: same operands, which the first assignment
+    // does not change, also not through a parameter bound to the same variable.
+    bool shares_divmod(CommandNode *first, CommandNode *second, std::string procName)
+    {
+        std::string key = divmod_key(first);
+        if (key.empty() || key != divmod_key(second))
+        {
+            return false;
+        }
+        IdentifierNode *target = static_cast<AssignNode *>(first)->identifier;
+        if (target->isElement)
+        {
+            return true;
+        }
+        bool targetByAddress = by_address(target->getName(), procName);
+        BinaryExpressionNode *binary = static_cast<BinaryExpressionNode *>(static_cast<AssignNode *>(first)->expression);
+        for (ValueNode *value : {binary->left, binary->right})
+        {
+            if (!value->identifier)
+            {
+                continue;
+            }
+            if (value->identifier->getName() == target->getName() ||
+                (targetByAddress && by_address(value->identifier->getName(), procName)))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
 
-        long long resultPid = symbolTable->getNewPid();
-        instructions.push_back("SET 0");
-        instructions.push_back("STORE " + std::to_string(resultPid));
-
-        long long iPid = symbolTable->getNewPid();
-        instructions.push_back("SET " + std::to_string(LARGE_NUMBER));
-        instructions.push_back("STORE " + std::to_string(iPid));
-
-        long long bxdPid = symbolTable->getNewPid();
-        generate_multiplication(rightCopy, new ValueNode(LARGE_NUMBER), procName);
-        instructions.push_back("STORE " + std::to_string(bxdPid));
-        instructions.push_back("JNEG 2");
-        instructions.push_back("JUMP 4");
-        instructions.push_back("SET 0");
-        instructions.push_back("SUB " + std::to_string(bxdPid));
-        instructions.push_back("STORE " + std::to_string(bxdPid));
-
-        for (int i = 0; i < 64; i++)
-        {
-            instructions.push_back("LOAD " + std::to_string(aPid));
-            instructions.push_back("SUB " + std::to_string(bxdPid));
-            instructions.push_back("JNEG 5");
-            instructions.push_back("STORE " + std::to_string(aPid));
-
-            instructions.push_back("LOAD " + std::to_string(resultPid));
-            instructions.push_back("ADD " + std::to_string(iPid));
-            instructions.push_back("STORE " + std::to_string(resultPid));
-
-            instructions.push_back("LOAD " + std::to_string(iPid));
-            instructions.push_back("HALF");
-            instructions.push_back("STORE " + std::to_string(iPid));
-            instructions.push_back("LOAD " + std::to_string(bxdPid));
-            instructions.push_back("HALF");
-            instructions.push_back("STORE " + std::to_string(bxdPid));
-        }
-
-        instructions.push_back("SET -1");
-        instructions.push_back("ADD " + std::to_string(signPid));
-        instructions.push_back("JZERO 2");
-        // if sign is positive
-        long long jumpIdx = instructions.size();
-        instructions.push_back("JUMP ");
-
-        // if sign is negative
-        instructions.push_back("LOAD " + std::to_string(resultPid));
-        instructions.push_back("STORE " + std::to_string(bPid));
-        generate_multiplication(rightCopy, right, procName);
-        instructions.push_back("STORE " + std::to_string(bPid));
-        generate_load_to_RAX(left, procName);
-        instructions.push_back("SUB " + std::to_string(bPid));
-        instructions.push_back("JZERO 4");
-        instructions.push_back("SET 1");
-        instructions.push_back("ADD " + std::to_string(resultPid));
-        instructions.push_back("STORE " + std::to_string(resultPid));
-
-        instructions.push_back("SET 0");
-        instructions.push_back("SUB " + std::to_string(resultPid));
-        instructions.push_back("JUMP 2");
-
-        instructions[jumpIdx] += std::to_string(instructions.size() - jumpIdx);
-        instructions.push_back("LOAD " + std::to_string(resultPid));
+    // a scalar parameter accessed through its address
+    bool by_address(const std::string &name, std::string procName)
+    {
+        std::string fullName = getName(procName, name);
+        return symbolTable->parametr_pid.count(fullName) > 0 && parameterCopies.count(fullName) == 0;
+    }
+
+    bool generate_division(ValueNode *left, ValueNode *right, std::string procName)
+    {
+        DebugScope scope(this, left, procName, "division");
+        if (!sharedDivmod)
+        {
+            divmodCells = generate_divmod(left, right, procName);
+        }
+        emit(Opcode::LOAD, divmodCells.first);
         return true;
     }
 
     bool generate_modulo(ValueNode *left, ValueNode *right, std::string procName)
     {
-        generate_load_to_RAX(left, procName);
-        long long aPid = symbolTable->getNewPid();
-        instructions.push_back("STORE " + std::to_string(aPid));
-        std::string baseName1 = "#MOD_1_HELPER#";
-        std::string name1 = getName(procName, baseName1);
-        symbolTable->zmienna_pid[name1] = aPid;
-        ValueNode *leftCopy = new ValueNode(new IdentifierNode(new std::string(baseName1)));
+        DebugScope scope(this, left, procName, "modulo");
+        if (!sharedDivmod)
+        {
+            divmodCells = generate_divmod(left, right, procName);
+        }
+        emit(Opcode::LOAD, divmodCells.second);
+        return true;
+    }
 
-        long long tmpPid = symbolTable->getNewPid();
-        instructions.push_back("STORE " + std::to_string(tmpPid));
+    // Whether the single jump ending a condition is taken when it holds.
+    static bool jumps_when_true(const std::string &op)
+    {
+        return op == "=" || op == "<" || op == ">";
+    }
 
-        generate_load_to_RAX(right, procName);
-        long long bPid = symbolTable->getNewPid();
-        instructions.push_back("STORE " + std::to_string(bPid));
-        std::string baseName2 = "#MOD_2_HELPER#";
-        std::string name2 = getName(procName, baseName2);
-        symbolTable->zmienna_pid[name2] = bPid;
-        ValueNode *rightCopy = new ValueNode(new IdentifierNode(new std::string(baseName2)));
-
-        long long jumpIdx = instructions.size();
-        instructions.push_back("JZERO "); // ??
-
-        // if not zero
-        generate_division(leftCopy, rightCopy, procName);
-        instructions.push_back("STORE " + std::to_string(aPid));
-        generate_multiplication(leftCopy, rightCopy, procName);
-        instructions.push_back("STORE " + std::to_string(aPid));
-        instructions.push_back("LOAD " + std::to_string(tmpPid));
-        instructions.push_back("SUB " + std::to_string(aPid));
-
-        instructions.push_back("JUMP 2");
-        instructions[jumpIdx] += std::to_string(instructions.size() - jumpIdx);
-        // if zero
-        instructions.push_back("SET 0");
+    // Emits the two jumps taken exactly when the single jump for op is not.
+    void emit_inverted_jumps(const std::string &op)
+    {
+        if (op == "=" || op == "!=")
+        {
+            emit(Opcode::JPOS);
+            emit(Opcode::JNEG);
+        }
+        else if (op == "<" || op == ">=")
+        {
+            emit(Opcode::JPOS);
+            emit(Opcode::JZERO);
+        }
+        else
+        {
+            emit(Opcode::JNEG);
+            emit(Opcode::JZERO);
+        }
+    }
 
-        return true;
+    // Points the jump(s) ending a condition, which end just before end, at target.
+    void patch_condition(long long end, bool inverted, long long target)
+    {
+        patch(end - 1, target - (end - 1));
+        if (inverted)
+        {
+            patch(end - 2, target - (end - 2));
+        }
     }
 
-    bool generate_condition(ConditionNode *condition, std::string procName) // overload
+    // Returns whether the emitted jump is taken when the condition holds. With
+    // invert the condition ends with two jumps taken in the opposite case.
+    bool generate_condition(ConditionNode *condition, std::string procName, bool invert = false) // overload
     {
+        DebugScope scope(this, condition, procName, "condition");
         generate_substract(condition->left, condition->right, procName);
 
         std::string op = condition->op;
 
+        if (invert)
+        {
+            emit_inverted_jumps(op);
+            return !jumps_when_true(op);
+        }
+
         if (op == "=")
         {
-            instructions.push_back("JZERO ");
+            emit(Opcode::JZERO);
             return true;
         }
         else if (op == "<")
         {
-            instructions.push_back("JNEG ");
+            emit(Opcode::JNEG);
             return true;
         }
         else if (op == ">")
         {
-            instructions.push_back("JPOS ");
+            emit(Opcode::JPOS);
             return true;
         }
         else if (op == "<=")
         {
-            instructions.push_back("JPOS ");
+            emit(Opcode::JPOS);
             return false;
         }
         else if (op == ">=")
         {
-            instructions.push_back("JNEG ");
+            emit(Opcode::JNEG);
             return false;
         }
         else if (op == "!=")
         {
-            instructions.push_back("JZERO ");
+            emit(Opcode::JZERO);
             return false;
         }
 
@@ -437,83 +1030,193 @@ public:
 
     bool generate_if(IfNode *ifNode, std::string procName)
     {
-        int beginIf = instructions.size();
         int endFirstPart = 0;
+        record_block(ifNode, "test");
         bool elseFirst = generate_condition(ifNode->condition, procName);
         int endIf = instructions.size() - 1;
 
+        if (jump_arm_out_of_line(ifNode, elseFirst))
+        {
+            return generate_if_out_of_line(ifNode, procName, elseFirst, endIf);
+        }
+
         if (elseFirst)
         {
-            if (ifNode->elseCommands)
-            {
-                for (const auto &cmd : ifNode->elseCommands->commands)
-                {
-                    generate_command(cmd, procName);
-                }
-            }
+            generate_commands(ifNode->elseCommands, procName);
         }
         else
         {
-            for (const auto &cmd : ifNode->thenCommands->commands)
-            {
-                generate_command(cmd, procName);
-            }
+            record_block(ifNode, "then");
+            generate_commands(ifNode->thenCommands, procName);
         }
-        instructions.push_back("JUMP ");
+        emit(Opcode::JUMP);
 
         endFirstPart = instructions.size();
-        instructions[endIf] += std::to_string(endFirstPart - endIf);
+        patch(endIf, endFirstPart - endIf);
 
         if (!elseFirst)
         {
-            if (ifNode->elseCommands)
-            {
-                for (const auto &cmd : ifNode->elseCommands->commands)
-                {
-                    generate_command(cmd, procName);
-                }
-            }
+            generate_commands(ifNode->elseCommands, procName);
         }
         else
         {
-            for (const auto &cmd : ifNode->thenCommands->commands)
+            record_block(ifNode, "then");
+            generate_commands(ifNode->thenCommands, procName);
+        }
+
+        patch(endFirstPart - 1, instructions.size() - endFirstPart + 1);
+
+        return true;
+    }
+
+    // The arm the condition jumps to costs one jump, the fall-through arm two:
+    // the conditional jump and the JUMP over the other arm. With a profile
+    // showing the jump arm is the colder one, it is moved out of line instead,
+    // paying for a JUMP back while the fall-through arm pays nothing extra.
+    bool jump_arm_out_of_line(IfNode *ifNode, bool elseFirst) const
+    {
+        long long test = profile_count(ifNode, "test");
+        long long thenCount = profile_count(ifNode, "then");
+        if (test < 0 || thenCount < 0)
+        {
+            return false;
+        }
+        long long jumpArm = elseFirst ? thenCount : test - thenCount;
+        return jumpArm < test - jumpArm;
+    }
+
+    bool generate_if_out_of_line(IfNode *ifNode, std::string procName, bool elseFirst, long long jump)
+    {
+        CommandsNode *jumpArm = elseFirst ? ifNode->thenCommands : ifNode->elseCommands;
+        if (!elseFirst)
+        {
+            record_block(ifNode, "then");
+        }
+        generate_commands(elseFirst ? ifNode->elseCommands : ifNode->thenCommands, procName);
+
+        if (stats)
+        {
+            stats->count("if arms moved out of line (profile)");
+        }
+        if (!jumpArm)
+        {
+            patch(jump, instructions.size() - jump);
+            return true;
+        }
+        outOfLineArms.push_back({ifNode, jumpArm, jump, (long long)instructions.size(), symbolTable->zmienna_pid, forDepth, constantIterators});
+        return true;
+    }
+
+    // Emitted after the last instruction of the procedure; arms moved out of
+    // line here may move their own nested arms further down.
+    void generate_out_of_line_arms(std::string procName)
+    {
+        for (size_t i = 0; i < outOfLineArms.size(); i++)
+        {
+            OutOfLineArm arm = outOfLineArms[i];
+            DebugScope scope(this, arm.ifNode, procName, "if");
+            std::swap(symbolTable->zmienna_pid, arm.variables);
+            std::swap(forDepth, arm.forDepth);
+            std::swap(constantIterators, arm.constants);
+            patch(arm.jump, instructions.size() - arm.jump);
+            if (arm.commands == arm.ifNode->thenCommands)
             {
-                generate_command(cmd, procName);
+                record_block(arm.ifNode, "then");
             }
+            generate_commands(arm.commands, procName);
+            emit(Opcode::JUMP, arm.resume - (long long)instructions.size());
+            std::swap(symbolTable->zmienna_pid, arm.variables);
+            std::swap(forDepth, arm.forDepth);
+            std::swap(constantIterators, arm.constants);
         }
+        outOfLineArms.clear();
+    }
 
-        instructions[endFirstPart - 1] += std::to_string(instructions.size() - endFirstPart + 1);
+    // Names of the profile counters of a loop's test and body. The remainder
+    // loop of a partially unrolled FOR loop counts under its own names.
+    struct LoopCounters
+    {
+        const char *test;
+        const char *body;
+
+        LoopCounters(const char *test = "test", const char *body = "body") : test(test), body(body) {}
+    };
+
+    // Counting only jumps: testing at the top costs two per iteration (the
+    // conditional jump and the JUMP back) and one or two on exit; testing at
+    // the bottom costs a JUMP on entry and one conditional jump per iteration,
+    // or for <=, >= and != two jumps of which the second is taken on equality
+    // only, estimated at one and a half.
+    bool rotate_loop(const AstNode *node, ConditionNode *condition, const LoopCounters &counters) const
+    {
+        long long test = profile_count(node, counters.test);
+        long long iterations = profile_count(node, counters.body);
+        if (test < 0 || iterations < 0)
+        {
+            return false;
+        }
+        long long entries = test - iterations;
+        if (jumps_when_true(condition->op))
+        {
+            return iterations + 2 * entries < 2 * iterations + 2 * entries;
+        }
+        return 3 * iterations + 6 * entries < 2 * (2 * iterations + entries);
+    }
 
+    bool generate_rotated_while(WhileNode *whileNode, std::string procName, const AstNode *node,
+                                const LoopCounters &counters)
+    {
+        if (stats)
+        {
+            stats->count("loops rotated (profile)");
+        }
+        long long entry = emit(Opcode::JUMP);
+        long long body = instructions.size();
+        record_block(node, counters.body);
+        generate_commands(whileNode->commands, procName);
+
+        patch(entry, instructions.size() - entry);
+        record_block(node, counters.test);
+        bool inverted = !jumps_when_true(whileNode->condition->op);
+        generate_condition(whileNode->condition, procName, inverted);
+        patch_condition(instructions.size(), inverted, body);
         return true;
     }
 
-    bool generate_while(WhileNode *whileNode, std::string procName)
+    // FOR loops pass themselves as profileNode, their WHILE is not in the AST.
+    bool generate_while(WhileNode *whileNode, std::string procName, const AstNode *profileNode = nullptr,
+                        const LoopCounters &counters = LoopCounters())
     {
+        const AstNode *node = profileNode ? profileNode : whileNode;
+        if (rotate_loop(node, whileNode->condition, counters))
+        {
+            return generate_rotated_while(whileNode, procName, node, counters);
+        }
+
         int beginWhile = instructions.size();
         int breakLabel = 0;
+        record_block(node, counters.test);
         bool elseFirst = generate_condition(whileNode->condition, procName);
         int endWhile = instructions.size() - 1;
 
         if (elseFirst)
         {
             breakLabel = instructions.size();
-            instructions.push_back("JUMP ");
+            emit(Opcode::JUMP);
         }
 
-        for (const auto &cmd : whileNode->commands->commands)
-        {
-            generate_command(cmd, procName);
-        }
-        instructions.push_back("JUMP " + std::to_string(beginWhile - (int)instructions.size()));
+        record_block(node, counters.body);
+        generate_commands(whileNode->commands, procName);
+        emit(Opcode::JUMP, beginWhile - (int)instructions.size());
 
         if (elseFirst)
         {
-            instructions[breakLabel] += std::to_string(instructions.size() - breakLabel);
-            instructions[endWhile] += std::to_string(2);
+            patch(breakLabel, instructions.size() - breakLabel);
+            patch(endWhile, 2);
         }
         else
         {
-            instructions[endWhile] += std::to_string(instructions.size() - endWhile);
+            patch(endWhile, instructions.size() - endWhile);
         }
 
         return true;
@@ -522,19 +1225,31 @@ public:
     bool generate_assignment(AssignNode *assignCmd, std::string procName)
     {
         try {
-            if (auto *binaryExpr = dynamic_cast<BinaryExpressionNode *>(assignCmd->expression))
+            bool arithmetic = general_arithmetic(assignCmd);
+            if (arithmetic)
             {
-                generate_binary_expression(binaryExpr, procName);
+                record_block(assignCmd, "runs");
             }
-            else if (auto *valueExpr = dynamic_cast<ValueNode *>(assignCmd->expression))
+            outOfLineArithmetic = arithmetic && profile_count(assignCmd, "runs") == 0;
+            generate_target_address(assignCmd->identifier, procName, loads_elements(assignCmd->expression));
+            switch (assignCmd->expression->kind)
             {
-                generate_load_to_RAX(valueExpr, procName);
+            case NodeKind::BinaryExpression:
+                generate_binary_expression(static_cast<BinaryExpressionNode *>(assignCmd->expression), procName);
+                break;
+            case NodeKind::Value:
+                generate_load_to_RAX(static_cast<ValueNode *>(assignCmd->expression), procName);
+                break;
+            default:
+                break;
             }
             
-            generate_save_from_RAX(new ValueNode(assignCmd->identifier), procName, assignCmd->ignore);
+            generate_save_from_RAX(assignCmd->identifier, procName, assignCmd->ignore);
+            outOfLineArithmetic = false;
             return true;
         } catch (const std::runtime_error &e)
         {
+            outOfLineArithmetic = false;
             throw CodeGeneratorError(e.what(), assignCmd->getLineNumber());
             return false;
         }
@@ -543,14 +1258,15 @@ public:
     bool generate_write(WriteNode *writeCmd, std::string procName)
     {
         generate_load_to_RAX(writeCmd->node, procName);
-        instructions.push_back("PUT 0");
+        emit(Opcode::PUT, 0);
         return true;
     }
 
     bool generate_read(ReadNode *readCmd, std::string procName)
     {
-        instructions.push_back("GET 0");
-        generate_save_from_RAX(new ValueNode(readCmd->identifier), procName);
+        generate_target_address(readCmd->identifier, procName, false);
+        emit(Opcode::GET, 0);
+        generate_save_from_RAX(readCmd->identifier, procName);
         return true;
     }
 
@@ -581,18 +1297,18 @@ public:
                     }
                     if (pidOrg.second)
                     {
-                        instructions.push_back("LOAD " + std::to_string(pidOrg.first));
+                        emit(Opcode::LOAD, pidOrg.first);
                     }
                     else
                     {
-                        instructions.push_back("SET " + std::to_string(pidOrg.first));
+                        emit(Opcode::SET, pidOrg.first);
                     }
-                    instructions.push_back("STORE " + std::to_string(pidFun.first));
+                    emit(Opcode::STORE, pidFun.first);
                 }
                 else
                 {
                     try {
-                        pidOrg = symbolTable->getPid(getName(procName, arg->getName()));
+                        pidOrg = variable_pid(getName(procName, arg->getName()));
                         pidFun = symbolTable->getPid(getName(name, symbolTable->funkcja_param[name][i++].first));
                     } catch (const std::runtime_error &e)
                     {
@@ -602,178 +1318,580 @@ public:
                     // instructions.push_back("[ARG] " + std::to_string(pidOrg.first) + " -> " + std::to_string(pidFun.first));
                     if (pidOrg.second)
                     {
-                        instructions.push_back("LOAD " + std::to_string(pidOrg.first));
+                        emit(Opcode::LOAD, pidOrg.first);
                     }
                     else
                     {
-                        instructions.push_back("SET " + std::to_string(pidOrg.first));
+                        emit(Opcode::SET, pidOrg.first);
                     }
-                    instructions.push_back("STORE " + std::to_string(pidFun.first));
+                    emit(Opcode::STORE, pidFun.first);
                 }
             }
         }
-        instructions.push_back("SET " + std::to_string(instructions.size() + 3));
-        instructions.push_back("STORE " + std::to_string(symbolTable->funkcja_RBX[name]));
+        returnAddressSets.push_back(emit(Opcode::SET, instructions.size() + 3));
+        emit(Opcode::STORE, symbolTable->funkcja_RBX[name]);
         long long diff = function_start[name] - instructions.size();
-        instructions.push_back("JUMP " + std::to_string(diff));
+        emit(Opcode::JUMP, diff);
         return true;
     }
 
-    bool generate_code(ProgramNode *root, SymbolTable *symbolTable)
+    // Runs the instruction passes on the code generated since from and moves
+    // everything pointing into it along.
+    void optimize(long long from)
+    {
+        if (!passes)
+        {
+            return;
+        }
+        std::vector<long long> barriers;
+        if (blockMap)
+        {
+            for (const auto &block : blockMap->counters)
+            {
+                barriers.push_back(block.index);
+            }
+        }
+        std::vector<long long> moved = passes->run_instruction_passes(instructions, from, returnAddressSets, barriers,
+                                                                      {frameTemporaries, symbolTable->pid});
+        if (debugMap)
+        {
+            debugMap->remap(from, moved);
+        }
+        if (blockMap)
+        {
+            blockMap->remap(from, moved);
+        }
+    }
+
+    // Places the cells of a procedure ("" for main) above the frames of all
+    // procedures it calls. No recursion means a procedure is only active below
+    // its callers, so procedures never active at the same time share cells.
+    void begin_frame(const std::string &procName)
+    {
+        if (overlayFrames)
+        {
+            long long base = SymbolTable::FIRST_CELL;
+            auto routines = frameEnd.find(arithmeticFrame);
+            if (routines != frameEnd.end())
+            {
+                base = routines->second;
+            }
+            for (const auto &callee : callGraph.callees[procName])
+            {
+                auto it = frameEnd.find(callee);
+                if (it != frameEnd.end())
+                {
+                    base = std::max(base, it->second);
+                }
+            }
+            symbolTable->place_frame(procName, base);
+        }
+        symbolTable->iterator_pid.clear();
+        loopCells.clear();
+        forDepth = 0;
+        frameTemporaries = symbolTable->pid;
+    }
+
+    void end_frame(const std::string &procName)
+    {
+        frameEnd[procName] = symbolTable->pid;
+        memoryHighWater = std::max(memoryHighWater, symbolTable->pid);
+        const auto &cells = symbolTable->frame_cells[procName];
+        memoryWithoutOverlay += cells.second - cells.first + symbolTable->pid - frameTemporaries;
+    }
+
+    // Iterator (0), bound (1) or unrolling limit (2) cell of a FOR loop
+    // starting at forDepth. Loops at the same depth of a procedure are never
+    // active together.
+    long long loop_cell(int k)
+    {
+        if (!overlayFrames)
+        {
+            return symbolTable->getNewPid();
+        }
+        size_t slot = LOOP_CELLS * forDepth + k;
+        while (loopCells.size() <= slot)
+        {
+            loopCells.push_back(symbolTable->getNewPid());
+        }
+        return loopCells[slot];
+    }
+
+    // The code of a procedure, up to its RTRN and the arms moved behind it,
+    // optimized unless the procedure is unused.
+    void generate_procedure(ProcedureNode *proc, const ParameterAnalysis &parameters)
+    {
+        std::string procName = *proc->arguments->procedureName;
+        PhaseTimer timer(stats, "codegen " + procName);
+        DebugScope scope(this, proc, procName, "procedure");
+        begin_frame(procName);
+        function_start[procName] = instructions.size();
+        auto copies = parameters.copies(procName);
+        for (const auto &copy : copies)
+        {
+            std::string name = getName(procName, copy.first);
+            parameterCopies[name] = symbolTable->getNewPid();
+            emit(Opcode::LOADI, symbolTable->parametr_pid[name]);
+            emit(Opcode::STORE, parameterCopies[name]);
+        }
+        if (stats)
+        {
+            stats->count("parameters copied in/out", copies.size());
+        }
+        generate_commands(proc->commands, procName);
+        DebugScope returnScope(this, nullptr, procName, "return");
+        for (const auto &copy : copies)
+        {
+            if (copy.second)
+            {
+                std::string name = getName(procName, copy.first);
+                emit(Opcode::LOAD, parameterCopies[name]);
+                emit(Opcode::STOREI, symbolTable->parametr_pid[name]);
+            }
+        }
+        emit(Opcode::RTRN, symbolTable->funkcja_RBX[procName]);
+        generate_out_of_line_arms(procName);
+        parameterCopies.clear();
+        declared_functions.insert(procName);
+        if (!proc->unused)
+        {
+            optimize(function_start[procName]);
+            end_frame(procName);
+        }
+    }
+
+    // Generates an unused procedure only to report its errors, as it would be
+    // generated without cloning; its code, temporaries and maps are dropped.
+    void check_procedure(ProcedureNode *proc, const ParameterAnalysis &parameters)
+    {
+        long long start = instructions.size();
+        long long pid = symbolTable->pid;
+        long long patched = patchedJumps;
+        DebugMap *debugMap = this->debugMap;
+        BlockMap *blockMap = this->blockMap;
+        CompileStats *stats = this->stats;
+        this->debugMap = nullptr;
+        this->blockMap = nullptr;
+        this->stats = nullptr;
+        generate_procedure(proc, parameters);
+        this->debugMap = debugMap;
+        this->blockMap = blockMap;
+        this->stats = stats;
+        instructions.resize(start);
+        returnAddressSets.erase(std::remove_if(returnAddressSets.begin(), returnAddressSets.end(),
+                                               [start](long long set) { return set >= start; }),
+                                returnAddressSets.end());
+        function_start.erase(*proc->arguments->procedureName);
+        symbolTable->pid = pid;
+        patchedJumps = patched;
+    }
+
+    // Generates the whole program into instructions. With a stream writer each
+    // procedure is written out as soon as it is finished; the leading jump to
+    // main is written as a placeholder and patched at the end. Errors name
+    // procedures as the source does, not as their clones.
+    bool generate_code(ProgramNode *root, SymbolTable *symbolTable, OutputWriter *stream = nullptr)
+    {
+        try
+        {
+            return generate_program(root, symbolTable, stream);
+        } catch (const std::runtime_error &e)
+        {
+            throw std::runtime_error(ProcedureCloning::source_names(e.what()));
+        }
+    }
+
+    bool generate_program(ProgramNode *root, SymbolTable *symbolTable, OutputWriter *stream)
     {
         this->symbolTable = symbolTable;
+        callGraph.visit(root);
+        modRef.analyze(root);
+        if (blockMap || profile)
+        {
+            NodeNumbering numbering;
+            numbering.visit(root);
+            nodeIds = numbering.ids;
+        }
+        ParameterAnalysis parameters;
+        if (copyInOut)
+        {
+            parameters.analyze(root, modRef);
+        }
         long long main_pos = 0;
-        instructions.push_back("JUMP ");
+        long long main_jump_offset = 0;
+        size_t emitted = 0;
+        DebugScope entryScope(this, root, "", "entry");
+        emit(Opcode::JUMP);
+        if (stream)
+        {
+            main_jump_offset = stream->write_placeholder(instructions[main_pos]);
+            emitted = instructions.size();
+        }
+        if (profile)
+        {
+            generate_arithmetic_routines(root);
+        }
         if (root->procedures)
         {
             for (const auto &proc : root->procedures->procedures)
             {
-                std::string procName = *proc->arguments->procedureName;
-                function_start[procName] = instructions.size();
-                for (const auto &cmd : proc->commands->commands)
+                if (proc->unused)
+                {
+                    check_procedure(proc, parameters);
+                    continue;
+                }
+                generate_procedure(proc, parameters);
+                if (stream)
                 {
-                    generate_command(cmd, procName);
+                    stream->write(instructions, emitted);
+                    emitted = instructions.size();
                 }
-                instructions.push_back("RTRN " + std::to_string(symbolTable->funkcja_RBX[procName]));
-                declared_functions.insert(procName);
             }
         }
-        instructions[main_pos] += std::to_string(instructions.size());
+
+        long long main_start = instructions.size();
+        patch(main_pos, main_start);
 
         if (root->main)
         {
+            PhaseTimer timer(stats, "codegen main");
+            DebugScope scope(this, root->main, "", "main");
             std::string procName = "";
-            for (const auto &cmd : root->main->commands->commands)
+            begin_frame(procName);
+            generate_commands(root->main->commands, procName);
+            emit(Opcode::HALT);
+            generate_out_of_line_arms(procName);
+            optimize(main_start);
+            end_frame(procName);
+        }
+
+        {
+            // jumps are back-patched while generating; only the stream needs a fix-up here
+            PhaseTimer timer(stats, "jump resolution");
+            if (stream)
             {
-                generate_command(cmd, procName);
+                stream->write(instructions, emitted);
+                stream->patch(main_jump_offset, instructions[main_pos]);
             }
-            instructions.push_back("HALT");
         }
 
-        for (const auto &inst : instructions)
+        if (stats)
         {
-            std::cout << inst << std::endl;
+            stats->count("jumps back-patched", patchedJumps);
+            stats->count("symbol lookups", symbolTable->lookupCount);
+            stats->count("temporaries allocated (getNewPid)", symbolTable->newPidCount);
+            stats->count("instructions emitted", instructions.size());
+            stats->count("memory high-water mark (cells)", memoryHighWater);
+            stats->count("memory cells without frame overlaying", memoryWithoutOverlay);
         }
         return true;
     }
 
     bool generate_command(CommandNode *cmd, std::string procName)
     {
-        if (auto assignCmd = dynamic_cast<AssignNode *>(cmd))
-        {
-            return generate_assignment(assignCmd, procName);
-        }
-        else if (auto *procCall = dynamic_cast<ProcedureCallNode *>(cmd))
-        {
-            return generate_procedure_call(procCall, procName);
-        }
-        else if (auto *readCmd = dynamic_cast<ReadNode *>(cmd))
+        DebugScope scope(this, cmd, procName, construct_name(cmd->kind));
+        if (blockMap)
         {
-            return generate_read(readCmd, procName);
-        }
-        else if (auto *writeCmd = dynamic_cast<WriteNode *>(cmd))
-        {
-            return generate_write(writeCmd, procName);
+            auto loop = iterationCounters.find(cmd);
+            if (loop != iterationCounters.end())
+            {
+                record_block(loop->second, "iterations");
+            }
         }
-        else if (auto *ifNode = dynamic_cast<IfNode *>(cmd))
+        if (!stats)
         {
-            return generate_if(ifNode, procName);
+            return dispatch_command(cmd, procName);
         }
-        else if (auto *whileNode = dynamic_cast<WhileNode *>(cmd))
+
+        // instructions are attributed to the innermost command emitting them
+        size_t before = instructions.size();
+        nestedEmitted.push_back(0);
+        bool result = dispatch_command(cmd, procName);
+        long long total = instructions.size() - before;
+        stats->count(std::string("instructions in ") + construct_name(cmd->kind), total - nestedEmitted.back());
+        nestedEmitted.pop_back();
+        if (!nestedEmitted.empty())
         {
-            return generate_while(whileNode, procName);
+            nestedEmitted.back() += total;
         }
-        else if (auto *forToNode = dynamic_cast<ForToNode *>(cmd))
+        return result;
+    }
+
+    bool dispatch_command(CommandNode *cmd, std::string procName)
+    {
+        switch (cmd->kind)
         {
-            return generate_for_to(forToNode, procName);
+        case NodeKind::Assign:
+            return generate_assignment(static_cast<AssignNode *>(cmd), procName);
+        case NodeKind::ProcedureCall:
+            return generate_procedure_call(static_cast<ProcedureCallNode *>(cmd), procName);
+        case NodeKind::Read:
+            return generate_read(static_cast<ReadNode *>(cmd), procName);
+        case NodeKind::Write:
+            return generate_write(static_cast<WriteNode *>(cmd), procName);
+        case NodeKind::If:
+            return generate_if(static_cast<IfNode *>(cmd), procName);
+        case NodeKind::While:
+            return generate_while(static_cast<WhileNode *>(cmd), procName);
+        case NodeKind::ForTo:
+            return generate_for_to(static_cast<ForToNode *>(cmd), procName);
+        case NodeKind::ForDownTo:
+            return generate_for_downto(static_cast<ForDownToNode *>(cmd), procName);
+        case NodeKind::RepeatUntil:
+            return generate_repeat_until(static_cast<RepeatUntilNode *>(cmd), procName);
+        default:
+            return false;
         }
-        else if (auto *forDownToNode = dynamic_cast<ForDownToNode *>(cmd))
+    }
+
+    bool generate_commands(const CommandsNode *cmds, std::string procName)
+    {
+        if (!cmds)
         {
-            return generate_for_downto(forDownToNode, procName);
+            return true;
         }
-        else if (auto *repeatUntilNode = dynamic_cast<RepeatUntilNode *>(cmd))
+        const auto &commands = cmds->commands;
+        for (size_t i = 0; i < commands.size(); i++)
         {
-            return generate_repeat_until(repeatUntilNode, procName);
+            generate_command(commands[i], procName);
+            if (i + 1 < commands.size() && shares_divmod(commands[i], commands[i + 1], procName))
+            {
+                sharedDivmod = true;
+                generate_command(commands[++i], procName);
+                sharedDivmod = false;
+                if (stats)
+                {
+                    stats->count("divisions sharing a divmod", 1);
+                }
+            }
         }
-
-        return false;
+        return true;
     }
 
     bool generate_repeat_until(RepeatUntilNode *repeatUntilNode, std::string procName)
     {
         long long beginRepeat = instructions.size();
-        for (const auto &cmd : repeatUntilNode->commands->commands)
-        {
-            generate_command(cmd, procName);
-        }
+        generate_commands(repeatUntilNode->commands, procName);
         bool elseFirst = generate_condition(repeatUntilNode->condition, procName);
         long long endIf = instructions.size() - 1;
 
         if (!elseFirst)
         {
-            instructions[endIf] += std::to_string(beginRepeat - endIf);
+            patch(endIf, beginRepeat - endIf);
         }
         else
         {
-            instructions[endIf] += std::to_string(2);
-            instructions.push_back("JUMP " + std::to_string(beginRepeat - (long long)instructions.size()));
+            patch(endIf, 2);
+            emit(Opcode::JUMP, beginRepeat - (long long)instructions.size());
         }
         return true;
     }
 
     bool generate_for_to(ForToNode *forToNode, std::string procName)
     {
-        std::string baseName = forToNode->pidentifier->getName();
-        std::string name = getName(procName, forToNode->pidentifier->getName());
-        symbolTable->zmienna_pid[name] = symbolTable->getNewPid();
-        symbolTable->iterator_pid.insert(symbolTable->zmienna_pid[name]);
-
-        // i = start
-        generate_load_to_RAX(forToNode->fromValue, procName);
-        instructions.push_back("STORE " + std::to_string(symbolTable->zmienna_pid[name]));
-
-        std::string baseEndName = baseName + "::END";
-        std::string endName = name + "::END";
-        symbolTable->zmienna_pid[endName] = symbolTable->getNewPid();
+        return generate_for(forToNode, forToNode->pidentifier, forToNode->fromValue, forToNode->toValue,
+                            forToNode->commands, false, procName);
+    }
 
-        // i_end = koniec
-        generate_load_to_RAX(forToNode->toValue, procName);
-        instructions.push_back("STORE " + std::to_string(symbolTable->zmienna_pid[endName]));
+    bool generate_for_downto(ForDownToNode *forDownToNode, std::string procName)
+    {
+        return generate_for(forDownToNode, forDownToNode->pidentifier, forDownToNode->fromValue,
+                            forDownToNode->toValue, forDownToNode->commands, true, procName);
+    }
 
-        AssignNode *assgn = new AssignNode(new IdentifierNode(new std::string(baseName)), new BinaryExpressionNode(new ValueNode(new IdentifierNode(new std::string(baseName))), "+", new ValueNode(1)), true);
-        forToNode->commands->commands.push_back(assgn);
-        ConditionNode *cond = new ConditionNode(new ValueNode(new IdentifierNode(new std::string(baseName))), "<=", new ValueNode(new IdentifierNode(new std::string(baseEndName))));
-        WhileNode *whileNode = new WhileNode(cond, forToNode->commands);
-        generate_while(whileNode, procName);
+    // Whether a value is known not to be negative: a constant that is not, or
+    // the iterator of a FOR loop that cannot go below 0.
+    bool known_non_negative(const ValueNode *node, const std::string &procName)
+    {
+        long long value;
+        if (constant_value(node, procName, value))
+        {
+            return value >= 0;
+        }
+        if (node->identifier->isElement)
+        {
+            return false;
+        }
+        auto it = symbolTable->zmienna_pid.find(getName(procName, node->identifier->getName()));
+        return it != symbolTable->zmienna_pid.end() && nonNegativeIterators.count(it->second) > 0;
+    }
 
+    // Value of a literal or of the iterator of an enclosing unrolled loop.
+    bool constant_value(const ValueNode *node, const std::string &procName, long long &value)
+    {
+        if (!node->identifier)
+        {
+            value = node->value;
+            return true;
+        }
+        if (node->identifier->isElement)
+        {
+            return false;
+        }
+        auto it = constantIterators.find(getName(procName, node->identifier->getName()));
+        if (it == constantIterators.end())
+        {
+            return false;
+        }
+        value = it->second;
         return true;
     }
 
-    bool generate_for_downto(ForDownToNode *forToNode, std::string procName)
+    // Iterations per test of a loop that is not unrolled completely; 0 for a
+    // loop the profile never saw entered, which stays as compact as it is.
+    // A loop the profile-generate build unrolled completely has no
+    // iterations counter, but its trip count is known.
+    long long unroll_factor(const AstNode *node, long long trips, long long size)
+    {
+        long long entries = profile_count(node, "entries");
+        long long iterations = profile_count(node, "iterations");
+        if (iterations < 0 && entries >= 0 && trips >= 0)
+        {
+            iterations = entries * trips;
+        }
+        if (entries < 0 || iterations < 0)
+        {
+            return unrollFactor;
+        }
+        if (stats)
+        {
+            stats->count("unrolling decisions from the profile");
+        }
+        if (entries == 0)
+        {
+            return 0;
+        }
+        return std::min(iterations / entries, unrollBudget / std::max(1LL, size));
+    }
+
+    // A FOR loop is a WHILE over the iterator and the bound fixed on entry.
+    // With bounds known here and a body small enough for unrollBudget it is
+    // unrolled completely, the iterator a constant in every copy, unless it
+    // runs no iteration: the body is still generated once, inside the WHILE,
+    // so that its errors are reported. Otherwise an innermost loop not known
+    // to run fewer iterations runs unrollFactor iterations per test while that
+    // many remain, then the rest in a remainder loop. With a profile, a loop it
+    // never saw entered is not unrolled at all, and the factor is the average
+    // number of iterations per entry, as far as unrollBudget allows.
+    bool generate_for(CommandNode *node, IdentifierNode *iterator, ValueNode *fromValue, ValueNode *toValue,
+                      CommandsNode *commands, bool down, std::string procName)
     {
-        std::string baseName = forToNode->pidentifier->getName();
-        std::string name = getName(procName, forToNode->pidentifier->getName());
-        symbolTable->zmienna_pid[name] = symbolTable->getNewPid();
-        symbolTable->iterator_pid.insert(symbolTable->zmienna_pid[name]);
+        std::string baseName = iterator->getName();
+        std::string name = getName(procName, baseName);
+        std::string step = down ? "-" : "+";
+        std::string test = down ? ">=" : "<=";
+
+        // a loop over the name of an enclosing unrolled loop hides it
+        auto outer = constantIterators.find(name);
+        bool hidesConstant = outer != constantIterators.end();
+        long long outerValue = hidesConstant ? outer->second : 0;
+        if (hidesConstant)
+        {
+            constantIterators.erase(outer);
+        }
+
+        LoopInfo info(baseName, commands, &modRef);
+        bool nonNegative = !info.iteratorEscapes && known_non_negative(down ? toValue : fromValue, procName);
+
+        long long iteratorPid = loop_cell(0);
+        symbolTable->zmienna_pid[name] = iteratorPid;
+        symbolTable->iterator_pid.insert(iteratorPid);
+        long long from, to;
+        long long trips = -1;
+        if (constant_value(fromValue, procName, from) && constant_value(toValue, procName, to))
+        {
+            trips = LoopInfo::trip_count(from, to, down);
+        }
+        long long factor = unroll_factor(node, trips, info.size);
+        if (unrollLoops && trips > 0 && factor > 0 && !info.iteratorPassed && trips <= unrollBudget / std::max(1LL, info.size))
+        {
+            if (stats)
+            {
+                stats->count("loops fully unrolled");
+            }
+            // the counter is read off the first copy, if it emits anything
+            size_t counter = blockMap ? blockMap->counters.size() : 0;
+            long long start = instructions.size();
+            record_block(node, "entries");
+            forDepth++;
+            for (long long k = 0; k < trips; k++)
+            {
+                constantIterators[name] = down ? from - k : from + k;
+                generate_commands(commands, procName);
+            }
+            forDepth--;
+            constantIterators.erase(name);
+            if (blockMap && (long long)instructions.size() == start && blockMap->counters.size() > counter)
+            {
+                blockMap->counters.erase(blockMap->counters.begin() + counter);
+            }
+        }
+        else
+        {
+            record_block(node, "entries");
+            // i = start
+            generate_load_to_RAX(fromValue, procName);
+            emit(Opcode::STORE, symbolTable->zmienna_pid[name]);
+            if (nonNegative)
+            {
+                nonNegativeIterators.insert(iteratorPid);
+            }
 
-        // i = start
-        generate_load_to_RAX(forToNode->fromValue, procName);
-        instructions.push_back("STORE " + std::to_string(symbolTable->zmienna_pid[name]));
+            std::string baseEndName = baseName + "::END";
+            std::string endName = name + "::END";
+            symbolTable->zmienna_pid[endName] = loop_cell(1);
 
-        std::string baseEndName = baseName + "::END";
-        std::string endName = name + "::END";
-        symbolTable->zmienna_pid[endName] = symbolTable->getNewPid();
+            // i_end = koniec
+            generate_load_to_RAX(toValue, procName);
+            emit(Opcode::STORE, symbolTable->zmienna_pid[endName]);
 
-        // i_end = koniec
-        generate_load_to_RAX(forToNode->toValue, procName);
-        instructions.push_back("STORE " + std::to_string(symbolTable->zmienna_pid[endName]));
+            // the synthetic nodes name the loop's cells through these strings
+            std::string baseLimitName = baseName + "::LIMIT";
+            AssignNode increment(new IdentifierNode(&baseName), new BinaryExpressionNode(new ValueNode(new IdentifierNode(&baseName)), step, new ValueNode(1)), true);
+            std::vector<CommandNode *> body = commands->commands;
+            body.push_back(&increment);
+            iterationCounters[&increment] = node;
 
-        AssignNode *assgn = new AssignNode(new IdentifierNode(new std::string(baseName)), new BinaryExpressionNode(new ValueNode(new IdentifierNode(new std::string(baseName))), "-", new ValueNode(1)), true);
-        forToNode->commands->commands.push_back(assgn);
-        ConditionNode *cond = new ConditionNode(new ValueNode(new IdentifierNode(new std::string(baseName))), ">=", new ValueNode(new IdentifierNode(new std::string(baseEndName))));
-        WhileNode *whileNode = new WhileNode(cond, forToNode->commands);
-        generate_while(whileNode, procName);
+            if (unrollLoops && factor > 1 && (trips < 0 || trips >= factor) && !info.hasLoop && !info.iteratorEscapes && factor * info.size <= unrollBudget)
+            {
+                if (stats)
+                {
+                    stats->count("loops partially unrolled");
+                }
+                // i_limit = i_end -+ (factor - 1): factor iterations remain while i has not passed it
+                std::string limitName = name + "::LIMIT";
+                symbolTable->zmienna_pid[limitName] = loop_cell(2);
+                emit(Opcode::SET, down ? factor - 1 : 1 - factor);
+                emit(Opcode::ADD, symbolTable->zmienna_pid[endName]);
+                emit(Opcode::STORE, symbolTable->zmienna_pid[limitName]);
+
+                std::vector<CommandNode *> unrolled;
+                for (long long k = 0; k < factor; k++)
+                {
+                    unrolled.insert(unrolled.end(), body.begin(), body.end());
+                }
+                WhileNode fast(new ConditionNode(new ValueNode(new IdentifierNode(&baseName)), test, new ValueNode(new IdentifierNode(&baseLimitName))), new BorrowedCommands(unrolled));
+                WhileNode rest(new ConditionNode(new ValueNode(new IdentifierNode(&baseName)), test, new ValueNode(new IdentifierNode(&baseEndName))), new BorrowedCommands(body));
+                forDepth++;
+                generate_while(&fast, procName, node);
+                generate_while(&rest, procName, node, {"remainder-test", "remainder-body"});
+                forDepth--;
+            }
+            else
+            {
+                WhileNode loop(new ConditionNode(new ValueNode(new IdentifierNode(&baseName)), test, new ValueNode(new IdentifierNode(&baseEndName))), new BorrowedCommands(body));
+                forDepth++;
+                generate_while(&loop, procName, node);
+                forDepth--;
+            }
+            iterationCounters.erase(&increment);
+        }
 
+        nonNegativeIterators.erase(iteratorPid);
+        if (hidesConstant)
+        {
+            constantIterators[name] = outerValue;
+        }
         return true;
     }
 };
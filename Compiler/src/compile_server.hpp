@@ -0,0 +1,413 @@
+#ifndef COMPILE_SERVER_HPP
+#define COMPILE_SERVER_HPP
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <stdexcept>
+#include <memory>
+#include <new>
+#include <cerrno>
+#include <cstring>
+#include <csignal>
+
+#include <poll.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "options.hpp"
+#include "driver.hpp"
+#include "parse_context.hpp"
+#include "source_buffer.hpp"
+#include "symbol_table.hpp"
+#include "code_generator.hpp"
+#include "output_writer.hpp"
+#include "binary_program.hpp"
+
+// --server <socket>: compiles sources sent over a UNIX domain socket, so that
+// build tools pay for starting the compiler once instead of per file. Every
+// connection is one request: the client sends the source and shuts down its
+// side of the socket, the server answers
+//
+//   OK\n<program>         in the text or, with --binary, the binary format
+//   ERROR\n<diagnostics>  one per line, as the compiler prints them
+//
+// and closes the connection. -j worker processes, forked before the first
+// request, accept connections, so at most that many requests are compiled at
+// once; the rest wait in the listen backlog. Each request gets its own parser
+// state, symbol table and code generator, all freed before the next one.
+//
+// Requests are isolated by their worker: its address space is capped at
+// WORKER_ADDRESS_SPACE, so a request that exhausts it fails with "Out of
+// memory" like any other error, and one that crashes the worker (a stack
+// overflow, say) is answered with an error by a signal handler before the
+// worker exits. The server then forks a replacement; requests in other
+// workers are not affected. The source must arrive within
+// RECEIVE_TIMEOUT_SECONDS in all and the answer be read within
+// ANSWER_TIMEOUT_SECONDS, or the worker gives up on the client. Compilation
+// itself has no time limit.
+class CompileServer
+{
+public:
+    static const size_t MAX_SOURCE_BYTES = 16 << 20;
+    static const int RECEIVE_TIMEOUT_SECONDS = 10;
+    static const int ANSWER_TIMEOUT_SECONDS = 10;
+    static const rlim_t WORKER_ADDRESS_SPACE = rlim_t(2) << 30;
+
+    explicit CompileServer(const CompilerOptions &options) : options(options), driver(options) {}
+
+    int run()
+    {
+        const std::string &path = options.serverSocket;
+        sockaddr_un address;
+        std::memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(address.sun_path))
+        {
+            std::cerr << "\e[0;31mError:\e[0m Socket path too long: " << path << std::endl;
+            return 1;
+        }
+        std::strcpy(address.sun_path, path.c_str());
+
+        listenFd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listenFd < 0 || !bind_socket(address))
+        {
+            std::cerr << "\e[0;31mError:\e[0m Could not listen on " << path << ": " << std::strerror(errno) << std::endl;
+            return 1;
+        }
+        socket_path() = path.c_str();
+        std::signal(SIGPIPE, SIG_IGN); // a client leaving early must not end the server
+        std::signal(SIGINT, stop);
+        std::signal(SIGTERM, stop);
+
+        std::cerr << "Compile server listening on " << path << " with " << options.jobs << " workers" << std::endl;
+        serverPid = ::getpid();
+        std::vector<pid_t> workers(options.jobs, -1);
+        for (auto &worker : workers)
+        {
+            worker = spawn();
+        }
+        for (;;)
+        {
+            int status;
+            pid_t pid = ::waitpid(-1, &status, 0);
+            if (pid < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                std::cerr << "\e[0;31mError:\e[0m Lost the workers: " << std::strerror(errno) << std::endl;
+                return 1;
+            }
+            for (auto &worker : workers)
+            {
+                if (worker == pid)
+                {
+                    std::cerr << "Worker " << pid << (WIFSIGNALED(status) ? " killed by signal " + std::to_string(WTERMSIG(status))
+                                                                            : " exited with " + std::to_string(WEXITSTATUS(status)))
+                              << ", starting another" << std::endl;
+                    worker = spawn();
+                }
+            }
+        }
+    }
+
+private:
+    const CompilerOptions &options;
+    Driver driver;
+    int listenFd = -1;
+    pid_t serverPid = -1;
+
+    // connection of the request being compiled, for the crash handler
+    static volatile sig_atomic_t &current_client()
+    {
+        static volatile sig_atomic_t client = -1;
+        return client;
+    }
+
+    // -1 when the fork fails; the server goes on with fewer workers
+    pid_t spawn()
+    {
+        pid_t pid = ::fork();
+        if (pid < 0)
+        {
+            std::cerr << "\e[0;31mError:\e[0m Could not start a worker: " << std::strerror(errno) << std::endl;
+        }
+        if (pid != 0)
+        {
+            return pid;
+        }
+
+        // the worker ends with the server, and only the server removes the socket
+        ::prctl(PR_SET_PDEATHSIG, SIGTERM);
+        std::signal(SIGINT, SIG_DFL);
+        std::signal(SIGTERM, SIG_DFL);
+        if (::getppid() != serverPid)
+        {
+            ::_exit(0);
+        }
+        rlimit limit;
+        if (::getrlimit(RLIMIT_AS, &limit) == 0 && (limit.rlim_cur == RLIM_INFINITY || limit.rlim_cur > WORKER_ADDRESS_SPACE))
+        {
+            limit.rlim_cur = WORKER_ADDRESS_SPACE;
+            ::setrlimit(RLIMIT_AS, &limit);
+        }
+
+        static char alternateStack[1 << 16]; // a stack overflow leaves no room on the stack itself
+        stack_t stack;
+        stack.ss_sp = alternateStack;
+        stack.ss_size = sizeof(alternateStack);
+        stack.ss_flags = 0;
+        ::sigaltstack(&stack, nullptr);
+        struct sigaction action;
+        std::memset(&action, 0, sizeof(action));
+        action.sa_handler = crashed;
+        action.sa_flags = SA_ONSTACK | SA_RESETHAND;
+        for (int signal : {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT})
+        {
+            ::sigaction(signal, &action, nullptr);
+        }
+
+        serve();
+        ::_exit(1);
+    }
+
+    // Answers the request that crashed the worker, then lets the signal end it.
+    static void crashed(int signal)
+    {
+        static const char answer[] = "ERROR\n\e[0;31mError:\e[0m The compiler crashed on this request\n";
+        int client = current_client();
+        if (client >= 0)
+        {
+            ssize_t ignored = ::write(client, answer, sizeof(answer) - 1);
+            (void)ignored;
+        }
+        ::raise(signal);
+    }
+
+    // read by the signal handler, which can reach no members
+    static const char *&socket_path()
+    {
+        static const char *path = "";
+        return path;
+    }
+
+    static void stop(int)
+    {
+        ::unlink(socket_path());
+        ::_exit(0);
+    }
+
+    // A socket file left behind by a server that is gone is replaced; one
+    // that still accepts connections is not.
+    bool bind_socket(const sockaddr_un &address)
+    {
+        if (::bind(listenFd, (const sockaddr *)&address, sizeof(address)) != 0)
+        {
+            if (errno != EADDRINUSE)
+            {
+                return false;
+            }
+            int probe = ::socket(AF_UNIX, SOCK_STREAM, 0);
+            bool alive = probe >= 0 && ::connect(probe, (const sockaddr *)&address, sizeof(address)) == 0;
+            ::close(probe);
+            if (alive)
+            {
+                errno = EADDRINUSE;
+                return false;
+            }
+            ::unlink(address.sun_path);
+            if (::bind(listenFd, (const sockaddr *)&address, sizeof(address)) != 0)
+            {
+                return false;
+            }
+        }
+        return ::listen(listenFd, SOMAXCONN) == 0;
+    }
+
+    void serve()
+    {
+        for (;;)
+        {
+            int client = ::accept(listenFd, nullptr, nullptr);
+            if (client < 0)
+            {
+                if (errno == EINTR || errno == ECONNABORTED)
+                {
+                    continue;
+                }
+                std::cerr << "\e[0;31mError:\e[0m accept failed: " << std::strerror(errno) << std::endl;
+                return;
+            }
+            HeapMeter heap;
+            try
+            {
+                handle(client);
+            }
+            catch (const std::exception &)
+            {
+                // the client went away while the answer was being sent
+            }
+            current_client() = -1;
+            ::alarm(0);
+            ::close(client);
+            if (options.memReport)
+            {
+                std::string report = "Memory report for request: peak heap " + std::to_string(heap.peak()) +
+                                     " bytes, " + std::to_string(heap.retained()) + " bytes not freed\n";
+                std::cerr << report << std::flush;
+            }
+        }
+    }
+
+    void handle(int client)
+    {
+        std::string source;
+        std::vector<std::string> errors;
+        BinaryProgram program;
+        current_client() = client;
+        bool ok = receive(client, source, errors) && compile(source, program, errors);
+        current_client() = -1;
+        ::alarm(ANSWER_TIMEOUT_SECONDS); // a client that does not read ends the worker
+        if (!ok)
+        {
+            reply_errors(client, errors);
+            return;
+        }
+
+        send_all(client, "OK\n");
+        if (options.binary)
+        {
+            send_all(client, program.encode());
+        }
+        else
+        {
+            OutputWriter out(client, "request");
+            out.write(program.instructions);
+            out.close();
+        }
+    }
+
+    // The same phases as compiling a file.
+    bool compile(const std::string &source, BinaryProgram &program, std::vector<std::string> &errors)
+    {
+        try
+        {
+            ParseContext context("request");
+            SourceBuffer buffer("request", source.data(), source.size());
+            parse_source(buffer, context);
+            errors = context.errors;
+            if (context.hasErrors() || context.root == nullptr)
+            {
+                if (errors.empty())
+                {
+                    errors.push_back("There is no PROGRAM created!");
+                }
+                return false;
+            }
+            PassManager passes(options, nullptr);
+            passes.run_ast_passes(context);
+            SymbolTable symbolTable(context.root);
+            CodeGenerator generate;
+            driver.configure(generate, passes, nullptr);
+            generate.generate_code(context.root, &symbolTable);
+            program.instructions.swap(generate.instructions);
+            program.maxAddress = generate.memoryHighWater - 1;
+        }
+        catch (const std::runtime_error &e)
+        {
+            errors.push_back(e.what());
+            return false;
+        }
+        catch (const std::bad_alloc &)
+        {
+            errors.push_back("\e[0;31mError:\e[0m Out of memory");
+            return false;
+        }
+        catch (const std::exception &e)
+        {
+            errors.push_back(std::string("\e[0;31mError:\e[0m Compilation failed: ") + e.what());
+            return false;
+        }
+        return true;
+    }
+
+    // Reads the source up to the client's shutdown; false with a diagnostic
+    // for sources over MAX_SOURCE_BYTES, sources not complete within
+    // RECEIVE_TIMEOUT_SECONDS and clients that fail.
+    bool receive(int client, std::string &source, std::vector<std::string> &errors)
+    {
+        char chunk[1 << 16];
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(RECEIVE_TIMEOUT_SECONDS);
+        for (;;)
+        {
+            long long left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+            pollfd ready = {client, POLLIN, 0};
+            int polled = left > 0 ? ::poll(&ready, 1, left) : 0;
+            if (polled == 0)
+            {
+                errors.push_back("\e[0;31mError:\e[0m Request timed out");
+                return false;
+            }
+            ssize_t n = polled > 0 ? ::read(client, chunk, sizeof(chunk)) : -1;
+            if (n == 0)
+            {
+                return true;
+            }
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                errors.push_back("\e[0;31mError:\e[0m Could not read request");
+                return false;
+            }
+            if (source.size() + n > MAX_SOURCE_BYTES)
+            {
+                errors.push_back("\e[0;31mError:\e[0m Request larger than " + std::to_string(MAX_SOURCE_BYTES) +
+                                 " bytes");
+                return false;
+            }
+            source.append(chunk, n);
+        }
+    }
+
+    void reply_errors(int client, const std::vector<std::string> &errors)
+    {
+        std::string text = "ERROR\n";
+        for (const auto &error : errors)
+        {
+            text += error + "\n";
+        }
+        send_all(client, text);
+    }
+
+    static void send_all(int client, const std::string &text)
+    {
+        const char *data = text.data();
+        size_t left = text.size();
+        while (left > 0)
+        {
+            ssize_t n = ::write(client, data, left);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                throw std::runtime_error(std::string("Could not answer request: ") + std::strerror(errno));
+            }
+            data += n;
+            left -= n;
+        }
+    }
+};
+
+#endif // COMPILE_SERVER_HPP
@@ -0,0 +1,123 @@
+#ifndef DEBUG_MAP_HPP
+#define DEBUG_MAP_HPP
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+
+// Links generated instructions back to the source. Every entry starts a range
+// of instructions that ends where the next entry starts; all of them were
+// emitted for the given construct on the given source line.
+struct DebugEntry
+{
+    long long index;
+    int line;
+    std::string procedure; // "" for the main program
+    std::string construct;
+};
+
+// Sidecar file format (output.mr.map), one entry per line:
+//   <first instruction> <source line> <procedure or -> <construct...>
+class DebugMap
+{
+public:
+    std::vector<DebugEntry> entries;
+
+    // Entries must be added in increasing index order. An entry at the same
+    // index as the previous one replaces it, so empty ranges never appear.
+    void add(long long index, int line, const std::string &procedure, const std::string &construct)
+    {
+        if (!entries.empty() && entries.back().index == index)
+        {
+            entries.pop_back();
+        }
+        if (!entries.empty() && entries.back().line == line && entries.back().procedure == procedure &&
+            entries.back().construct == construct)
+        {
+            return;
+        }
+        entries.push_back({index, line, procedure, construct});
+    }
+
+    // Entry covering the instruction, or nullptr if there is none.
+    const DebugEntry *find(long long index) const
+    {
+        auto it = std::upper_bound(entries.begin(), entries.end(), index,
+                                   [](long long idx, const DebugEntry &entry)
+                                   { return idx < entry.index; });
+        if (it == entries.begin())
+        {
+            return nullptr;
+        }
+        return &*(it - 1);
+    }
+
+    // After instructions from `from` on moved, moved[index - from] being the
+    // new index; entries left without instructions are dropped.
+    void remap(long long from, const std::vector<long long> &moved)
+    {
+        std::vector<DebugEntry> old;
+        old.swap(entries);
+        for (auto &entry : old)
+        {
+            if (entry.index >= from)
+            {
+                entry.index = moved[entry.index - from];
+            }
+            add(entry.index, entry.line, entry.procedure, entry.construct);
+        }
+    }
+
+    void write(const std::string &fileName) const
+    {
+        std::ofstream out(fileName);
+        out << "# instruction line procedure construct\n";
+        for (const auto &entry : entries)
+        {
+            out << entry.index << " " << entry.line << " " << (entry.procedure.empty() ? "-" : entry.procedure) << " "
+                << entry.construct << "\n";
+        }
+        if (!out)
+        {
+            throw std::runtime_error("Could not write debug map " + fileName);
+        }
+    }
+
+    static DebugMap read(const std::string &fileName)
+    {
+        std::ifstream in(fileName);
+        if (!in)
+        {
+            throw std::runtime_error("Could not open debug map " + fileName);
+        }
+        DebugMap map;
+        std::string line;
+        int lineNumber = 0;
+        while (std::getline(in, line))
+        {
+            lineNumber++;
+            if (line.empty() || line[0] == '#')
+            {
+                continue;
+            }
+            std::istringstream fields(line);
+            DebugEntry entry;
+            if (!(fields >> entry.index >> entry.line >> entry.procedure))
+            {
+                throw std::runtime_error("Malformed debug map " + fileName + " at line: " + std::to_string(lineNumber));
+            }
+            if (entry.procedure == "-")
+            {
+                entry.procedure = "";
+            }
+            std::getline(fields >> std::ws, entry.construct);
+            map.entries.push_back(entry);
+        }
+        return map;
+    }
+};
+
+#endif // DEBUG_MAP_HPP
@@ -0,0 +1,546 @@
+#ifndef DRIVER_HPP
+#define DRIVER_HPP
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <new>
+#include <memory>
+#include <fstream>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <sstream>
+
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "ast.hpp"
+#include "options.hpp"
+#include "parse_context.hpp"
+#include "source_buffer.hpp"
+#include "symbol_table.hpp"
+#include "code_generator.hpp"
+#include "output_writer.hpp"
+#include "binary_program.hpp"
+#include "stats.hpp"
+#include "debug_map.hpp"
+#include "machine.hpp"
+#include "profiler.hpp"
+#include "profile_data.hpp"
+#include "interpreter.hpp"
+#include "c_generator.hpp"
+#include "pass_manager.hpp"
+
+// Outcome of compiling one input file. Errors are collected instead of printed
+// so that concurrent compilations do not interleave their messages.
+struct CompileResult
+{
+    std::string input;
+    std::string output;
+    bool ok = false;
+    std::vector<std::string> errors;
+    long long instructions = 0;
+    double milliseconds = 0;
+    long long peakHeapBytes = 0;     // above the heap in use when the compilation started
+    long long retainedHeapBytes = 0; // still held when it ended: the diagnostics and statistics
+    CompileStats stats;
+};
+
+class Driver
+{
+public:
+    explicit Driver(const CompilerOptions &options) : options(options) {}
+
+    CompileResult compile(const std::string &input, const std::string &output)
+    {
+        CompileResult result;
+        result.input = input;
+        result.output = output;
+        auto start = std::chrono::steady_clock::now();
+        HeapMeter heap;
+
+        CompileStats *stats = options.collectStats() ? &result.stats : nullptr;
+
+        try
+        {
+            ParseContext context(input);
+            context.stats = stats;
+            SourceBuffer source(input);
+            parse_source(source, context);
+            result.errors = context.errors;
+
+            if (!context.hasErrors() && context.root != nullptr && (options.emitC || options.native))
+            {
+                SymbolTable symbolTable(context.root);
+                compile_c(context.root, &symbolTable, output, stats);
+                result.ok = true;
+            }
+            else if (!context.hasErrors() && context.root != nullptr)
+            {
+                PassManager passes(options, stats);
+                passes.run_ast_passes(context);
+                std::unique_ptr<SymbolTable> symbolTable;
+                {
+                    PhaseTimer timer(stats, "symbol table");
+                    symbolTable.reset(new SymbolTable(context.root));
+                }
+
+                CodeGenerator generate;
+                DebugMap debugMap;
+                BlockMap blockMap;
+                ProfileData profile;
+                configure(generate, passes, stats);
+                if (options.debugMap)
+                {
+                    generate.debugMap = &debugMap;
+                }
+                if (options.profileGenerate)
+                {
+                    generate.blockMap = &blockMap;
+                }
+                if (options.profileUse)
+                {
+                    profile = ProfileData::read(options.profileFile.empty() ? output + ".profile" : options.profileFile);
+                    generate.profile = &profile;
+                }
+                if (options.binary)
+                {
+                    generate.generate_code(context.root, symbolTable.get());
+                    PhaseTimer timer(stats, "output");
+                    write_binary(generate, options.debugMap ? &debugMap : nullptr, output, stats);
+                }
+                else
+                {
+                    OutputWriter outputFile(output);
+                    if (options.stream)
+                    {
+                        generate.generate_code(context.root, symbolTable.get(), &outputFile);
+                    }
+                    else
+                    {
+                        generate.generate_code(context.root, symbolTable.get());
+                    }
+                    {
+                        PhaseTimer timer(stats, "output");
+                        if (!options.stream)
+                        {
+                            outputFile.write(generate.instructions);
+                        }
+                        outputFile.close();
+                    }
+                    if (stats)
+                    {
+                        stats->count("output bytes", outputFile.bytesWritten());
+                    }
+                }
+                if (options.debugMap && !options.binary)
+                {
+                    debugMap.write(output + ".map");
+                }
+                if (options.profileGenerate)
+                {
+                    blockMap.write(output + ".blocks");
+                }
+                passes.report();
+                result.instructions = generate.instructions.size();
+                result.ok = true;
+            }
+            else
+            {
+                result.errors.push_back("There is no PROGRAM created!");
+            }
+        }
+        catch (const std::runtime_error &e)
+        {
+            result.errors.push_back(e.what());
+        }
+        catch (const std::bad_alloc &)
+        {
+            result.errors.push_back("\e[0;31mError:\e[0m Out of memory");
+        }
+        catch (const std::exception &e)
+        {
+            result.errors.push_back(std::string("\e[0;31mError:\e[0m Compilation failed: ") + e.what());
+        }
+
+        auto end = std::chrono::steady_clock::now();
+        result.milliseconds = std::chrono::duration<double, std::milli>(end - start).count();
+        result.peakHeapBytes = heap.peak();
+        result.retainedHeapBytes = heap.retained();
+        return result;
+    }
+
+    // Code generation settings taken from the command line.
+    void configure(CodeGenerator &generate, PassManager &passes, CompileStats *stats)
+    {
+        generate.stats = stats;
+        generate.passes = &passes;
+        generate.copyInOut = options.copyInOut;
+        generate.overlayFrames = options.overlayFrames;
+        generate.unrollLoops = options.unrollLoops;
+        generate.unrollFactor = options.unrollFactor;
+        generate.unrollBudget = options.unrollBudget;
+    }
+
+    // --binary: the debug map, if any, goes into the program file.
+    void write_binary(const CodeGenerator &generate, const DebugMap *debugMap, const std::string &output,
+                      CompileStats *stats)
+    {
+        BinaryProgram program;
+        program.instructions = generate.instructions;
+        program.maxAddress = generate.memoryHighWater - 1;
+        if (debugMap)
+        {
+            program.hasDebugMap = true;
+            program.debugMap = *debugMap;
+        }
+        long long bytes = program.write(output);
+        if (stats)
+        {
+            stats->count("output bytes", bytes);
+        }
+    }
+
+    // --convert: a text program becomes binary, taking <input>.map into its
+    // debug section if there is one; a binary program becomes text, its debug
+    // section written to <output>.map.
+    int convert(const std::string &input, const std::string &output)
+    {
+        try
+        {
+            if (BinaryProgram::is_binary(input))
+            {
+                BinaryProgram program = BinaryProgram::read(input);
+                OutputWriter outputFile(output);
+                outputFile.write(program.instructions);
+                outputFile.close();
+                if (program.hasDebugMap)
+                {
+                    program.debugMap.write(output + ".map");
+                }
+            }
+            else
+            {
+                BinaryProgram program;
+                program.instructions = read_program(input);
+                program.maxAddress = BinaryProgram::direct_max_address(program.instructions);
+                program.maxAddressLowerBound = true;
+                if (std::ifstream(input + ".map"))
+                {
+                    program.hasDebugMap = true;
+                    program.debugMap = DebugMap::read(input + ".map");
+                }
+                program.write(output);
+            }
+        }
+        catch (const std::runtime_error &e)
+        {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    // --emit-c and --native: writes the program as C and builds it with $CC.
+    void compile_c(ProgramNode *root, SymbolTable *symbolTable, const std::string &output, CompileStats *stats)
+    {
+        std::string executable = CompilerOptions::withoutExtension(output, ".mr");
+        std::string source = executable + ".c";
+        {
+            PhaseTimer timer(stats, "C generation");
+            CGenerator generate(symbolTable);
+            std::ofstream out(source);
+            out << generate.generate(root);
+            if (!out)
+            {
+                throw std::runtime_error("Could not write " + source);
+            }
+        }
+        if (options.native)
+        {
+            PhaseTimer timer(stats, "native build");
+            build_native(executable, source);
+        }
+    }
+
+    // Runs $CC (cc if unset) on the C source, without a shell, so that file
+    // names are passed as they are. $CC may hold a command with arguments,
+    // such as "ccache cc", split on whitespace. Several workers may build at
+    // once; each waits for its own child.
+    void build_native(const std::string &executable, const std::string &source)
+    {
+        const char *cc = std::getenv("CC");
+        std::vector<std::string> args;
+        std::istringstream words(cc ? cc : "");
+        for (std::string word; words >> word;)
+        {
+            args.push_back(word);
+        }
+        if (args.empty())
+        {
+            args.push_back("cc");
+        }
+        for (const char *arg : {"-O2", "-fwrapv", "-o"})
+        {
+            args.push_back(arg);
+        }
+        args.push_back(executable);
+        args.push_back(source);
+
+        std::vector<char *> argv;
+        for (auto &arg : args)
+        {
+            argv.push_back(&arg[0]);
+        }
+        argv.push_back(nullptr);
+
+        pid_t child;
+        int error = posix_spawnp(&child, argv[0], nullptr, nullptr, argv.data(), environ);
+        if (error != 0)
+        {
+            throw std::runtime_error("Could not run " + args[0] + ": " + std::strerror(error));
+        }
+        int status;
+        while (waitpid(child, &status, 0) < 0)
+        {
+            if (errno != EINTR)
+            {
+                throw std::runtime_error("Could not wait for " + args[0] + ": " + std::strerror(errno));
+            }
+        }
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            throw std::runtime_error("Could not build " + executable + " from " + source);
+        }
+    }
+
+    // --profile: runs an already compiled program and reports its cost per line.
+    int profile(const std::string &source, const std::string &programFile)
+    {
+        try
+        {
+            BinaryProgram program;
+            if (BinaryProgram::is_binary(programFile))
+            {
+                program = BinaryProgram::read(programFile);
+            }
+            else
+            {
+                program.instructions = read_program(programFile);
+            }
+            DebugMap debugMap = program.hasDebugMap ? program.debugMap : DebugMap::read(programFile + ".map");
+            Profiler profiler(program.instructions, debugMap);
+            profiler.run(std::cin, std::cout);
+            std::cout.flush();
+            profiler.report(source, std::cerr);
+        }
+        catch (const std::runtime_error &e)
+        {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    // --profile-run: adds the execution counts of one run to <program>.profile.
+    int profile_run(const std::string &programFile)
+    {
+        try
+        {
+            std::vector<Instruction> program = read_program(programFile);
+            BlockMap blockMap = BlockMap::read(programFile + ".blocks");
+            ProfileData profile = ProfileData::read(programFile + ".profile", false);
+            Machine machine(program, true);
+            machine.run(std::cin, std::cout);
+            blockMap.collect(machine.executed, profile);
+            profile.write(programFile + ".profile");
+        }
+        catch (const std::runtime_error &e)
+        {
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    // --run: interprets a source file on stdin and stdout.
+    int interpret(const std::string &input)
+    {
+        try
+        {
+            ParseContext context(input);
+            SourceBuffer source(input);
+            parse_source(source, context);
+            for (const auto &error : context.errors)
+            {
+                std::cerr << error << std::endl;
+            }
+            if (context.hasErrors() || context.root == nullptr)
+            {
+                if (!context.hasErrors())
+                {
+                    std::cerr << "There is no PROGRAM created!" << std::endl;
+                }
+                return 1;
+            }
+            SymbolTable symbolTable(context.root);
+            Interpreter interpreter(context.root, &symbolTable);
+            interpreter.run(std::cin, std::cout);
+            std::cout.flush();
+        }
+        catch (const std::runtime_error &e)
+        {
+            std::cout.flush();
+            std::cerr << e.what() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+
+    // Compiles every file from the options on a pool of worker threads. A file
+    // that fails does not stop the others; its errors are printed prefixed with
+    // its name. Returns the process exit code.
+    int run()
+    {
+        if (!options.profileRun.empty())
+        {
+            return profile_run(options.profileRun);
+        }
+        if (!options.runFile.empty())
+        {
+            return interpret(options.runFile);
+        }
+        if (!options.convertInput.empty())
+        {
+            return convert(options.convertInput, options.convertOutput);
+        }
+        if (options.profile)
+        {
+            return profile(options.files[0].first, options.files[0].second);
+        }
+
+        const auto &files = options.files;
+        std::vector<CompileResult> results(files.size());
+        std::atomic<size_t> next(0);
+        std::mutex printLock;
+        bool batch = files.size() > 1;
+
+        auto worker = [&]()
+        {
+            for (size_t i = next++; i < files.size(); i = next++)
+            {
+                results[i] = compile(files[i].first, files[i].second);
+
+                std::lock_guard<std::mutex> guard(printLock);
+                for (const auto &error : results[i].errors)
+                {
+                    if (batch)
+                    {
+                        std::cerr << results[i].input << ": ";
+                    }
+                    std::cerr << error << std::endl;
+                }
+                print_stats(results[i]);
+            }
+        };
+
+        auto start = std::chrono::steady_clock::now();
+        unsigned threads = std::min<size_t>(options.jobs, files.size());
+        if (threads <= 1)
+        {
+            worker();
+        }
+        else
+        {
+            std::vector<std::thread> pool;
+            for (unsigned i = 0; i < threads; i++)
+            {
+                pool.emplace_back(worker);
+            }
+            for (auto &thread : pool)
+            {
+                thread.join();
+            }
+        }
+        auto end = std::chrono::steady_clock::now();
+
+        size_t failed = 0;
+        for (const auto &result : results)
+        {
+            failed += !result.ok;
+        }
+        if (batch)
+        {
+            print_summary(results, failed, std::chrono::duration<double, std::milli>(end - start).count());
+        }
+        if (!options.timeReportFile.empty() && !write_stats_file(results))
+        {
+            std::cerr << "Error: Could not write " << options.timeReportFile << std::endl;
+            return 1;
+        }
+        return failed == 0 ? 0 : 1;
+    }
+
+private:
+    const CompilerOptions &options;
+
+    void print_stats(const CompileResult &result)
+    {
+        if (options.memReport)
+        {
+            std::cerr << "Memory report for " << result.input << ": peak heap " << result.peakHeapBytes
+                      << " bytes, " << result.retainedHeapBytes << " bytes not freed" << std::endl;
+        }
+        if (options.timeReport)
+        {
+            std::cerr << "Time report for " << result.input << ":\n";
+            result.stats.print_table(std::cerr);
+            std::cerr << std::endl;
+        }
+        if (options.timeReportJson)
+        {
+            result.stats.print_json(std::cerr, result.input);
+            std::cerr << std::endl;
+        }
+    }
+
+    bool write_stats_file(const std::vector<CompileResult> &results)
+    {
+        std::ofstream out(options.timeReportFile);
+        out << "[";
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            out << (i ? ",\n " : "");
+            results[i].stats.print_json(out, results[i].input);
+        }
+        out << "]\n";
+        return bool(out);
+    }
+
+    void print_summary(const std::vector<CompileResult> &results, size_t failed, double milliseconds)
+    {
+        std::cerr << "Compiled " << results.size() - failed << " of " << results.size() << " files in "
+                  << (long long)milliseconds << " ms";
+        if (failed > 0)
+        {
+            std::cerr << ", " << failed << " failed:";
+        }
+        std::cerr << std::endl;
+        for (const auto &result : results)
+        {
+            if (!result.ok)
+            {
+                std::cerr << "  " << result.input << std::endl;
+            }
+        }
+    }
+};
+
+#endif // DRIVER_HPP
@@ -0,0 +1,141 @@
+#ifndef INSTRUCTION_HPP
+#define INSTRUCTION_HPP
+
+#include <string>
+
+enum class Opcode
+{
+    GET,
+    PUT,
+    LOAD,
+    STORE,
+    LOADI,
+    STOREI,
+    ADD,
+    SUB,
+    ADDI,
+    SUBI,
+    SET,
+    HALF,
+    JUMP,
+    JPOS,
+    JZERO,
+    JNEG,
+    RTRN,
+    HALT
+};
+
+// Single machine instruction. Jumps keep the relative offset in arg, exactly
+// as it is written to the output file.
+struct Instruction
+{
+    Opcode op;
+    long long arg;
+};
+
+inline const char *opcode_name(Opcode op)
+{
+    switch (op)
+    {
+    case Opcode::GET:
+        return "GET";
+    case Opcode::PUT:
+        return "PUT";
+    case Opcode::LOAD:
+        return "LOAD";
+    case Opcode::STORE:
+        return "STORE";
+    case Opcode::LOADI:
+        return "LOADI";
+    case Opcode::STOREI:
+        return "STOREI";
+    case Opcode::ADD:
+        return "ADD";
+    case Opcode::SUB:
+        return "SUB";
+    case Opcode::ADDI:
+        return "ADDI";
+    case Opcode::SUBI:
+        return "SUBI";
+    case Opcode::SET:
+        return "SET";
+    case Opcode::HALF:
+        return "HALF";
+    case Opcode::JUMP:
+        return "JUMP";
+    case Opcode::JPOS:
+        return "JPOS";
+    case Opcode::JZERO:
+        return "JZERO";
+    case Opcode::JNEG:
+        return "JNEG";
+    case Opcode::RTRN:
+        return "RTRN";
+    case Opcode::HALT:
+        return "HALT";
+    }
+    return "";
+}
+
+// Cost of executing the instruction on the target machine.
+inline long long instruction_cost(Opcode op)
+{
+    switch (op)
+    {
+    case Opcode::GET:
+    case Opcode::PUT:
+        return 100;
+    case Opcode::LOAD:
+    case Opcode::STORE:
+    case Opcode::ADD:
+    case Opcode::SUB:
+    case Opcode::RTRN:
+        return 10;
+    case Opcode::LOADI:
+    case Opcode::STOREI:
+    case Opcode::ADDI:
+    case Opcode::SUBI:
+        return 20;
+    case Opcode::SET:
+        return 50;
+    case Opcode::HALF:
+        return 5;
+    case Opcode::JUMP:
+    case Opcode::JPOS:
+    case Opcode::JZERO:
+    case Opcode::JNEG:
+        return 1;
+    case Opcode::HALT:
+        return 0;
+    }
+    return 0;
+}
+
+// Inverse of opcode_name; returns false for unknown mnemonics.
+inline bool parse_opcode(const std::string &name, Opcode &op)
+{
+    static const Opcode all[] = {Opcode::GET, Opcode::PUT, Opcode::LOAD, Opcode::STORE, Opcode::LOADI, Opcode::STOREI,
+                                 Opcode::ADD, Opcode::SUB, Opcode::ADDI, Opcode::SUBI, Opcode::SET, Opcode::HALF,
+                                 Opcode::JUMP, Opcode::JPOS, Opcode::JZERO, Opcode::JNEG, Opcode::RTRN, Opcode::HALT};
+    for (Opcode candidate : all)
+    {
+        if (name == opcode_name(candidate))
+        {
+            op = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+inline bool has_operand(Opcode op)
+{
+    return op != Opcode::HALF && op != Opcode::HALT;
+}
+
+inline bool is_jump(Opcode op)
+{
+    return op == Opcode::JUMP || op == Opcode::JPOS || op == Opcode::JZERO || op == Opcode::JNEG;
+}
+
+#endif // INSTRUCTION_HPP
@@ -0,0 +1,506 @@
+#ifndef INTERPRETER_HPP
+#define INTERPRETER_HPP
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <utility>
+#include <stdexcept>
+
+#include "ast.hpp"
+#include "symbol_table.hpp"
+
+class InterpreterError : public std::runtime_error
+{
+public:
+    InterpreterError(const std::string &message, int line)
+        : std::runtime_error("\e[0;31mError:\e[0m " + message + " at line: " + std::to_string(line)) {}
+};
+
+// Runs a program straight from its tree (--run). The tree is first resolved
+// into steps whose operands are cells of the symbol table's layout, so
+// running them never looks up a name. Parameters hold the address of their
+// argument as in the generated code, every procedure keeps its own cells and
+// the arithmetic is the generated code's: division rounds down, the remainder
+// takes the sign of the divisor and dividing by 0 gives 0. Values are 64-bit.
+class Interpreter
+{
+public:
+    Interpreter(ProgramNode *root, SymbolTable *symbolTable) : symbolTable(symbolTable), cells(symbolTable->pid)
+    {
+        if (root->procedures)
+        {
+            for (const auto &proc : root->procedures->procedures)
+            {
+                std::string procName = *proc->arguments->procedureName;
+                Procedure procedure;
+                if (proc->arguments->arguments)
+                {
+                    for (const auto &arg : proc->arguments->arguments->arguments)
+                    {
+                        std::string name = getName(procName, *arg->argumentName);
+                        procedure.parameters.push_back(arg->isArray ? symbolTable->tablica_param_pid[name]
+                                                                    : symbolTable->parametr_pid[name]);
+                    }
+                }
+                resolve(proc->commands, procName, procedure.body);
+                procedures[procName] = procedure;
+            }
+        }
+        if (root->main)
+        {
+            resolve(root->main->commands, "", main);
+        }
+    }
+
+    void run(std::istream &in, std::ostream &out)
+    {
+        this->in = &in;
+        this->out = &out;
+        memory.assign(cells, 0);
+        execute(main);
+    }
+
+    // The result of a binary operator; wraps around on overflow.
+    static long long apply(char op, long long a, long long b)
+    {
+        typedef unsigned long long Bits;
+        switch (op)
+        {
+        case '+':
+            return (long long)((Bits)a + (Bits)b);
+        case '-':
+            return (long long)((Bits)a - (Bits)b);
+        case '*':
+            return (long long)((Bits)a * (Bits)b);
+        case '/':
+        case '%':
+        {
+            if (b == 0)
+            {
+                return 0;
+            }
+            if (b == -1)
+            {
+                return op == '/' ? (long long)(0 - (Bits)a) : 0;
+            }
+            long long quotient = a / b;
+            long long remainder = a % b;
+            if (remainder != 0 && (remainder < 0) != (b < 0))
+            {
+                quotient--;
+                remainder += b;
+            }
+            return op == '/' ? quotient : remainder;
+        }
+        default:
+            return a;
+        }
+    }
+
+private:
+    // Where a value is: a constant, a cell, the cell a parameter points to, or
+    // an element of an array whose origin (the cell of index 0) is known or
+    // held by an array parameter. An index is a constant or a variable's cell.
+    struct Slot
+    {
+        enum Kind
+        {
+            CONSTANT,
+            CELL,
+            REFERENCE,
+            ELEMENT,
+            REFERENCE_ELEMENT
+        };
+        Kind kind = CONSTANT;
+        long long value = 0;
+        bool indexed = false;
+        bool indexReference = false;
+        long long index = 0;
+    };
+
+    struct Procedure;
+
+    // One command; conditions compare left and right with op, one of
+    // '=', '!', '<', '>', 'l' (<=) and 'g' (>=).
+    struct Step
+    {
+        NodeKind kind;
+        int line = 0;
+        Slot target; // assigned or read; the iterator of a FOR loop
+        Slot left, right;
+        char op = 0; // 0 for an assignment of a single value
+        long long bound = 0;
+        std::vector<Step> body, otherwise;
+        const Procedure *callee = nullptr;
+        std::vector<std::pair<long long, bool>> arguments; // address, or cell holding it
+    };
+
+    struct Procedure
+    {
+        std::vector<long long> parameters;
+        std::vector<Step> body;
+    };
+
+    SymbolTable *symbolTable;
+    long long cells;
+    std::unordered_map<std::string, Procedure> procedures;
+    std::vector<Step> main;
+    std::unordered_map<std::string, long long> iterators; // of the FOR loops being resolved
+    std::vector<long long> memory;
+    std::istream *in = nullptr;
+    std::ostream *out = nullptr;
+
+    static std::string getName(const std::string &func, const std::string &var)
+    {
+        return func + "::" + var;
+    }
+
+    Slot resolve_identifier(IdentifierNode *id, const std::string &procName, int line)
+    {
+        std::string name = getName(procName, id->getName());
+        Slot slot;
+        try
+        {
+            if (id->isElement)
+            {
+                std::pair<long long, bool> pid = symbolTable->getArrPid(name);
+                slot.kind = pid.second ? Slot::REFERENCE_ELEMENT : Slot::ELEMENT;
+                slot.value = pid.first;
+                slot.index = id->index_const;
+                if (id->index_var)
+                {
+                    Slot index = resolve_identifier(id->index_var, procName, line);
+                    slot.indexed = true;
+                    slot.indexReference = index.kind == Slot::REFERENCE;
+                    slot.index = index.value;
+                }
+                return slot;
+            }
+            auto it = iterators.find(name);
+            if (it != iterators.end())
+            {
+                slot.kind = Slot::CELL;
+                slot.value = it->second;
+                return slot;
+            }
+            std::pair<long long, bool> pid = symbolTable->getPid(name);
+            slot.kind = pid.second ? Slot::REFERENCE : Slot::CELL;
+            slot.value = pid.first;
+            return slot;
+        }
+        catch (const InterpreterError &)
+        {
+            throw;
+        }
+        catch (const std::runtime_error &e)
+        {
+            throw InterpreterError(e.what(), line);
+        }
+    }
+
+    Slot resolve_value(ValueNode *node, const std::string &procName, int line)
+    {
+        if (node->identifier)
+        {
+            return resolve_identifier(node->identifier, procName, line);
+        }
+        Slot slot;
+        slot.value = node->value;
+        return slot;
+    }
+
+    Slot resolve_target(IdentifierNode *id, const std::string &procName, int line)
+    {
+        if (!id->isElement && iterators.count(getName(procName, id->getName())))
+        {
+            throw InterpreterError("Cannot modify iterator: " + getName(procName, id->getName()), line);
+        }
+        return resolve_identifier(id, procName, line);
+    }
+
+    void resolve_condition(ConditionNode *cond, const std::string &procName, Step &step)
+    {
+        step.left = resolve_value(cond->left, procName, step.line);
+        step.right = resolve_value(cond->right, procName, step.line);
+        const std::string &op = cond->op;
+        step.op = op == "<=" ? 'l' : op == ">=" ? 'g' : op == "!=" ? '!' : op[0];
+    }
+
+    void resolve(CommandsNode *cmds, const std::string &procName, std::vector<Step> &steps)
+    {
+        if (!cmds)
+        {
+            return;
+        }
+        for (const auto &cmd : cmds->commands)
+        {
+            Step step;
+            step.kind = cmd->kind;
+            step.line = cmd->getLineNumber();
+            switch (cmd->kind)
+            {
+            case NodeKind::Assign:
+            {
+                AssignNode *assign = static_cast<AssignNode *>(cmd);
+                step.target = resolve_target(assign->identifier, procName, step.line);
+                if (assign->expression->kind == NodeKind::BinaryExpression)
+                {
+                    BinaryExpressionNode *expr = static_cast<BinaryExpressionNode *>(assign->expression);
+                    step.left = resolve_value(expr->left, procName, step.line);
+                    step.right = resolve_value(expr->right, procName, step.line);
+                    step.op = expr->op[0];
+                }
+                else
+                {
+                    step.left = resolve_value(static_cast<ValueNode *>(assign->expression), procName, step.line);
+                }
+                break;
+            }
+            case NodeKind::If:
+            {
+                IfNode *ifNode = static_cast<IfNode *>(cmd);
+                resolve_condition(ifNode->condition, procName, step);
+                resolve(ifNode->thenCommands, procName, step.body);
+                resolve(ifNode->elseCommands, procName, step.otherwise);
+                break;
+            }
+            case NodeKind::While:
+            {
+                WhileNode *whileNode = static_cast<WhileNode *>(cmd);
+                resolve_condition(whileNode->condition, procName, step);
+                resolve(whileNode->commands, procName, step.body);
+                break;
+            }
+            case NodeKind::RepeatUntil:
+            {
+                RepeatUntilNode *repeat = static_cast<RepeatUntilNode *>(cmd);
+                resolve_condition(repeat->condition, procName, step);
+                resolve(repeat->commands, procName, step.body);
+                break;
+            }
+            case NodeKind::ForTo:
+            {
+                ForToNode *forNode = static_cast<ForToNode *>(cmd);
+                resolve_for(forNode->pidentifier, forNode->fromValue, forNode->toValue, forNode->commands, procName, step);
+                break;
+            }
+            case NodeKind::ForDownTo:
+            {
+                ForDownToNode *forNode = static_cast<ForDownToNode *>(cmd);
+                resolve_for(forNode->pidentifier, forNode->fromValue, forNode->toValue, forNode->commands, procName, step);
+                break;
+            }
+            case NodeKind::ProcedureCall:
+                resolve_call(static_cast<ProcedureCallNode *>(cmd), procName, step);
+                break;
+            case NodeKind::Read:
+                step.target = resolve_target(static_cast<ReadNode *>(cmd)->identifier, procName, step.line);
+                break;
+            case NodeKind::Write:
+                step.left = resolve_value(static_cast<WriteNode *>(cmd)->node, procName, step.line);
+                break;
+            default:
+                break;
+            }
+            steps.push_back(step);
+        }
+    }
+
+    // The bounds are read before the iterator's name is bound to its cell.
+    void resolve_for(IdentifierNode *iterator, ValueNode *from, ValueNode *to, CommandsNode *commands,
+                     const std::string &procName, Step &step)
+    {
+        std::string name = getName(procName, iterator->getName());
+        step.left = resolve_value(from, procName, step.line);
+        step.right = resolve_value(to, procName, step.line);
+        step.target.kind = Slot::CELL;
+        step.target.value = cells++;
+        step.bound = cells++;
+
+        auto outer = iterators.find(name);
+        bool hides = outer != iterators.end();
+        long long outerCell = hides ? outer->second : 0;
+        iterators[name] = step.target.value;
+        resolve(commands, procName, step.body);
+        if (hides)
+        {
+            iterators[name] = outerCell;
+        }
+        else
+        {
+            iterators.erase(name);
+        }
+    }
+
+    void resolve_call(ProcedureCallNode *call, const std::string &procName, Step &step)
+    {
+        std::string name = *call->procedureName;
+        auto callee = procedures.find(name);
+        if (callee == procedures.end())
+        {
+            throw InterpreterError("Procedure " + name + " not declared", step.line);
+        }
+        step.callee = &callee->second;
+        const auto &params = symbolTable->funkcja_param[name];
+        size_t count = call->arguments ? call->arguments->getArguments().size() : 0;
+        if (count != params.size())
+        {
+            throw InterpreterError("Wrong param in procedure " + name, step.line);
+        }
+        for (size_t i = 0; i < count; i++)
+        {
+            std::string argName = getName(procName, call->arguments->getArguments()[i]->getName());
+            try
+            {
+                auto it = iterators.find(argName);
+                if (params[i].second)
+                {
+                    step.arguments.push_back(symbolTable->getArrPid(argName));
+                }
+                else if (it != iterators.end())
+                {
+                    step.arguments.push_back({it->second, false});
+                }
+                else
+                {
+                    step.arguments.push_back(symbolTable->getPid(argName));
+                }
+            }
+            catch (const std::runtime_error &e)
+            {
+                throw InterpreterError("Wrong param in procedure " + name, step.line);
+            }
+        }
+    }
+
+    long long &cell(long long address, int line)
+    {
+        if (address < 0 || address >= (long long)memory.size())
+        {
+            throw InterpreterError("Memory address " + std::to_string(address) + " out of range", line);
+        }
+        return memory[address];
+    }
+
+    long long address(const Slot &slot, int line)
+    {
+        switch (slot.kind)
+        {
+        case Slot::CELL:
+            return slot.value;
+        case Slot::REFERENCE:
+            return cell(slot.value, line);
+        default:
+            break;
+        }
+        long long index = slot.index;
+        if (slot.indexed)
+        {
+            index = cell(slot.indexReference ? cell(slot.index, line) : slot.index, line);
+        }
+        long long origin = slot.kind == Slot::ELEMENT ? slot.value : cell(slot.value, line);
+        return (long long)((unsigned long long)origin + index);
+    }
+
+    long long get(const Slot &slot, int line)
+    {
+        return slot.kind == Slot::CONSTANT ? slot.value : cell(address(slot, line), line);
+    }
+
+    bool holds(const Step &step)
+    {
+        long long a = get(step.left, step.line);
+        long long b = get(step.right, step.line);
+        switch (step.op)
+        {
+        case '=':
+            return a == b;
+        case '!':
+            return a != b;
+        case '<':
+            return a < b;
+        case '>':
+            return a > b;
+        case 'l':
+            return a <= b;
+        default:
+            return a >= b;
+        }
+    }
+
+    void execute(const std::vector<Step> &steps)
+    {
+        for (const Step &step : steps)
+        {
+            switch (step.kind)
+            {
+            case NodeKind::Assign:
+            {
+                long long value = get(step.left, step.line);
+                if (step.op)
+                {
+                    value = apply(step.op, value, get(step.right, step.line));
+                }
+                cell(address(step.target, step.line), step.line) = value;
+                break;
+            }
+            case NodeKind::If:
+                execute(holds(step) ? step.body : step.otherwise);
+                break;
+            case NodeKind::While:
+                while (holds(step))
+                {
+                    execute(step.body);
+                }
+                break;
+            case NodeKind::RepeatUntil:
+                do
+                {
+                    execute(step.body);
+                } while (!holds(step));
+                break;
+            case NodeKind::ForTo:
+            case NodeKind::ForDownTo:
+            {
+                long long &iterator = memory[step.target.value];
+                iterator = get(step.left, step.line);
+                memory[step.bound] = get(step.right, step.line);
+                bool down = step.kind == NodeKind::ForDownTo;
+                while (down ? iterator >= memory[step.bound] : iterator <= memory[step.bound])
+                {
+                    execute(step.body);
+                    iterator += down ? -1 : 1;
+                }
+                break;
+            }
+            case NodeKind::ProcedureCall:
+                for (size_t i = 0; i < step.arguments.size(); i++)
+                {
+                    const auto &arg = step.arguments[i];
+                    memory[step.callee->parameters[i]] = arg.second ? cell(arg.first, step.line) : arg.first;
+                }
+                execute(step.callee->body);
+                break;
+            case NodeKind::Read:
+            {
+                long long value;
+                if (!(*in >> value))
+                {
+                    throw InterpreterError("Missing input", step.line);
+                }
+                cell(address(step.target, step.line), step.line) = value;
+                break;
+            }
+            case NodeKind::Write:
+                *out << get(step.left, step.line) << "\n";
+                break;
+            default:
+                break;
+            }
+        }
+    }
+};
+
+#endif // INTERPRETER_HPP
@@ -0,0 +1,473 @@
+#ifndef LOOP_FUSION_HPP
+#define LOOP_FUSION_HPP
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "ast.hpp"
+#include "ast_visitor.hpp"
+#include "loop_info.hpp"
+#include "mod_ref.hpp"
+
+// Fuses FOR loops that follow each other in a command list and run over the
+// same range: the body of the second is appended to that of the first, whose
+// iterator it takes over, so the bounds are set up, tested and stepped once.
+// Assignments between the loops move above the first when its body does not
+// touch what they use, as with a sum cleared before the loop adding to it.
+// Bounds are the same when they are the same literal or name and the first
+// body writes nothing they read. Iteration k of the second loop then runs
+// right after iteration k of the first instead of after all of them, which
+// keeps the meaning of the program when
+//
+// - no variable one body writes is used by the other, except arrays that both
+//   only ever index by the iterator, which the fused loop touches in the same
+//   iteration in the same order;
+// - at most one body reads or writes, itself or through the procedures it
+//   calls, so the input and output keep their order;
+// - neither body passes the iterator to a procedure that may change it.
+//
+// A procedure only sees its parameters and locals, so a call uses nothing but
+// its arguments, read and written as the mod/ref summary says. Parameters may
+// be bound to the same variable, so all scalar parameters count as one
+// variable, and all array parameters as another. Loops the code generator
+// would unroll completely are not fused into one it would not.
+class LoopFusion : public AstVisitor
+{
+public:
+    bool unrollLoops = true;
+    long long unrollBudget = 256;
+    long long fused = 0; // loops merged into the loop before them
+
+    void run(ProgramNode *root)
+    {
+        modRef.analyze(root);
+        if (root->procedures)
+        {
+            for (const auto &proc : root->procedures->procedures)
+            {
+                InputOutput io(ioProcedures);
+                io.visit(proc->commands);
+                if (io.found)
+                {
+                    ioProcedures.insert(*proc->arguments->procedureName);
+                }
+            }
+        }
+        visit(root);
+    }
+
+    void visit_main(MainNode *node) override
+    {
+        procName = "";
+        parameters.clear();
+        visit(node->commands);
+    }
+
+    void visit_procedure(ProcedureNode *node) override
+    {
+        procName = *node->arguments->procedureName;
+        parameters.clear();
+        if (node->arguments->arguments)
+        {
+            for (const auto &arg : node->arguments->arguments->arguments)
+            {
+                parameters[*arg->argumentName] = arg->isArray;
+            }
+        }
+        visit(node->commands);
+    }
+
+    void visit_commands(CommandsNode *node) override
+    {
+        auto &commands = node->commands;
+        size_t k = 0;
+        while (k + 1 < commands.size())
+        {
+            size_t next = k + 1;
+            while (next < commands.size() && commands[next]->kind == NodeKind::Assign)
+            {
+                next++;
+            }
+            Loop first, second;
+            if (next < commands.size() && as_loop(commands[k], first) && as_loop(commands[next], second) &&
+                fusible(first, second) &&
+                (next == k + 1 || movable({commands.begin() + k + 1, commands.begin() + next}, first)))
+            {
+                std::rotate(commands.begin() + k, commands.begin() + k + 1, commands.begin() + next);
+                merge(first, second);
+                delete commands[next];
+                commands.erase(commands.begin() + next);
+                fused++;
+                k = next - 1;
+            }
+            else
+            {
+                k++;
+            }
+        }
+        // loops nested in fused bodies may have become neighbours
+        for (const auto &cmd : commands)
+        {
+            visit(cmd);
+        }
+    }
+
+private:
+    ModRefSummary modRef;
+    std::unordered_set<std::string> ioProcedures;       // procedures reading or writing, themselves or through calls
+    std::unordered_map<std::string, bool> parameters;    // of the procedure being visited: whether an array
+
+    struct Loop
+    {
+        IdentifierNode *iterator;
+        ValueNode *from;
+        ValueNode *to;
+        CommandsNode *commands;
+        bool down;
+    };
+
+    // How a loop body uses a variable.
+    struct Use
+    {
+        bool read = false;
+        bool written = false;
+        bool sameIteration = true; // only as elements indexed by the iterator
+    };
+
+    // Whether commands read or write, themselves or through the procedures
+    // they call.
+    class InputOutput : public AstVisitor
+    {
+    public:
+        bool found = false;
+
+        explicit InputOutput(const std::unordered_set<std::string> &procedures) : procedures(procedures) {}
+
+        void visit_read(ReadNode *) override
+        {
+            found = true;
+        }
+
+        void visit_write(WriteNode *) override
+        {
+            found = true;
+        }
+
+        void visit_procedure_call(ProcedureCallNode *node) override
+        {
+            found = found || procedures.count(*node->procedureName);
+        }
+
+    private:
+        const std::unordered_set<std::string> &procedures;
+    };
+
+    // Every variable a loop body uses, by the name it is checked under.
+    class Accesses : public AstVisitor
+    {
+    public:
+        std::unordered_map<std::string, Use> uses;
+        std::unordered_set<std::string> names;     // as written, outside the loops declaring them
+        std::unordered_set<std::string> iterators; // of the loops in the body
+        bool io = false;
+
+        Accesses(const std::string &iterator, CommandsNode *body, const LoopFusion &fusion)
+            : iterator(iterator), fusion(fusion)
+        {
+            visit(body);
+        }
+
+        void visit_identifier(IdentifierNode *node) override
+        {
+            use(node, false);
+        }
+
+        void visit_assign(AssignNode *node) override
+        {
+            use(node->identifier, true);
+            visit(node->expression);
+        }
+
+        void visit_read(ReadNode *node) override
+        {
+            io = true;
+            use(node->identifier, true);
+        }
+
+        void visit_write(WriteNode *node) override
+        {
+            io = true;
+            visit(node->node);
+        }
+
+        void visit_for_to(ForToNode *node) override
+        {
+            visit_for(node->pidentifier, node->fromValue, node->toValue, node->commands);
+        }
+
+        void visit_for_downto(ForDownToNode *node) override
+        {
+            visit_for(node->pidentifier, node->fromValue, node->toValue, node->commands);
+        }
+
+        void visit_procedure_call(ProcedureCallNode *node) override
+        {
+            io = io || fusion.ioProcedures.count(*node->procedureName);
+            if (!node->arguments)
+            {
+                return;
+            }
+            const auto &args = node->arguments->arguments;
+            for (size_t k = 0; k < args.size(); k++)
+            {
+                std::string name = args[k]->getName();
+                if (local(name))
+                {
+                    continue;
+                }
+                names.insert(name);
+                Use &use = uses[fusion.alias(name)];
+                use.read = use.read || fusion.modRef.reads(*node->procedureName, k);
+                use.written = use.written || fusion.modRef.writes(*node->procedureName, k);
+                use.sameIteration = false;
+            }
+        }
+
+    private:
+        std::string iterator;
+        const LoopFusion &fusion;
+        std::vector<std::string> scope; // iterators of the loops being visited
+
+        bool local(const std::string &name) const
+        {
+            return name == iterator || std::find(scope.begin(), scope.end(), name) != scope.end();
+        }
+
+        void use(IdentifierNode *node, bool write)
+        {
+            std::string name = node->getName();
+            if (!local(name))
+            {
+                names.insert(name);
+                Use &use = uses[fusion.alias(name)];
+                use.read = use.read || !write;
+                use.written = use.written || write;
+                if (!node->isElement || !node->index_var || node->index_var->getName() != iterator)
+                {
+                    use.sameIteration = false;
+                }
+            }
+            visit(node->index_var);
+        }
+
+        void visit_for(IdentifierNode *pid, ValueNode *from, ValueNode *to, CommandsNode *commands)
+        {
+            visit(from);
+            visit(to);
+            iterators.insert(pid->getName());
+            scope.push_back(pid->getName());
+            visit(commands);
+            scope.pop_back();
+        }
+    };
+
+    // Points the identifiers of one name at another.
+    class Rename : public AstVisitor
+    {
+    public:
+        Rename(const std::string &from, std::string *to) : from(from), to(to) {}
+
+        void visit_identifier(IdentifierNode *node) override
+        {
+            if (*node->name == from)
+            {
+                node->name = to;
+            }
+            visit(node->index_var);
+        }
+
+    private:
+        std::string from;
+        std::string *to;
+    };
+
+    std::string alias(const std::string &name) const
+    {
+        auto it = parameters.find(name);
+        if (it == parameters.end())
+        {
+            return name;
+        }
+        return it->second ? "#array parameters" : "#scalar parameters";
+    }
+
+    static bool as_loop(CommandNode *node, Loop &loop)
+    {
+        if (node->kind == NodeKind::ForTo)
+        {
+            auto *forTo = static_cast<ForToNode *>(node);
+            loop = {forTo->pidentifier, forTo->fromValue, forTo->toValue, forTo->commands, false};
+            return true;
+        }
+        if (node->kind == NodeKind::ForDownTo)
+        {
+            auto *forDownTo = static_cast<ForDownToNode *>(node);
+            loop = {forDownTo->pidentifier, forDownTo->fromValue, forDownTo->toValue, forDownTo->commands, true};
+            return true;
+        }
+        return false;
+    }
+
+    static bool same_identifier(const IdentifierNode *a, const IdentifierNode *b)
+    {
+        if (a->getName() != b->getName() || a->isElement != b->isElement || a->index_const != b->index_const)
+        {
+            return false;
+        }
+        if (!a->index_var || !b->index_var)
+        {
+            return !a->index_var && !b->index_var;
+        }
+        return same_identifier(a->index_var, b->index_var);
+    }
+
+    static bool same_value(const ValueNode *a, const ValueNode *b)
+    {
+        if (!a->identifier || !b->identifier)
+        {
+            return !a->identifier && !b->identifier && a->value == b->value;
+        }
+        return same_identifier(a->identifier, b->identifier);
+    }
+
+    // Whether a bound may read something else after the first body: a name
+    // the body writes, or one an inner loop of it binds to its iterator.
+    bool changes(const Accesses &body, const ValueNode *bound) const
+    {
+        for (const IdentifierNode *id = bound->identifier; id; id = id->index_var)
+        {
+            auto it = body.uses.find(alias(id->getName()));
+            if ((it != body.uses.end() && it->second.written) || body.iterators.count(id->getName()))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Whether the code generator unrolls a loop completely. Partial unrolling
+    // only saves the test of the bound, fusion the test and the step too, so
+    // fusing is worth losing it.
+    bool unrolled(long long trips, long long size, bool iteratorPassed) const
+    {
+        return unrollLoops && trips >= 0 && !iteratorPassed && trips <= unrollBudget / std::max(1LL, size);
+    }
+
+    bool fusible(const Loop &first, const Loop &second) const
+    {
+        if (!first.commands || !second.commands || first.down != second.down ||
+            !same_value(first.from, second.from) || !same_value(first.to, second.to))
+        {
+            return false;
+        }
+        std::string i = first.iterator->getName();
+        std::string j = second.iterator->getName();
+        Accesses one(i, first.commands, *this);
+        Accesses two(j, second.commands, *this);
+
+        // the iterators must mean the same in both bodies
+        if (one.iterators.count(i) || one.iterators.count(j) || two.iterators.count(i) || two.iterators.count(j) ||
+            (i != j && two.names.count(i)))
+        {
+            return false;
+        }
+        for (const auto &name : one.iterators)
+        {
+            if (two.names.count(name))
+            {
+                return false;
+            }
+        }
+        for (const auto &name : two.iterators)
+        {
+            if (one.names.count(name))
+            {
+                return false;
+            }
+        }
+
+        if ((one.io && two.io) || changes(one, first.from) || changes(one, first.to))
+        {
+            return false;
+        }
+        for (const auto &entry : one.uses)
+        {
+            auto it = two.uses.find(entry.first);
+            if (it != two.uses.end() && (entry.second.written || it->second.written) &&
+                !(entry.second.sameIteration && it->second.sameIteration))
+            {
+                return false;
+            }
+        }
+
+        LoopInfo infoOne(i, first.commands, &modRef);
+        LoopInfo infoTwo(j, second.commands, &modRef);
+        if (infoOne.iteratorEscapes || infoTwo.iteratorEscapes)
+        {
+            return false;
+        }
+        long long trips = LoopInfo::constant_trip_count(first.from, first.to, first.down);
+        if ((unrolled(trips, infoOne.size, infoOne.iteratorPassed) || unrolled(trips, infoTwo.size, infoTwo.iteratorPassed)) &&
+            !unrolled(trips, infoOne.size + infoTwo.size, infoOne.iteratorPassed || infoTwo.iteratorPassed))
+        {
+            return false;
+        }
+
+        return true;
+    }
+
+    // Appends the body of the second loop to that of the first, which can
+    // then be deleted.
+    static void merge(const Loop &first, const Loop &second)
+    {
+        std::string j = second.iterator->getName();
+        if (first.iterator->getName() != j)
+        {
+            Rename rename(j, first.iterator->name);
+            rename.visit(second.commands);
+        }
+        auto &body = first.commands->commands;
+        body.insert(body.end(), second.commands->commands.begin(), second.commands->commands.end());
+        second.commands->commands.clear();
+    }
+
+    // Whether the assignments between two loops may run before the first:
+    // they use nothing its body writes, write nothing it uses and leave its
+    // bounds alone.
+    bool movable(const std::vector<CommandNode *> &commands, const Loop &first) const
+    {
+        BorrowedCommands between(commands);
+        std::string i = first.iterator->getName();
+        Accesses moved("", &between, *this);
+        Accesses body(i, first.commands, *this);
+        if (moved.names.count(i) || changes(moved, first.from) || changes(moved, first.to))
+        {
+            return false;
+        }
+        for (const auto &entry : moved.uses)
+        {
+            auto it = body.uses.find(entry.first);
+            if ((it != body.uses.end() && (entry.second.written || it->second.written)) ||
+                body.iterators.count(entry.first))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+#endif // LOOP_FUSION_HPP
@@ -0,0 +1,165 @@
+#ifndef LOOP_INFO_HPP
+#define LOOP_INFO_HPP
+
+#include <string>
+
+#include "ast.hpp"
+#include "ast_visitor.hpp"
+#include "mod_ref.hpp"
+
+// What the code generator needs to know about the body of a FOR loop before
+// unrolling it: roughly how many instructions one iteration takes, whether it
+// contains loops of its own and whether the iterator is passed to a procedure.
+// A procedure receives its address, so the iterator then needs a cell, and
+// escapes when the mod/ref summary says the procedure may change it (any
+// procedure may without a summary).
+class LoopInfo : public AstVisitor
+{
+public:
+    long long size = 0;
+    bool hasLoop = false;
+    bool iteratorPassed = false;
+    bool iteratorEscapes = false;
+
+    LoopInfo(const std::string &iterator, CommandsNode *body, const ModRefSummary *modRef = nullptr)
+        : iterator(iterator), modRef(modRef)
+    {
+        visit(body);
+    }
+
+    // Trip count of a loop with literal bounds, -1 otherwise.
+    static long long constant_trip_count(const ValueNode *from, const ValueNode *to, bool down)
+    {
+        if (from->identifier || to->identifier)
+        {
+            return -1;
+        }
+        return trip_count(from->value, to->value, down);
+    }
+
+    // -1 when it does not fit a long long.
+    static long long trip_count(long long from, long long to, bool down)
+    {
+        long long count;
+        if (__builtin_sub_overflow(down ? from : to, down ? to : from, &count) ||
+            __builtin_add_overflow(count, 1, &count))
+        {
+            return -1;
+        }
+        return count < 0 ? 0 : count;
+    }
+
+    void visit_value(ValueNode *node) override
+    {
+        size += node->identifier && node->identifier->isElement ? 5 : 1;
+        AstVisitor::visit_value(node);
+    }
+
+    void visit_binary_expression(BinaryExpressionNode *node) override
+    {
+        if (node->op == "*")
+        {
+            size += 45;
+        }
+        else if (node->op == "/" || node->op == "%")
+        {
+            size += 70;
+        }
+        else
+        {
+            size += 2;
+        }
+        AstVisitor::visit_binary_expression(node);
+    }
+
+    void visit_condition(ConditionNode *node) override
+    {
+        size += 4;
+        AstVisitor::visit_condition(node);
+    }
+
+    void visit_assign(AssignNode *node) override
+    {
+        size += node->identifier->isElement ? 4 : 1;
+        AstVisitor::visit_assign(node);
+    }
+
+    void visit_if(IfNode *node) override
+    {
+        size += 1;
+        AstVisitor::visit_if(node);
+    }
+
+    void visit_while(WhileNode *node) override
+    {
+        hasLoop = true;
+        size += 1;
+        AstVisitor::visit_while(node);
+    }
+
+    void visit_repeat_until(RepeatUntilNode *node) override
+    {
+        hasLoop = true;
+        size += 1;
+        AstVisitor::visit_repeat_until(node);
+    }
+
+    void visit_for_to(ForToNode *node) override
+    {
+        visit_for(node->fromValue, node->toValue, node->commands, false);
+    }
+
+    void visit_for_downto(ForDownToNode *node) override
+    {
+        visit_for(node->fromValue, node->toValue, node->commands, true);
+    }
+
+    void visit_procedure_call(ProcedureCallNode *node) override
+    {
+        size += 3;
+        if (node->arguments)
+        {
+            const auto &args = node->arguments->getArguments();
+            for (size_t k = 0; k < args.size(); k++)
+            {
+                size += 2;
+                if (args[k]->getName() == iterator)
+                {
+                    iteratorPassed = true;
+                    iteratorEscapes = iteratorEscapes || !modRef || modRef->may_write(node, k);
+                }
+            }
+        }
+    }
+
+    void visit_read(ReadNode *node) override
+    {
+        size += 2;
+        AstVisitor::visit_read(node);
+    }
+
+    void visit_write(WriteNode *node) override
+    {
+        size += 1;
+        AstVisitor::visit_write(node);
+    }
+
+private:
+    static const long long MAX_COUNT = 1 << 20; // keeps the estimate from overflowing
+
+    std::string iterator;
+    const ModRefSummary *modRef;
+
+    void visit_for(ValueNode *from, ValueNode *to, CommandsNode *commands, bool down)
+    {
+        hasLoop = true;
+        long long outer = size;
+        size = 0;
+        visit(commands);
+        long long trips = constant_trip_count(from, to, down);
+        long long copies = trips < 0 ? 1 : (trips < MAX_COUNT ? trips : MAX_COUNT);
+        size = outer + 20 + (size < MAX_COUNT ? size : MAX_COUNT) * copies;
+    }
+};
+
+#endif // LOOP_INFO_HPP
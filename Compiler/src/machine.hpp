@@ -0,0 +1,269 @@
+#ifndef MACHINE_HPP
+#define MACHINE_HPP
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <stdexcept>
+#include <climits>
+
+#include "instruction.hpp"
+#include "binary_program.hpp"
+
+class MachineError : public std::runtime_error
+{
+public:
+    MachineError(const std::string &message, long long k)
+        : std::runtime_error("\e[0;31mError:\e[0m " + message + " at instruction: " + std::to_string(k)) {}
+};
+
+// Reads a program in the text format written by OutputWriter.
+inline std::vector<Instruction> read_program(std::istream &in, const std::string &fileName)
+{
+    std::vector<Instruction> program;
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(in, line))
+    {
+        lineNumber++;
+        size_t comment = line.find('#');
+        if (comment != std::string::npos)
+        {
+            line.erase(comment);
+        }
+        std::istringstream fields(line);
+        std::string name;
+        if (!(fields >> name))
+        {
+            continue;
+        }
+        Instruction inst = {Opcode::HALT, 0};
+        if (!parse_opcode(name, inst.op) || (has_operand(inst.op) && !(fields >> inst.arg)))
+        {
+            throw std::runtime_error("Malformed instruction in " + fileName + " at line: " + std::to_string(lineNumber));
+        }
+        program.push_back(inst);
+    }
+    return program;
+}
+
+// Reads a program in either format, telling binary ones by their magic.
+inline std::vector<Instruction> read_program(const std::string &fileName)
+{
+    if (BinaryProgram::is_binary(fileName))
+    {
+        return BinaryProgram::read(fileName).instructions;
+    }
+    std::ifstream in(fileName);
+    if (!in)
+    {
+        throw std::runtime_error("Could not open program " + fileName);
+    }
+    return read_program(in, fileName);
+}
+
+// Local implementation of the target register machine. Memory cell 0 is the
+// accumulator, jumps are relative and RTRN jumps to the address stored in its
+// operand cell. Besides running the program it keeps the total cost and, when
+// asked, how many times every instruction was executed.
+class Machine
+{
+public:
+    // Cells are wider than the language's integers: the generated
+    // multiplication and division shift operands past 64 bits on the way.
+    typedef __int128 Word;
+
+    static const long long DIRECT_MEMORY = 1 << 22;
+
+    long long cost = 0;
+    long long steps = 0;
+    long long stepLimit = 0; // 0: no limit
+    std::vector<long long> executed;
+
+    explicit Machine(const std::vector<Instruction> &program, bool countExecutions = false)
+        : program(program), countExecutions(countExecutions), memory(64, 0)
+    {
+        if (countExecutions)
+        {
+            executed.assign(program.size(), 0);
+        }
+    }
+
+    void run(std::istream &in, std::ostream &out)
+    {
+        long long k = 0;
+        while (true)
+        {
+            if (k < 0 || k >= (long long)program.size())
+            {
+                throw MachineError("Jump outside of the program", k);
+            }
+            const Instruction &inst = program[k];
+            cost += instruction_cost(inst.op);
+            steps++;
+            if (countExecutions)
+            {
+                executed[k]++;
+            }
+            if (stepLimit > 0 && steps > stepLimit)
+            {
+                throw MachineError("Step limit exceeded", k);
+            }
+
+            switch (inst.op)
+            {
+            case Opcode::GET:
+            {
+                long long value;
+                if (!(in >> value))
+                {
+                    throw MachineError("Missing input", k);
+                }
+                write(inst.arg, value, k);
+                k++;
+                break;
+            }
+            case Opcode::PUT:
+                out << to_string(read(inst.arg, k)) << "\n";
+                k++;
+                break;
+            case Opcode::LOAD:
+                memory[0] = read(inst.arg, k);
+                k++;
+                break;
+            case Opcode::STORE:
+                write(inst.arg, memory[0], k);
+                k++;
+                break;
+            case Opcode::LOADI:
+                memory[0] = read(address(inst.arg, k), k);
+                k++;
+                break;
+            case Opcode::STOREI:
+                write(address(inst.arg, k), memory[0], k);
+                k++;
+                break;
+            case Opcode::ADD:
+                memory[0] += read(inst.arg, k);
+                k++;
+                break;
+            case Opcode::SUB:
+                memory[0] -= read(inst.arg, k);
+                k++;
+                break;
+            case Opcode::ADDI:
+                memory[0] += read(address(inst.arg, k), k);
+                k++;
+                break;
+            case Opcode::SUBI:
+                memory[0] -= read(address(inst.arg, k), k);
+                k++;
+                break;
+            case Opcode::SET:
+                memory[0] = inst.arg;
+                k++;
+                break;
+            case Opcode::HALF:
+                memory[0] = floor_half(memory[0]);
+                k++;
+                break;
+            case Opcode::JUMP:
+                k += inst.arg;
+                break;
+            case Opcode::JPOS:
+                k += memory[0] > 0 ? inst.arg : 1;
+                break;
+            case Opcode::JZERO:
+                k += memory[0] == 0 ? inst.arg : 1;
+                break;
+            case Opcode::JNEG:
+                k += memory[0] < 0 ? inst.arg : 1;
+                break;
+            case Opcode::RTRN:
+                k = address(inst.arg, k);
+                break;
+            case Opcode::HALT:
+                return;
+            }
+        }
+    }
+
+    static Word floor_half(Word value)
+    {
+        return value >= 0 ? value / 2 : -((-(value + 1)) / 2) - 1;
+    }
+
+    static std::string to_string(Word value)
+    {
+        bool negative = value < 0;
+        unsigned __int128 magnitude = negative ? -(unsigned __int128)value : (unsigned __int128)value;
+        std::string digits;
+        do
+        {
+            digits += char('0' + (int)(magnitude % 10));
+            magnitude /= 10;
+        } while (magnitude != 0);
+        if (negative)
+        {
+            digits += '-';
+        }
+        return std::string(digits.rbegin(), digits.rend());
+    }
+
+private:
+    const std::vector<Instruction> &program;
+    bool countExecutions;
+    std::vector<Word> memory;
+    std::unordered_map<long long, Word> farMemory;
+
+    // Contents of a cell used as an address by the indirect instructions.
+    long long address(long long cell, long long k)
+    {
+        Word value = read(cell, k);
+        if (value < 0 || value > (Word)LLONG_MAX)
+        {
+            throw MachineError("Memory address out of range", k);
+        }
+        return (long long)value;
+    }
+
+    Word read(long long address, long long k)
+    {
+        if (address >= 0 && address < (long long)memory.size())
+        {
+            return memory[address];
+        }
+        if (address < 0)
+        {
+            throw MachineError("Negative memory address " + std::to_string(address), k);
+        }
+        auto it = farMemory.find(address);
+        return it == farMemory.end() ? 0 : it->second;
+    }
+
+    void write(long long address, Word value, long long k)
+    {
+        if (address >= 0 && address < (long long)memory.size())
+        {
+            memory[address] = value;
+            return;
+        }
+        if (address < 0)
+        {
+            throw MachineError("Negative memory address " + std::to_string(address), k);
+        }
+        if (address < DIRECT_MEMORY)
+        {
+            memory.resize(std::max<long long>(address + 1, memory.size() * 2), 0);
+            memory[address] = value;
+            return;
+        }
+        farMemory[address] = value;
+    }
+};
+
+#endif // MACHINE_HPP
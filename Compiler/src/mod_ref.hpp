@@ -0,0 +1,126 @@
+#ifndef MOD_REF_HPP
+#define MOD_REF_HPP
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include "ast.hpp"
+#include "ast_visitor.hpp"
+
+// Which parameters every procedure may read and write, including through the
+// procedures it passes them to; for an array parameter, its elements. A
+// procedure sees no variables but its parameters and locals, so a call can
+// change nothing of its caller but the arguments bound to parameters it
+// writes. Procedures are declared before they are called, so one pass in
+// declaration order sees every callee's summary before its callers.
+class ModRefSummary : public AstVisitor
+{
+public:
+    struct Access
+    {
+        bool read = false;
+        bool written = false;
+    };
+
+    std::unordered_map<std::string, std::vector<Access>> parameters; // per procedure, in declaration order
+
+    void analyze(ProgramNode *root)
+    {
+        visit(root->procedures);
+    }
+
+    // Unknown procedures and parameters are assumed read and written.
+    bool reads(const std::string &proc, size_t param) const
+    {
+        auto it = parameters.find(proc);
+        return it == parameters.end() || param >= it->second.size() || it->second[param].read;
+    }
+
+    bool writes(const std::string &proc, size_t param) const
+    {
+        auto it = parameters.find(proc);
+        return it == parameters.end() || param >= it->second.size() || it->second[param].written;
+    }
+
+    // Whether the call may change the variable passed as its k-th argument.
+    bool may_write(const ProcedureCallNode *call, size_t k) const
+    {
+        return writes(*call->procedureName, k);
+    }
+
+    void visit_procedure(ProcedureNode *node) override
+    {
+        procName = *node->arguments->procedureName;
+        index.clear();
+        std::vector<Access> &params = parameters[procName];
+        params.clear();
+        if (node->arguments->arguments)
+        {
+            for (const auto &arg : node->arguments->arguments->arguments)
+            {
+                index[*arg->argumentName] = params.size();
+                params.push_back(Access());
+            }
+        }
+        visit(node->commands);
+    }
+
+    void visit_identifier(IdentifierNode *node) override
+    {
+        if (Access *access = find(node->getName()))
+        {
+            access->read = true;
+        }
+        visit(node->index_var);
+    }
+
+    void visit_assign(AssignNode *node) override
+    {
+        visit_target(node->identifier);
+        visit(node->expression);
+    }
+
+    void visit_read(ReadNode *node) override
+    {
+        visit_target(node->identifier);
+    }
+
+    void visit_procedure_call(ProcedureCallNode *node) override
+    {
+        if (!node->arguments)
+        {
+            return;
+        }
+        const auto &args = node->arguments->arguments;
+        for (size_t k = 0; k < args.size(); k++)
+        {
+            if (Access *access = find(args[k]->getName()))
+            {
+                bool self = *node->procedureName == procName;
+                access->read = access->read || self || reads(*node->procedureName, k);
+                access->written = access->written || self || writes(*node->procedureName, k);
+            }
+        }
+    }
+
+private:
+    std::unordered_map<std::string, size_t> index; // parameters of the procedure being visited
+
+    Access *find(const std::string &name)
+    {
+        auto it = index.find(name);
+        return it == index.end() ? nullptr : &parameters[procName][it->second];
+    }
+
+    void visit_target(IdentifierNode *node)
+    {
+        if (Access *access = find(node->getName()))
+        {
+            access->written = true;
+        }
+        visit(node->index_var);
+    }
+};
+
+#endif // MOD_REF_HPP
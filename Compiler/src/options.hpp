@@ -0,0 +1,414 @@
+#ifndef OPTIONS_HPP
+#define OPTIONS_HPP
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <cstring>
+
+class CompilerOptions
+{
+public:
+    std::vector<std::pair<std::string, std::string>> files; // input -> output
+    unsigned jobs = 0;                                      // 0: one per hardware thread
+    bool stream = false;
+    bool timeReport = false;          // -ftime-report: table on stderr
+    bool timeReportJson = false;      // -ftime-report=json: JSON on stderr
+    std::string timeReportFile;       // -ftime-report-file=<file>: JSON array
+    bool memReport = false;           // -fmem-report: peak heap of every compilation on stderr
+    bool debugMap = false;            // -g: write <output>.map
+    bool profile = false;             // --profile: files are <source> <program> pairs
+    bool profileGenerate = false;     // -fprofile-generate: write <output>.blocks
+    bool profileUse = false;          // -fprofile-use[=<file>]
+    std::string profileFile;          // "": <output>.profile
+    std::string profileRun;           // --profile-run <program>
+    std::string runFile;              // --run <source>
+    bool binary = false;              // --binary: write the binary encoding instead of text
+    std::string convertInput;         // --convert <input> <output>: text to binary or back
+    std::string convertOutput;
+    std::string serverSocket;         // --server <socket>: compile requests from a UNIX socket
+    bool emitC = false;               // --emit-c: write <output>.c instead of machine code
+    bool native = false;              // --native: also build it into the executable <output>
+    char optimizationLevel = '2';     // -O0, -O1, -O2 or -Os: the passes on by default
+    bool verifyPasses = false;        // -fverify-passes: check the code after every pass
+    // passes, set from the level and then from -f<pass> and -fno-<pass>
+    bool cloneProcedures = true;      // specialize procedures for constant arguments
+    bool fuseLoops = true;            // merge adjacent FOR loops over the same range
+    bool copyInOut = true;            // copy scalar parameters into local cells
+    bool overlayFrames = true;        // share cells between procedures never active together
+    bool unrollLoops = true;          // unroll FOR loops
+    bool rewriteTable = true;         // apply the superoptimized rewrites
+    bool nullJumps = true;            // remove jumps to the next instruction
+    unsigned unrollFactor = 4;        // -funroll-factor=<n>: iterations per test of innermost loops
+    unsigned unrollBudget = 256;      // -funroll-budget=<n>: instructions an unrolled loop may take
+    unsigned cloneBudget = 2048;      // -fclone-budget=<n>: instructions all clones may take
+
+    // Optimization passes with the levels that turn them on, in the order
+    // they run: tree passes, then those of the code generator, then those
+    // rewriting the generated code.
+    struct PassOption
+    {
+        const char *name;
+        bool CompilerOptions::*enabled;
+        const char *levels;
+        const char *kind;
+        const char *description;
+    };
+
+    static const std::vector<PassOption> &pass_options()
+    {
+        static const std::vector<PassOption> passes = {
+            {"clone-procedures", &CompilerOptions::cloneProcedures, "2", "ast",
+             "specialize procedures for constant arguments"},
+            {"fuse-loops", &CompilerOptions::fuseLoops, "12s", "ast", "merge adjacent FOR loops over the same range"},
+            {"copy-in-out", &CompilerOptions::copyInOut, "12", "lowering",
+             "copy scalar parameters into local cells"},
+            {"frame-overlay", &CompilerOptions::overlayFrames, "12s", "lowering",
+             "share cells between procedures never active together"},
+            {"unroll-loops", &CompilerOptions::unrollLoops, "2", "lowering", "unroll FOR loops"},
+            {"rewrite-table", &CompilerOptions::rewriteTable, "12s", "instruction",
+             "apply the superoptimizer's rewrite table"},
+            {"null-jumps", &CompilerOptions::nullJumps, "12s", "instruction", "remove jumps to the next instruction"},
+        };
+        return passes;
+    }
+
+    class UsageError : public std::runtime_error
+    {
+    public:
+        explicit UsageError(const std::string &message) : std::runtime_error(message) {}
+    };
+
+    static std::string usage(const std::string &program)
+    {
+        return "Usage: " + program + " [options] <input> <output> [<input> <output> ...]\n"
+               "       " + program + " [options] --manifest <file>\n"
+               "Options:\n"
+               "  -j, --jobs <n>       compile up to n files at the same time\n"
+               "  --manifest <file>    read \"<input> <output>\" pairs from file, one per line\n"
+               "  --stream             write procedures to the output as soon as they are generated\n"
+               "  -ftime-report        print time, allocations and peak RSS per phase to stderr\n"
+               "  -ftime-report=json   the same as JSON, one object per compiled file\n"
+               "  -ftime-report-file=<file>\n"
+               "                       write the JSON report of all files to file\n"
+               "  -fmem-report         print the peak heap use of every compilation to stderr\n"
+               "  -g                   write a map from instructions to source lines to <output>.map\n"
+               "  --profile <source> <program>\n"
+               "                       run program (compiled with -g) on stdin and print the cost\n"
+               "                       of every line and procedure of source to stderr\n"
+               "  -fprofile-generate   write where the execution counts of branches and loops are\n"
+               "                       read off to <output>.blocks\n"
+               "  --profile-run <program>\n"
+               "                       run program (compiled with -fprofile-generate) on stdin and\n"
+               "                       add its execution counts to <program>.profile\n"
+               "  --emit-c             translate to C, writing <output>.c (without \".mr\")\n"
+               "  --native             translate to C and build the native executable <output>\n"
+               "                       with $CC (default cc)\n"
+               "  --run <source>       interpret source without compiling it, reading stdin and\n"
+               "                       writing stdout like the compiled program\n"
+               "  --binary             write the binary encoding of the program; with -g the map\n"
+               "                       goes into the file instead of <output>.map\n"
+               "  --convert <input> <output>\n"
+               "                       convert a compiled program from text to binary or back\n"
+               "  --server <socket>    compile sources sent to the UNIX socket, up to -j at once\n"
+               "  -fprofile-use[=<file>]\n"
+               "                       lay out branches and loops using <output>.profile or file\n"
+               "  -O0, -O1, -O2, -Os   optimization level, default -O2; -O0 runs no pass, -Os the\n"
+               "                       passes that do not make the code larger\n"
+               "  -f<pass>, -fno-<pass>\n"
+               "                       turn a pass on or off whatever the level\n"
+               + pass_usage() +
+               "  -fverify-passes      check jump targets and return addresses after every pass\n"
+               "  -funroll-factor=<n>  run n iterations of innermost FOR loops per test (default 4)\n"
+               "  -funroll-budget=<n>  instructions a loop may grow to by unrolling (default 256)\n"
+               "  -fclone-budget=<n>   instructions all specialized clones may take (default 2048)\n"
+               "  -h, --help           show this message\n";
+    }
+
+    static std::string pass_usage()
+    {
+        std::string text;
+        for (const auto &pass : pass_options())
+        {
+            std::string levels;
+            for (const char *level = pass.levels; *level; level++)
+            {
+                levels += std::string(levels.empty() ? "" : " ") + "-O" + *level;
+            }
+            std::string name = std::string("    ") + pass.name;
+            name.resize(23, ' ');
+            text += name + pass.description + " (" + levels + ")\n";
+        }
+        return text;
+    }
+
+    // ".imp" and ".mr" are appended to file names given without them.
+    static std::string withExtension(const std::string &name, const std::string &ext)
+    {
+        if (name.size() >= ext.size() && name.compare(name.size() - ext.size(), ext.size(), ext) == 0)
+        {
+            return name;
+        }
+        return name + ext;
+    }
+
+    void addFile(const std::string &input, const std::string &output)
+    {
+        files.push_back({withExtension(input, ".imp"), withExtension(output, ".mr")});
+    }
+
+    void readManifest(const std::string &fileName)
+    {
+        std::ifstream manifest(fileName);
+        if (!manifest)
+        {
+            throw UsageError("Could not open manifest " + fileName);
+        }
+        std::string line;
+        int lineNumber = 0;
+        while (std::getline(manifest, line))
+        {
+            lineNumber++;
+            std::istringstream fields(line);
+            std::string input, output, rest;
+            if (!(fields >> input) || input[0] == '#')
+            {
+                continue;
+            }
+            if (!(fields >> output) || (fields >> rest))
+            {
+                throw UsageError("Expected \"<input> <output>\" in " + fileName + " at line: " + std::to_string(lineNumber));
+            }
+            addFile(input, output);
+        }
+    }
+
+    // Throws UsageError on malformed command lines.
+    void parse(int argc, char **argv)
+    {
+        std::vector<std::string> positional;
+        for (int i = 1; i < argc; i++)
+        {
+            std::string arg = argv[i];
+            if (arg == "-j" || arg == "--jobs")
+            {
+                jobs = parseCount(arg, value(argc, argv, i));
+            }
+            else if (arg.compare(0, 2, "-j") == 0 && arg.size() > 2)
+            {
+                jobs = parseCount("-j", arg.substr(2));
+            }
+            else if (arg == "--manifest")
+            {
+                readManifest(value(argc, argv, i));
+            }
+            else if (arg == "--stream")
+            {
+                stream = true;
+            }
+            else if (arg == "-ftime-report")
+            {
+                timeReport = true;
+            }
+            else if (arg == "-ftime-report=json")
+            {
+                timeReportJson = true;
+            }
+            else if (arg.compare(0, 19, "-ftime-report-file=") == 0)
+            {
+                timeReportFile = arg.substr(19);
+            }
+            else if (arg == "-fmem-report")
+            {
+                memReport = true;
+            }
+            else if (arg == "-g")
+            {
+                debugMap = true;
+            }
+            else if (arg == "--profile")
+            {
+                profile = true;
+            }
+            else if (arg == "-fprofile-generate")
+            {
+                profileGenerate = true;
+            }
+            else if (arg == "-fprofile-use")
+            {
+                profileUse = true;
+            }
+            else if (arg.compare(0, 14, "-fprofile-use=") == 0)
+            {
+                profileUse = true;
+                profileFile = arg.substr(14);
+            }
+            else if (arg == "--profile-run")
+            {
+                profileRun = withExtension(value(argc, argv, i), ".mr");
+            }
+            else if (arg == "--emit-c")
+            {
+                emitC = true;
+            }
+            else if (arg == "--native")
+            {
+                native = true;
+            }
+            else if (arg == "--run")
+            {
+                runFile = withExtension(value(argc, argv, i), ".imp");
+            }
+            else if (arg == "--binary")
+            {
+                binary = true;
+            }
+            else if (arg == "--convert")
+            {
+                convertInput = value(argc, argv, i);
+                convertOutput = value(argc, argv, i);
+            }
+            else if (arg == "--server")
+            {
+                serverSocket = value(argc, argv, i);
+            }
+            else if (arg == "-O0" || arg == "-O1" || arg == "-O2" || arg == "-Os")
+            {
+                optimizationLevel = arg[2];
+            }
+            else if (arg == "-fverify-passes")
+            {
+                verifyPasses = true;
+            }
+            else if (find_pass(arg))
+            {
+                passFlags.push_back(arg);
+            }
+            else if (arg.compare(0, 16, "-funroll-factor=") == 0)
+            {
+                unrollFactor = parseCount("-funroll-factor", arg.substr(16));
+            }
+            else if (arg.compare(0, 16, "-funroll-budget=") == 0)
+            {
+                unrollBudget = parseCount("-funroll-budget", arg.substr(16));
+            }
+            else if (arg.compare(0, 15, "-fclone-budget=") == 0)
+            {
+                cloneBudget = parseCount("-fclone-budget", arg.substr(15));
+            }
+            else if (arg == "-h" || arg == "--help")
+            {
+                throw UsageError("");
+            }
+            else if (arg.size() > 1 && arg[0] == '-')
+            {
+                throw UsageError("Unknown option " + arg);
+            }
+            else
+            {
+                positional.push_back(arg);
+            }
+        }
+
+        if (positional.size() % 2 != 0)
+        {
+            throw UsageError("Missing output file for " + positional.back());
+        }
+        for (size_t i = 0; i < positional.size(); i += 2)
+        {
+            addFile(positional[i], positional[i + 1]);
+        }
+        if (files.empty())
+        {
+            addFile("input", "output");
+        }
+        if (profile && files.size() != 1)
+        {
+            throw UsageError("--profile takes exactly one <source> <program> pair");
+        }
+        // the level first, so that -f<pass> and -fno-<pass> win in any order
+        for (const auto &pass : pass_options())
+        {
+            this->*pass.enabled = std::strchr(pass.levels, optimizationLevel) != nullptr;
+        }
+        for (const auto &flag : passFlags)
+        {
+            this->*find_pass(flag)->enabled = flag.compare(0, 5, "-fno-") != 0;
+        }
+        if (binary && stream)
+        {
+            throw UsageError("--binary cannot be combined with --stream");
+        }
+        if (jobs == 0)
+        {
+            jobs = std::thread::hardware_concurrency();
+            if (jobs == 0)
+            {
+                jobs = 1;
+            }
+        }
+    }
+
+    // --emit-c and --native name their outputs after <output> without ".mr".
+    static std::string withoutExtension(const std::string &name, const std::string &ext)
+    {
+        if (name.size() > ext.size() && name.compare(name.size() - ext.size(), ext.size(), ext) == 0)
+        {
+            return name.substr(0, name.size() - ext.size());
+        }
+        return name;
+    }
+
+    bool collectStats() const
+    {
+        return timeReport || timeReportJson || !timeReportFile.empty();
+    }
+
+private:
+    std::vector<std::string> passFlags; // -f<pass> and -fno-<pass> in command line order
+
+    static const PassOption *find_pass(const std::string &flag)
+    {
+        std::string name = flag.compare(0, 5, "-fno-") == 0 ? flag.substr(5) : flag.compare(0, 2, "-f") == 0 ? flag.substr(2) : "";
+        for (const auto &pass : pass_options())
+        {
+            if (name == pass.name)
+            {
+                return &pass;
+            }
+        }
+        return nullptr;
+    }
+
+    static std::string value(int argc, char **argv, int &i)
+    {
+        if (i + 1 >= argc)
+        {
+            throw UsageError(std::string("Missing value for ") + argv[i]);
+        }
+        return argv[++i];
+    }
+
+    static unsigned parseCount(const std::string &option, const std::string &text)
+    {
+        try
+        {
+            size_t used = 0;
+            long count = std::stol(text, &used);
+            if (used == text.size() && count > 0)
+            {
+                return count;
+            }
+        }
+        catch (const std::logic_error &)
+        {
+        }
+        throw UsageError("Expected a positive number for " + option + ", got " + text);
+    }
+};
+
+#endif // OPTIONS_HPP
@@ -0,0 +1,277 @@
+#ifndef OUTPUT_WRITER_HPP
+#define OUTPUT_WRITER_HPP
+
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <cstdlib>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "instruction.hpp"
+
+// Formats instructions straight into one large buffer and hands it to the
+// kernel with plain write() calls, flushing only when the buffer fills up.
+// A named output is written to a temporary file next to it and renamed over
+// it by close(); a writer destroyed without close(), as when compilation
+// fails, removes the temporary file and leaves an earlier output untouched.
+class OutputWriter
+{
+public:
+    static const size_t DEFAULT_CAPACITY = 1 << 20;
+    // operand field reserved by write_placeholder, wide enough for any long long
+    static const int PLACEHOLDER_WIDTH = 20;
+
+    explicit OutputWriter(const std::string &fileName, size_t capacity = DEFAULT_CAPACITY)
+        : fileName(fileName), capacity(capacity), tempName(fileName + ".XXXXXX")
+    {
+        fd = ::mkstemp(&tempName[0]);
+        if (fd < 0 || ::fchmod(fd, 0644) != 0)
+        {
+            discard();
+            throw std::runtime_error("Could not open output file " + fileName);
+        }
+        buffer.reserve(capacity + 64);
+    }
+
+    // Writes to a descriptor the caller owns, such as a socket; close() only
+    // flushes it.
+    OutputWriter(int fd, const std::string &name, size_t capacity = DEFAULT_CAPACITY)
+        : fileName(name), capacity(capacity), fd(fd), ownsFd(false)
+    {
+        buffer.reserve(capacity + 64);
+    }
+
+    ~OutputWriter()
+    {
+        if (ownsFd)
+        {
+            discard();
+            return;
+        }
+        try
+        {
+            close();
+        }
+        catch (const std::runtime_error &)
+        {
+        }
+    }
+
+    OutputWriter(const OutputWriter &) = delete;
+    OutputWriter &operator=(const OutputWriter &) = delete;
+
+    void write(const Instruction &inst)
+    {
+        append(opcode_name(inst.op));
+        if (has_operand(inst.op))
+        {
+            buffer.push_back(' ');
+            append_number(inst.arg);
+        }
+        buffer.push_back('\n');
+        if (buffer.size() >= capacity)
+        {
+            flush();
+        }
+    }
+
+    void write(const std::vector<Instruction> &instructions, size_t from = 0)
+    {
+        write(instructions, from, instructions.size());
+    }
+
+    void write(const std::vector<Instruction> &instructions, size_t from, size_t to)
+    {
+        for (size_t i = from; i < to; i++)
+        {
+            write(instructions[i]);
+        }
+    }
+
+    // Bytes already formatted, such as an encoded binary program.
+    void write_bytes(const std::string &bytes)
+    {
+        buffer.append(bytes);
+        if (buffer.size() >= capacity)
+        {
+            flush();
+        }
+    }
+
+    // Writes an instruction whose operand is not known yet, padding the operand
+    // field so that patch() can later fill it in place. Returns the file offset.
+    long long write_placeholder(const Instruction &inst)
+    {
+        long long offset = flushed + buffer.size();
+        append(opcode_name(inst.op));
+        buffer.push_back(' ');
+        buffer.append(PLACEHOLDER_WIDTH, ' ');
+        buffer.push_back('\n');
+        return offset;
+    }
+
+    // Replaces the placeholder at offset with the instruction, formatted as
+    // write() would. Whatever follows the placeholder moves back by the padding
+    // left over, in the buffer or, once flushed, in the file.
+    void patch(long long offset, const Instruction &inst)
+    {
+        std::string line = opcode_name(inst.op);
+        line.push_back(' ');
+        line += std::to_string(inst.arg);
+        long long placeholder = std::strlen(opcode_name(inst.op)) + 1 + PLACEHOLDER_WIDTH;
+
+        if (offset >= flushed)
+        {
+            buffer.replace(offset - flushed, placeholder, line);
+            return;
+        }
+        flush();
+        pwrite_all(line.data(), line.size(), offset);
+        long long gap = placeholder - line.size();
+        std::vector<char> chunk(capacity);
+        for (long long from = offset + placeholder; from < flushed;)
+        {
+            ssize_t n = ::pread(fd, chunk.data(), std::min<long long>(chunk.size(), flushed - from), from);
+            if (n <= 0)
+            {
+                if (n < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                throw std::runtime_error("Could not read back output file " + fileName + ": " +
+                                         std::strerror(n < 0 ? errno : EIO));
+            }
+            pwrite_all(chunk.data(), n, from - gap);
+            from += n;
+        }
+        flushed -= gap;
+        if (::ftruncate(fd, flushed) != 0)
+        {
+            throw std::runtime_error("Could not write output file " + fileName + ": " + std::strerror(errno));
+        }
+    }
+
+    void flush()
+    {
+        const char *data = buffer.data();
+        size_t left = buffer.size();
+        while (left > 0)
+        {
+            ssize_t n = ::write(fd, data, left);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                throw std::runtime_error("Could not write output file " + fileName + ": " + std::strerror(errno));
+            }
+            data += n;
+            left -= n;
+        }
+        flushed += buffer.size();
+        buffer.clear();
+    }
+
+    void close()
+    {
+        if (fd < 0)
+        {
+            return;
+        }
+        flush();
+        if (ownsFd)
+        {
+            bool closed = ::close(fd) == 0;
+            fd = -1;
+            if (!closed || ::rename(tempName.c_str(), fileName.c_str()) != 0)
+            {
+                std::string error = std::strerror(errno);
+                discard();
+                throw std::runtime_error("Could not write output file " + fileName + ": " + error);
+            }
+            tempName.clear();
+        }
+        fd = -1;
+    }
+
+    long long bytesWritten() const
+    {
+        return flushed + buffer.size();
+    }
+
+private:
+    std::string fileName;
+    size_t capacity;
+    int fd = -1;
+    bool ownsFd = true;
+    long long flushed = 0;
+    std::string buffer;
+    std::string tempName; // until close() renames it
+
+    void discard()
+    {
+        if (fd >= 0)
+        {
+            ::close(fd);
+            fd = -1;
+        }
+        if (!tempName.empty())
+        {
+            ::unlink(tempName.c_str());
+            tempName.clear();
+        }
+    }
+
+    void pwrite_all(const char *data, size_t size, long long offset)
+    {
+        while (size > 0)
+        {
+            ssize_t n = ::pwrite(fd, data, size, offset);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                throw std::runtime_error("Could not write output file " + fileName + ": " + std::strerror(errno));
+            }
+            data += n;
+            size -= n;
+            offset += n;
+        }
+    }
+
+    void append(const char *text)
+    {
+        buffer.append(text);
+    }
+
+    void append_number(long long value)
+    {
+        char digits[24];
+        int len = 0;
+        unsigned long long magnitude = value < 0 ? 0ULL - (unsigned long long)value : (unsigned long long)value;
+        do
+        {
+            digits[len++] = '0' + magnitude % 10;
+            magnitude /= 10;
+        } while (magnitude > 0);
+        if (value < 0)
+        {
+            buffer.push_back('-');
+        }
+        while (len > 0)
+        {
+            buffer.push_back(digits[--len]);
+        }
+    }
+};
+
+#endif // OUTPUT_WRITER_HPP
@@ -0,0 +1,310 @@
+#ifndef PARAMETER_ANALYSIS_HPP
+#define PARAMETER_ANALYSIS_HPP
+
+#include <string>
+#include <vector>
+#include <set>
+#include <utility>
+#include <unordered_map>
+
+#include "ast.hpp"
+#include "ast_visitor.hpp"
+#include "mod_ref.hpp"
+
+// Chooses the scalar parameters passed by copy-in/copy-out instead of by
+// address. Such a parameter is loaded into a local cell on entry and, when the
+// procedure may modify it, stored back before RTRN, so the body uses LOAD and
+// STORE instead of LOADI and STOREI.
+//
+// This is only equivalent when nothing else can reach the caller's variable
+// while the procedure runs. Procedures see no variables but their own, so the
+// only way is another parameter bound to the same variable: a parameter that
+// may alias another one at any call site keeps being passed by address.
+// Aliasing is followed through calls, as a procedure passing on two of its
+// own parameters passes whatever they were bound to.
+class ParameterAnalysis : public AstVisitor
+{
+public:
+    static const long long LOOP_WEIGHT = 10; // assumed iterations of a loop
+    static const int MAX_LOOP_DEPTH = 6;
+
+    struct Parameter
+    {
+        std::string name;
+        bool isArray = false;
+        long long reads = 0;  // LOADI saved, weighted by loop depth
+        long long writes = 0; // STOREI saved
+        long long passes = 0; // passed on: SET of the copy instead of LOAD
+        bool read = false;    // including by the procedures it is passed to
+        bool written = false;
+        bool aliased = false;
+        bool copied = false;
+    };
+
+    struct CallSite
+    {
+        std::string caller;
+        std::string callee;
+        std::vector<std::string> arguments;
+    };
+
+    std::vector<std::string> procedures; // declaration order
+    std::unordered_map<std::string, std::vector<Parameter>> parameters;
+    std::vector<CallSite> calls;
+
+    // Runs the analysis over the whole program, taking what every procedure
+    // reads and writes from its mod/ref summary.
+    void analyze(ProgramNode *root, const ModRefSummary &summary)
+    {
+        visit(root);
+        for (const auto &proc : procedures)
+        {
+            auto &params = parameters[proc];
+            for (size_t i = 0; i < params.size(); i++)
+            {
+                params[i].read = summary.reads(proc, i);
+                params[i].written = summary.writes(proc, i);
+            }
+        }
+        find_aliases();
+        for (const auto &proc : procedures)
+        {
+            for (auto &param : parameters[proc])
+            {
+                param.copied = !param.isArray && !param.aliased && benefit(param) > 0;
+            }
+        }
+    }
+
+    // Copied parameters of a procedure, with whether they are stored back.
+    std::vector<std::pair<std::string, bool>> copies(const std::string &proc) const
+    {
+        std::vector<std::pair<std::string, bool>> result;
+        auto it = parameters.find(proc);
+        if (it != parameters.end())
+        {
+            for (const auto &param : it->second)
+            {
+                if (param.copied)
+                {
+                    result.push_back({param.name, param.written});
+                }
+            }
+        }
+        return result;
+    }
+
+    void visit_procedure(ProcedureNode *node) override
+    {
+        procName = *node->arguments->procedureName;
+        procedures.push_back(procName);
+        auto &params = parameters[procName];
+        if (node->arguments->arguments)
+        {
+            for (const auto &arg : node->arguments->arguments->arguments)
+            {
+                Parameter param;
+                param.name = *arg->argumentName;
+                param.isArray = arg->isArray;
+                params.push_back(param);
+            }
+        }
+        depth = 0;
+        visit(node->commands);
+    }
+
+    void visit_main(MainNode *node) override
+    {
+        procName = "";
+        depth = 0;
+        visit(node->commands);
+    }
+
+    // identifiers are read unless they are the target of a command below
+    void visit_identifier(IdentifierNode *node) override
+    {
+        if (!node->isElement)
+        {
+            if (Parameter *param = find(node->getName()))
+            {
+                param->reads += weight();
+            }
+        }
+        visit(node->index_var);
+    }
+
+    void visit_assign(AssignNode *node) override
+    {
+        visit_target(node->identifier);
+        visit(node->expression);
+    }
+
+    void visit_read(ReadNode *node) override
+    {
+        visit_target(node->identifier);
+    }
+
+    void visit_while(WhileNode *node) override
+    {
+        depth++;
+        AstVisitor::visit_while(node);
+        depth--;
+    }
+
+    void visit_repeat_until(RepeatUntilNode *node) override
+    {
+        depth++;
+        AstVisitor::visit_repeat_until(node);
+        depth--;
+    }
+
+    void visit_for_to(ForToNode *node) override
+    {
+        visit(node->fromValue);
+        visit(node->toValue);
+        depth++;
+        visit(node->commands);
+        depth--;
+    }
+
+    void visit_for_downto(ForDownToNode *node) override
+    {
+        visit(node->fromValue);
+        visit(node->toValue);
+        depth++;
+        visit(node->commands);
+        depth--;
+    }
+
+    void visit_procedure_call(ProcedureCallNode *node) override
+    {
+        CallSite call = {procName, *node->procedureName, {}};
+        if (node->arguments)
+        {
+            for (const auto &arg : node->arguments->getArguments())
+            {
+                call.arguments.push_back(arg->getName());
+                if (Parameter *param = find(arg->getName()))
+                {
+                    param->passes += weight();
+                }
+            }
+        }
+        calls.push_back(call);
+    }
+
+private:
+    int depth = 0;
+
+    long long weight() const
+    {
+        long long w = 1;
+        for (int i = 0; i < depth && i < MAX_LOOP_DEPTH; i++)
+        {
+            w *= LOOP_WEIGHT;
+        }
+        return w;
+    }
+
+    // Scalar parameter of the procedure being visited, or nullptr.
+    Parameter *find(const std::string &name)
+    {
+        auto it = parameters.find(procName);
+        if (it == parameters.end())
+        {
+            return nullptr;
+        }
+        for (auto &param : it->second)
+        {
+            if (param.name == name && !param.isArray)
+            {
+                return &param;
+            }
+        }
+        return nullptr;
+    }
+
+    int index(const std::string &proc, const std::string &name) const
+    {
+        auto it = parameters.find(proc);
+        if (it == parameters.end())
+        {
+            return -1;
+        }
+        for (size_t i = 0; i < it->second.size(); i++)
+        {
+            if (it->second[i].name == name && !it->second[i].isArray)
+            {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    void visit_target(IdentifierNode *node)
+    {
+        if (!node->isElement)
+        {
+            if (Parameter *param = find(node->getName()))
+            {
+                param->writes += weight();
+            }
+        }
+        visit(node->index_var);
+    }
+
+    // Callers follow their callees, so walking the procedures backwards sees
+    // every caller's aliases before its callees.
+    void find_aliases()
+    {
+        std::unordered_map<std::string, std::set<std::pair<int, int>>> aliases;
+        for (auto proc = procedures.rbegin(); proc != procedures.rend(); ++proc)
+        {
+            auto &params = parameters[*proc];
+            for (const auto &call : calls)
+            {
+                if (call.callee != *proc)
+                {
+                    continue;
+                }
+                for (size_t i = 0; i < call.arguments.size() && i < params.size(); i++)
+                {
+                    for (size_t j = i + 1; j < call.arguments.size() && j < params.size(); j++)
+                    {
+                        if (params[i].isArray || params[j].isArray)
+                        {
+                            continue;
+                        }
+                        bool same = call.arguments[i] == call.arguments[j];
+                        int k = index(call.caller, call.arguments[i]);
+                        int l = index(call.caller, call.arguments[j]);
+                        if (!same && k >= 0 && l >= 0)
+                        {
+                            same = aliases[call.caller].count({std::min(k, l), std::max(k, l)}) > 0;
+                        }
+                        if (same)
+                        {
+                            aliases[*proc].insert({(int)i, (int)j});
+                            params[i].aliased = params[j].aliased = true;
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // Cost units saved per call: 10 for every LOADI/STOREI turned into a
+    // LOAD/STORE, less 40 for every SET of the copy replacing a LOAD of the
+    // address, less 30 for the copy in and 30 for the copy out.
+    static long long benefit(const Parameter &param)
+    {
+        if (!param.read && !param.written)
+        {
+            return 0;
+        }
+        long long saved = 10 * (param.reads + param.writes) - 40 * param.passes;
+        return saved - 30 - (param.written ? 30 : 0);
+    }
+};
+
+#endif // PARAMETER_ANALYSIS_HPP
@@ -0,0 +1,100 @@
+#ifndef PARSE_CONTEXT_HPP
+#define PARSE_CONTEXT_HPP
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstring>
+#include <unordered_map>
+
+#include "ast.hpp"
+#include "source_buffer.hpp"
+#include "stats.hpp"
+
+// State of a single parse. The scanner and the parser are reentrant and keep
+// everything here instead of in globals, so independent compilations can run
+// side by side in one process.
+class ParseContext
+{
+public:
+    explicit ParseContext(const std::string &file) : fileName(file) {}
+
+    // The tree and the names it points to live as long as the context.
+    ~ParseContext()
+    {
+        delete root;
+    }
+
+    ParseContext(const ParseContext &) = delete;
+    ParseContext &operator=(const ParseContext &) = delete;
+
+    void error(const std::string &message, int line)
+    {
+        errors.push_back("\e[0;31mError:\e[0m " + message + " at line: " + std::to_string(line));
+    }
+
+    bool hasErrors() const
+    {
+        return !errors.empty();
+    }
+
+    // Every occurrence of an identifier shares one string, owned here. The
+    // token is hashed where it lies in the source buffer, so only the first
+    // occurrence of a name allocates.
+    std::string *intern(const char *text, size_t length)
+    {
+        auto it = names.find(NameView{text, length});
+        if (it != names.end())
+        {
+            return it->second;
+        }
+        namePool.emplace_back(new std::string(text, length));
+        std::string *name = namePool.back().get();
+        names.emplace(NameView{name->data(), length}, name);
+        return name;
+    }
+
+    std::string fileName;
+    ProgramNode *root = nullptr; // owned
+    std::vector<std::string> errors;
+
+    // set for -ftime-report; the scanner is then timed token by token
+    CompileStats *stats = nullptr;
+    double lexMilliseconds = 0;
+    long long lexAllocations = 0;
+    long long tokens = 0;
+
+private:
+    struct NameView
+    {
+        const char *text;
+        size_t length;
+
+        bool operator==(const NameView &other) const
+        {
+            return length == other.length && std::memcmp(text, other.text, length) == 0;
+        }
+    };
+
+    struct NameHash
+    {
+        size_t operator()(const NameView &name) const
+        {
+            size_t hash = 14695981039346656037ULL; // FNV-1a
+            for (size_t i = 0; i < name.length; i++)
+            {
+                hash = (hash ^ (unsigned char)name.text[i]) * 1099511628211ULL;
+            }
+            return hash;
+        }
+    };
+
+    std::unordered_map<NameView, std::string *, NameHash> names; // keys view the pooled strings
+    std::vector<std::unique_ptr<std::string>> namePool;
+};
+
+// Defined in parser.y. Parses the whole buffer; the resulting tree is left in
+// context.root. Returns false on syntax errors (listed in context.errors).
+bool parse_source(SourceBuffer &source, ParseContext &context);
+
+#endif // PARSE_CONTEXT_HPP
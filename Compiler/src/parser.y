@@ -1,27 +1,40 @@
 %{
     #include "ast.hpp"
     #include <cstdio>
-    #include <fstream>
+    #include <cstdlib>
+    #include <chrono>
+    #include <new>
+    #include <malloc.h>
     #include "symbol_table.hpp"
     #include "code_generator.hpp"
-
-    extern FILE* yyin;
-
-    ProgramNode* root;
-    void yyerror(const char *s);
-    int yylex(void);
-    extern int yylineno;
+    #include "driver.hpp"
+    #include "compile_server.hpp"
 %}
 
 %debug
+%define api.pure full
+%locations
 
 %code requires {
     #include <iostream>
     #include <string>
     #include "ast.hpp"
-    
+    #include "parse_context.hpp"
+
+    #ifndef YY_TYPEDEF_YY_SCANNER_T
+    #define YY_TYPEDEF_YY_SCANNER_T
+    typedef void *yyscan_t;
+    #endif
 }
 
+%code {
+    int yylex(YYSTYPE *yylval, YYLTYPE *yylloc, yyscan_t scanner);
+    void yyerror(YYLTYPE *yylloc, yyscan_t scanner, ParseContext *context, const char *s);
+}
+
+%lex-param {yyscan_t scanner}
+%parse-param {yyscan_t scanner} {ParseContext *context}
+
 %union {
     long long num;
     std::string* str;
@@ -66,43 +79,50 @@
 %type <args_decl_node> args_decl
 %type <args_node> args
 
+// nodes of a parse that fails are freed; a finished program is owned by the context
+%destructor { delete $$; } <procedures_node> <main_node> <commands_node> <command_node>
+%destructor { delete $$; } <proc_head_node> <proc_call_node> <declarations_node> <args_decl_node> <args_node>
+%destructor { delete $$; } <expression_node> <condition_node> <value_node> <identifier_node>
+
 %start program_all
 
 %%
 
 program_all:
     procedures main {
-        root = new ProgramNode();
-        root->addProcedures($1);
-        root->addMain($2);
+        context->root = new ProgramNode();
+        context->root->addProcedures($1);
+        context->root->addMain($2);
     }
     ;
 
 procedures:
     procedures PROCEDURE proc_head IS declarations BEGIN_T commands END_T {
         $1->addProcedure(new ProcedureNode($3, $5, $7));
+        $1->procedures.back()->setLineNumber(@2.first_line);
         $$ = $1;
-        $$->setLineNumber(yylineno);
+        $$->setLineNumber(@$.first_line);
     }
     | procedures PROCEDURE proc_head IS BEGIN_T commands END_T {
         $1->addProcedure(new ProcedureNode($3, nullptr, $6));
+        $1->procedures.back()->setLineNumber(@2.first_line);
         $$ = $1;
-        $$->setLineNumber(yylineno);
+        $$->setLineNumber(@$.first_line);
     }
     | {
         $$ = new ProceduresNode();
-        $$->setLineNumber(yylineno);
+        $$->setLineNumber(@$.first_line);
     }
     ;
 
 main:
     PROGRAM IS declarations BEGIN_T commands END_T {
         $$ = new MainNode($3, $5);
-        $$->setLineNumber(yylineno);
+        $$->setLineNumber(@$.first_line);
     }
     | PROGRAM IS BEGIN_T commands END_T {
        $$ = new MainNode($4); 
-       $$->setLineNumber(yylineno);
+       $$->setLineNumber(@$.first_line);
     }
     ;
 
@@ -120,250 +140,303 @@ commands:
 command:
     identifier ASSIGN expression SEMICOLON {
          $$ = new AssignNode($1, $3);
-         $$->setLineNumber(yylineno);
+         $$->setLineNumber(@$.first_line);
     }
     | IF condition THEN commands ELSE commands ENDIF {
         $$ = new IfNode($2, $4, $6);
-        $$->setLineNumber(yylineno);
+        $$->setLineNumber(@$.first_line);
     }
     | IF condition THEN commands ENDIF {
         $$ = new IfNode($2, $4, nullptr);
-        $$->setLineNumber(yylineno);
+        $$->setLineNumber(@$.first_line);
     }
     | WHILE condition DO commands ENDWHILE {
         $$ = new WhileNode($2, $4);
-        $$->setLineNumber(yylineno);
+        $$->setLineNumber(@$.first_line);
     }
     | REPEAT commands UNTIL condition SEMICOLON {
         $$ = new RepeatUntilNode($4, $2);
-        $$->setLineNumber(yylineno);
+        $$->setLineNumber(@$.first_line);
     }
     | FOR PIDENTIFIER_TOKEN FROM value TO value DO commands ENDFOR {
         $$ = new ForToNode($2, $4, $6, $8);
-        $$->setLineNumber(yylineno);
+        $$->setLineNumber(@$.first_line);
     }
     | FOR PIDENTIFIER_TOKEN FROM value DOWNTO value DO commands ENDFOR {
         $$ = new ForDownToNode($2, $4, $6, $8);
-        $$->setLineNumber(yylineno);
+        $$->setLineNumber(@$.first_line);
     }
     | proc_call SEMICOLON {
         $$ = $1;
-        $$->setLineNumber(yylineno);
+        $$->setLineNumber(@$.first_line);
     }
     | READ identifier SEMICOLON {
         $$ = new ReadNode($2);
-        $$->setLineNumber(yylineno);
+        $$->setLineNumber(@$.first_line);
     }
     | WRITE value SEMICOLON {
         $$ = new WriteNode($2);
-        $$->setLineNumber(yylineno);
+        $$->setLineNumber(@$.first_line);
     }
     ;
 
 proc_head:
     PIDENTIFIER_TOKEN LPAREN args_decl RPAREN {
         $$ = new ProcedureHeadNode($1, $3);
-        $$->setLineNumber(yylineno);
+        $$->setLineNumber(@$.first_line);
     }
     ;
 
 proc_call:
     PIDENTIFIER_TOKEN LPAREN args RPAREN {
         $$ = new ProcedureCallNode($1, $3);
-        $$->setLineNumber(yylineno);
+        $$->setLineNumber(@$.first_line);
     }
     ;
 
 declarations:
     declarations COMMA PIDENTIFIER_TOKEN {
         $1->addVariableDeclaration($3);
+        $1->declarations.back()->setLineNumber(@3.first_line);
         $$ = $1;
-        $$->setLineNumber(yylineno - 1);
     }
     | declarations COMMA PIDENTIFIER_TOKEN LBRACK value COLON value RBRACK {
         $1->addArrayDeclaration($3, $5, $7);
+        $1->declarations.back()->setLineNumber(@3.first_line);
         $$ = $1;
-        $$->setLineNumber(yylineno - 1);    
     }
     | PIDENTIFIER_TOKEN {
         $$ = new DeclarationsNode();
         $$->addVariableDeclaration($1);
-        $$->setLineNumber(yylineno - 1);
+        $$->declarations.back()->setLineNumber(@1.first_line);
+        $$->setLineNumber(@$.first_line);
     }
     | PIDENTIFIER_TOKEN LBRACK value COLON value RBRACK {
         $$ = new DeclarationsNode();
         $$->addArrayDeclaration($1, $3, $5);
-        $$->setLineNumber(yylineno - 1);
+        $$->declarations.back()->setLineNumber(@1.first_line);
+        $$->setLineNumber(@$.first_line);
     }
     ;
 
 args_decl:
     args_decl COMMA PIDENTIFIER_TOKEN {
         $1->addVariableArgument($3);
+        $1->arguments.back()->setLineNumber(@3.first_line);
         $$ = $1;
-        $$->setLineNumber(yylineno);
     }
     | args_decl COMMA T PIDENTIFIER_TOKEN {
         $1->addArrayArgument($4);
+        $1->arguments.back()->setLineNumber(@4.first_line);
         $$ = $1;
-        $$->setLineNumber(yylineno);
     }
     | PIDENTIFIER_TOKEN {
         $$ = new ArgumentsDeclarationNode();
         $$->addVariableArgument($1);
-        $$->setLineNumber(yylineno);
+        $$->arguments.back()->setLineNumber(@1.first_line);
+        $$->setLineNumber(@$.first_line);
     }
     | T PIDENTIFIER_TOKEN {
         $$ = new ArgumentsDeclarationNode();
         $$->addArrayArgument($2);
-        $$->setLineNumber(yylineno);
+        $$->arguments.back()->setLineNumber(@2.first_line);
+        $$->setLineNumber(@$.first_line);
     }
     ;
 
 args:
     args COMMA PIDENTIFIER_TOKEN {
         $1->addArgument($3);
+        $1->arguments.back()->setLineNumber(@3.first_line);
         $$ = $1;
-        $$->setLineNumber(yylineno);
     }
     | PIDENTIFIER_TOKEN {
         $$ = new ProcedureCallArguments();
         $$->addArgument($1);
-        $$->setLineNumber(yylineno);
+        $$->arguments.back()->setLineNumber(@1.first_line);
+        $$->setLineNumber(@$.first_line);
     }
     ;
 
 expression:
     value {
         $$ = $1;
-        $$->setLineNumber(yylineno);
+        $$->setLineNumber(@$.first_line);
     }
     | value PLUS value {
         $$ = new BinaryExpressionNode($1, "+", $3);
-        $$->setLineNumber(yylineno);
+        $$->setLineNumber(@$.first_line);
     }
     | value MINUS value {
          $$ = new BinaryExpressionNode($1, "-", $3);
-         $$->setLineNumber(yylineno);
+         $$->setLineNumber(@$.first_line);
     }
     | value ASTERISK value {
          $$ = new BinaryExpressionNode($1, "*", $3);
-         $$->setLineNumber(yylineno);
+         $$->setLineNumber(@$.first_line);
     }
     | value FWSLASH value {
          $$ = new BinaryExpressionNode($1, "/", $3);
-         $$->setLineNumber(yylineno);
+         $$->setLineNumber(@$.first_line);
     }
     | value PERCENT value {
          $$ = new BinaryExpressionNode($1, "%", $3);
-         $$->setLineNumber(yylineno);
+         $$->setLineNumber(@$.first_line);
     }
     ;
 
 condition:
     value EQ value {
         $$ = new ConditionNode($1, "=", $3);
-        $$->setLineNumber(yylineno);
+        $$->setLineNumber(@$.first_line);
     }
     | value NEQ value {
         $$ = new ConditionNode($1, "!=", $3);
-        $$->setLineNumber(yylineno);
+        $$->setLineNumber(@$.first_line);
     }
     | value GT value {
         $$ = new ConditionNode($1, ">", $3);
-        $$->setLineNumber(yylineno);
+        $$->setLineNumber(@$.first_line);
     }
     | value LT value {
         $$ = new ConditionNode($1, "<", $3);
-        $$->setLineNumber(yylineno);
+        $$->setLineNumber(@$.first_line);
     }
     | value GEQ value {
         $$ = new ConditionNode($1, ">=", $3);
-        $$->setLineNumber(yylineno);
+        $$->setLineNumber(@$.first_line);
     }
     | value LEQ value {
         $$ = new ConditionNode($1, "<=", $3);
-        $$->setLineNumber(yylineno);
+        $$->setLineNumber(@$.first_line);
     }
     ;
 
 value:
     NUM {
         $$ = new ValueNode($1);
+        $$->setLineNumber(@$.first_line);
     }
     | identifier {
         $$ = new ValueNode($1);
+        $$->setLineNumber(@$.first_line);
     }
     | MINUS NUM {
         $$ = new ValueNode($2, -1);
+        $$->setLineNumber(@$.first_line);
     }
     ;
 
 identifier:
     PIDENTIFIER_TOKEN {
         $$ = new IdentifierNode($1);
+        $$->setLineNumber(@$.first_line);
     }
     | PIDENTIFIER_TOKEN LBRACK PIDENTIFIER_TOKEN RBRACK {
         $$ = new IdentifierNode($1, new IdentifierNode($3));
+        $$->index_var->setLineNumber(@3.first_line);
+        $$->setLineNumber(@$.first_line);
     }
     | PIDENTIFIER_TOKEN LBRACK NUM RBRACK {
         $$ = new IdentifierNode($1, $3);
+        $$->setLineNumber(@$.first_line);
     }
     ;
 
 %%
 
-void yyerror(const char *s) {
-     // Suppress error messages
-     fprintf(stderr, "Error: %s at line %d\n", s, yylineno);
+typedef struct yy_buffer_state *YY_BUFFER_STATE;
+int yylex_init_extra(ParseContext *context, yyscan_t *scanner);
+YY_BUFFER_STATE yy_scan_buffer(char *base, size_t size, yyscan_t scanner);
+int yylex_destroy(yyscan_t scanner);
+ParseContext *yyget_extra(yyscan_t scanner);
+int scan_token(YYSTYPE *yylval, YYLTYPE *yylloc, yyscan_t scanner);
+
+thread_local long long thread_allocations = 0;
+thread_local long long thread_heap_bytes = 0;
+thread_local long long thread_heap_peak = 0;
+
+// Counts allocations and heap bytes per thread for -ftime-report and -fmem-report.
+void *operator new(std::size_t size) {
+    thread_allocations++;
+    void *p = std::malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    thread_heap_bytes += malloc_usable_size(p);
+    if (thread_heap_bytes > thread_heap_peak) {
+        thread_heap_peak = thread_heap_bytes;
+    }
+    return p;
 }
 
-int main(int argc, char** argv) {
-    std::string inputFileName = "input.imp";
-    std::string outputFileName = "output.mr";
+// kept out of line so the compiler does not pair free() with new-expressions
+__attribute__((noinline)) void operator delete(void *p) noexcept {
+    if (p) {
+        thread_heap_bytes -= malloc_usable_size(p);
+    }
+    std::free(p);
+}
 
-    FILE* inputFile = fopen(inputFileName.c_str(), "r");
-    if (!inputFile) {
-        std::cerr << "Error: Could not open input file " << inputFileName << "\n";
-        return 1;
+int yylex(YYSTYPE *yylval, YYLTYPE *yylloc, yyscan_t scanner) {
+    ParseContext *context = yyget_extra(scanner);
+    if (!context->stats) {
+        return scan_token(yylval, yylloc, scanner);
     }
-    yyin = inputFile;
 
-    if (yyparse() == 0 && root != nullptr) {
-        SymbolTable* tb;  
+    auto start = std::chrono::steady_clock::now();
+    long long allocations = thread_allocations;
+    int token = scan_token(yylval, yylloc, scanner);
+    context->lexMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    context->lexAllocations += thread_allocations - allocations;
+    context->tokens++;
+    return token;
+}
 
-        try {
-            tb = new SymbolTable(root); 
-        } catch (const std::runtime_error& e) {
-            std::cerr << e.what() << std::endl;
-            fclose(inputFile);
-            return 1;
-        }
+void yyerror(YYLTYPE *yylloc, yyscan_t, ParseContext *context, const char *s) {
+    context->error(s, yylloc->first_line);
+}
 
-        std::ofstream outputFile(outputFileName);
-        if (!outputFile) {
-            std::cerr << "Error: Could not open output file " << outputFileName << "\n";
-            return 1;
-        }
-        
-        std::streambuf* coutbuf = std::cout.rdbuf(); 
-        std::cout.rdbuf(outputFile.rdbuf()); 
-        
-        CodeGenerator generate; 
-        try {
-            generate.generate_code(root, tb); 
-        } catch (const std::runtime_error& e) {
-            std::cerr << e.what() << std::endl;
-            fclose(inputFile);
-            std::cout.rdbuf(coutbuf);
-            return 1;
-        }
-        std::cout.rdbuf(coutbuf);
-    } else {
-        std::cerr << "There is no PROGRAM created!\n";
+bool parse_source(SourceBuffer &source, ParseContext &context) {
+    yyscan_t scanner;
+    if (yylex_init_extra(&context, &scanner) != 0) {
+        context.errors.push_back("Could not initialize the scanner");
+        return false;
     }
+    yy_scan_buffer(source.data(), source.scanSize(), scanner);
 
-    fclose(inputFile);
-    return 0;
+    auto start = std::chrono::steady_clock::now();
+    long long allocations = thread_allocations;
+    int result = yyparse(scanner, &context);
+    yylex_destroy(scanner);
+
+    if (context.stats) {
+        double parseMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        context.stats->addPhase("lexing", context.lexMilliseconds, context.lexAllocations);
+        context.stats->addPhase("parsing (yyparse)", parseMilliseconds - context.lexMilliseconds,
+                                thread_allocations - allocations - context.lexAllocations);
+        context.stats->count("tokens", context.tokens);
+    }
+    return result == 0 && context.root != nullptr && !context.hasErrors();
 }
 
+int main(int argc, char** argv) {
+    CompilerOptions options;
+    try {
+        options.parse(argc, argv);
+    } catch (const CompilerOptions::UsageError& e) {
+        if (e.what()[0] != '\0') {
+            std::cerr << "Error: " << e.what() << "\n";
+        }
+        std::cerr << CompilerOptions::usage(argv[0]);
+        return e.what()[0] != '\0';
+    }
+
+    if (!options.serverSocket.empty()) {
+        CompileServer server(options);
+        return server.run();
+    }
+
+    Driver driver(options);
+    return driver.run();
+}
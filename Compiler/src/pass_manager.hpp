@@ -0,0 +1,394 @@
+#ifndef PASS_MANAGER_HPP
+#define PASS_MANAGER_HPP
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+
+#include "ast.hpp"
+#include "ast_visitor.hpp"
+#include "instruction.hpp"
+#include "loop_fusion.hpp"
+#include "options.hpp"
+#include "parse_context.hpp"
+#include "peephole.hpp"
+#include "procedure_cloning.hpp"
+#include "stats.hpp"
+
+// Runs the optimization passes chosen by the options, in the order of
+// CompilerOptions::pass_options(): tree passes before the symbol table is
+// built, then, on the code of every procedure once it is generated, the
+// instruction passes. Lowering passes are decisions the code generator makes
+// while emitting code, so they only show up here in the report. With
+// -fverify-passes the code is checked before the first instruction pass and
+// after every pass, and a broken invariant is reported as an error naming the
+// pass.
+class PassManager
+{
+public:
+    PassManager(const CompilerOptions &options, CompileStats *stats) : options(options), stats(stats)
+    {
+        for (const auto &pass : CompilerOptions::pass_options())
+        {
+            results.push_back({pass.name, pass.kind, 0, 0, 0, 0});
+            index[pass.name] = results.size() - 1;
+        }
+    }
+
+    bool enabled(const std::string &name) const
+    {
+        for (const auto &pass : CompilerOptions::pass_options())
+        {
+            if (name == pass.name)
+            {
+                return options.*pass.enabled;
+            }
+        }
+        return false;
+    }
+
+    void run_ast_passes(ParseContext &context)
+    {
+        if (enabled("clone-procedures"))
+        {
+            {
+                Timer timer(this, "clone-procedures");
+                PhaseTimer phase(stats, "procedure cloning");
+                ProcedureCloning cloning(&context);
+                cloning.budget = options.cloneBudget;
+                cloning.run(context.root);
+                if (stats)
+                {
+                    stats->count("procedures cloned", cloning.cloned);
+                    stats->count("calls to clones", cloning.specialized);
+                    stats->count("procedures replaced by clones", cloning.removed);
+                }
+            }
+            if (options.verifyPasses)
+            {
+                verify_tree(context.root, "clone-procedures");
+            }
+        }
+        if (enabled("fuse-loops"))
+        {
+            {
+                Timer timer(this, "fuse-loops");
+                PhaseTimer phase(stats, "loop fusion");
+                LoopFusion fusion;
+                fusion.unrollLoops = options.unrollLoops;
+                fusion.unrollBudget = options.unrollBudget;
+                fusion.run(context.root);
+                if (stats)
+                {
+                    stats->count("loops fused", fusion.fused);
+                }
+            }
+            if (options.verifyPasses)
+            {
+                verify_tree(context.root, "fuse-loops");
+            }
+        }
+    }
+
+    // Rewrites code[from..], the code of one procedure, as Peephole::run does,
+    // and returns the new index of every old index from `from` to the end.
+    std::vector<long long> run_instruction_passes(std::vector<Instruction> &code, long long from,
+                                                  std::vector<long long> &returnAddressSets,
+                                                  const std::vector<long long> &barriers,
+                                                  std::pair<long long, long long> temporaries)
+    {
+        std::vector<long long> moved(code.size() - from + 1);
+        for (size_t k = 0; k < moved.size(); k++)
+        {
+            moved[k] = from + k;
+        }
+        if (options.verifyPasses)
+        {
+            verify_code(code, from, returnAddressSets, "code generation");
+        }
+
+        if (enabled("rewrite-table"))
+        {
+            Measure measure(this, "rewrite-table", code, from);
+            compose(moved, peephole.run(code, from, returnAddressSets, barriers, temporaries), from);
+            if (stats)
+            {
+                stats->count("rewrite table matches", peephole.matches - rewriteMatches);
+                stats->count("instructions removed by rewrites", peephole.removed - rewriteRemoved);
+            }
+            rewriteMatches = peephole.matches;
+            rewriteRemoved = peephole.removed;
+        }
+        if (options.verifyPasses && enabled("rewrite-table"))
+        {
+            verify_code(code, from, returnAddressSets, "rewrite-table");
+        }
+
+        if (enabled("null-jumps"))
+        {
+            Measure measure(this, "null-jumps", code, from);
+            compose(moved, remove_null_jumps(code, from, returnAddressSets, barriers), from);
+        }
+        if (options.verifyPasses && enabled("null-jumps"))
+        {
+            verify_code(code, from, returnAddressSets, "null-jumps");
+        }
+        return moved;
+    }
+
+    // Adds the passes to the statistics, once code generation is done.
+    void report()
+    {
+        if (!stats)
+        {
+            return;
+        }
+        for (auto &result : results)
+        {
+            if (enabled(result.name) && result.kind == "lowering")
+            {
+                result.runs = 1;
+            }
+            stats->passes.push_back(result);
+        }
+    }
+
+private:
+    const CompilerOptions &options;
+    CompileStats *stats;
+    Peephole peephole;
+    long long rewriteMatches = 0;
+    long long rewriteRemoved = 0;
+    std::vector<CompileStats::Pass> results;
+    std::unordered_map<std::string, size_t> index;
+
+    // Wall time of one run of a pass.
+    class Timer
+    {
+    public:
+        Timer(PassManager *manager, const std::string &name)
+            : result(manager->results[manager->index[name]]), start(std::chrono::steady_clock::now())
+        {
+        }
+
+        ~Timer()
+        {
+            auto end = std::chrono::steady_clock::now();
+            result.milliseconds += std::chrono::duration<double, std::milli>(end - start).count();
+            result.runs++;
+        }
+
+    protected:
+        CompileStats::Pass &result;
+
+    private:
+        std::chrono::steady_clock::time_point start;
+    };
+
+    // Wall time, size and cost of the code from `from` on across one run.
+    class Measure : public Timer
+    {
+    public:
+        Measure(PassManager *manager, const std::string &name, const std::vector<Instruction> &code, long long from)
+            : Timer(manager, name), code(code), from(from), size(code.size()), cost(static_cost(code, from))
+        {
+        }
+
+        ~Measure()
+        {
+            result.instructionsRemoved += size - (long long)code.size();
+            result.costSaved += cost - static_cost(code, from);
+        }
+
+    private:
+        const std::vector<Instruction> &code;
+        long long from;
+        long long size;
+        long long cost;
+    };
+
+    static long long static_cost(const std::vector<Instruction> &code, long long from)
+    {
+        long long cost = 0;
+        for (size_t k = from; k < code.size(); k++)
+        {
+            cost += instruction_cost(code[k].op);
+        }
+        return cost;
+    }
+
+    // moved maps indexes from `from` on before all passes so far; step the
+    // same indexes before the last one.
+    static void compose(std::vector<long long> &moved, const std::vector<long long> &step, long long from)
+    {
+        for (auto &index : moved)
+        {
+            index = step[index - from];
+        }
+    }
+
+    // A jump to the next instruction does nothing, so it goes, and everything
+    // landing on it lands on the instruction after it instead. A jump at a
+    // barrier stays, since a block counter is read off there.
+    static std::vector<long long> remove_null_jumps(std::vector<Instruction> &code, long long from,
+                                                    std::vector<long long> &returnAddressSets,
+                                                    const std::vector<long long> &barriers)
+    {
+        long long end = code.size();
+        std::vector<char> keep(end - from, 1);
+        for (long long k = from; k < end; k++)
+        {
+            keep[k - from] = !is_jump(code[k].op) || code[k].arg != 1;
+        }
+        for (long long index : barriers)
+        {
+            if (index >= from && index < end)
+            {
+                keep[index - from] = 1;
+            }
+        }
+
+        std::vector<long long> moved(end - from + 1);
+        std::vector<Instruction> out;
+        for (long long k = from; k < end; k++)
+        {
+            moved[k - from] = from + out.size();
+            if (keep[k - from])
+            {
+                out.push_back(code[k]);
+            }
+        }
+        moved[end - from] = from + out.size();
+
+        for (long long k = from; k < end; k++)
+        {
+            if (keep[k - from] && is_jump(code[k].op))
+            {
+                long long target = k + code[k].arg;
+                long long newTarget = target >= from ? moved[target - from] : target;
+                out[moved[k - from] - from].arg = newTarget - moved[k - from];
+            }
+        }
+        for (auto &set : returnAddressSets)
+        {
+            if (set >= from)
+            {
+                set = moved[set - from];
+                Instruction &inst = out[set - from];
+                if (inst.arg >= from)
+                {
+                    inst.arg = moved[inst.arg - from];
+                }
+            }
+        }
+        code.resize(from);
+        code.insert(code.end(), out.begin(), out.end());
+        return moved;
+    }
+
+    static void broken(const std::string &pass, const std::string &invariant, long long at)
+    {
+        throw std::runtime_error("\e[0;31mError:\e[0m Pass " + pass + " broke the code: " + invariant +
+                                 " at instruction: " + std::to_string(at));
+    }
+
+    // Every jump lands inside the code generated so far, every return
+    // address is a SET of an instruction in it, and memory operands are
+    // cells.
+    static void verify_code(const std::vector<Instruction> &code, long long from,
+                            const std::vector<long long> &returnAddressSets, const std::string &pass)
+    {
+        long long end = code.size();
+        for (long long k = from; k < end; k++)
+        {
+            const Instruction &inst = code[k];
+            if (is_jump(inst.op) && (k + inst.arg < 0 || k + inst.arg >= end))
+            {
+                broken(pass, "jump out of range", k);
+            }
+            if (has_operand(inst.op) && !is_jump(inst.op) && inst.op != Opcode::SET && inst.arg < 0)
+            {
+                broken(pass, "negative memory address", k);
+            }
+        }
+        for (long long set : returnAddressSets)
+        {
+            if (set < from)
+            {
+                continue;
+            }
+            if (set >= end || code[set].op != Opcode::SET)
+            {
+                broken(pass, "lost return address", set);
+            }
+            if (code[set].arg <= set || code[set].arg > end)
+            {
+                broken(pass, "return address out of range", set);
+            }
+        }
+    }
+
+    // Every procedure is declared once, and every call names a procedure
+    // declared before its caller with as many parameters as it passes.
+    static void verify_tree(ProgramNode *root, const std::string &pass)
+    {
+        std::unordered_map<std::string, size_t> parameters;
+        auto check = [&](CommandsNode *commands, const std::string &caller)
+        {
+            CallChecker checker(parameters, caller, pass);
+            checker.visit(commands);
+        };
+        if (root->procedures)
+        {
+            for (const auto &proc : root->procedures->procedures)
+            {
+                std::string name = *proc->arguments->procedureName;
+                check(proc->commands, name);
+                if (parameters.count(name))
+                {
+                    throw std::runtime_error("\e[0;31mError:\e[0m Pass " + pass + " broke the program: " + name +
+                                             " declared twice at line: " + std::to_string(proc->getLineNumber()));
+                }
+                parameters[name] = proc->arguments->arguments ? proc->arguments->arguments->arguments.size() : 0;
+            }
+        }
+        if (root->main)
+        {
+            check(root->main->commands, "");
+        }
+    }
+
+    class CallChecker : public AstVisitor
+    {
+    public:
+        CallChecker(const std::unordered_map<std::string, size_t> &parameters, const std::string &caller,
+                    const std::string &pass)
+            : parameters(parameters), caller(caller), pass(pass)
+        {
+        }
+
+        void visit_procedure_call(ProcedureCallNode *node) override
+        {
+            const std::string &callee = *node->procedureName;
+            auto it = parameters.find(callee);
+            size_t passed = node->arguments ? node->arguments->arguments.size() : 0;
+            // calls of undeclared procedures are the code generator's to report
+            if (callee != caller && it != parameters.end() && it->second != passed)
+            {
+                throw std::runtime_error("\e[0;31mError:\e[0m Pass " + pass + " broke the program: call of " + callee +
+                                         " with " + std::to_string(passed) + " arguments at line: " +
+                                         std::to_string(node->getLineNumber()));
+            }
+        }
+
+    private:
+        const std::unordered_map<std::string, size_t> &parameters;
+        const std::string &caller;
+        const std::string &pass;
+    };
+};
+
+#endif // PASS_MANAGER_HPP
@@ -0,0 +1,282 @@
+#ifndef PEEPHOLE_HPP
+#define PEEPHOLE_HPP
+
+#include <vector>
+#include <unordered_map>
+#include <utility>
+
+#include "instruction.hpp"
+#include "rewrite_rule.hpp"
+#include "rewrite_table.hpp"
+
+// Applies the rewrite table to a range of generated code and relinks it. A
+// pattern only matches windows with no jump target past their first
+// instruction and no SET of a return address; relative jumps and return
+// addresses are adjusted once the window shrinks.
+class Peephole
+{
+public:
+    static const long long SCRATCH_CELLS = 3; // accumulator and cells 1, 2
+
+    long long matches = 0;
+    long long removed = 0;
+
+    Peephole()
+    {
+        for (const auto &entry : REWRITE_TABLE)
+        {
+            rules.push_back(RewriteRule::parse(entry.pattern, entry.replacement, entry.dead));
+        }
+    }
+
+    // Rewrites code[from..], the code of one procedure, until no pattern
+    // matches. Temporaries dead after a pattern must be cells of the procedure's
+    // temporaries [first, end) that no other of its instructions uses; barriers
+    // are further instructions that must stay first in their window. Returns
+    // the new index of every old index from `from` to the end.
+    std::vector<long long> run(std::vector<Instruction> &code, long long from, std::vector<long long> &returnAddressSets,
+                               const std::vector<long long> &barriers, std::pair<long long, long long> temporaries)
+    {
+        std::vector<long long> moved(code.size() - from + 1);
+        for (size_t k = 0; k < moved.size(); k++)
+        {
+            moved[k] = from + k;
+        }
+
+        bool changed = true;
+        while (changed)
+        {
+            std::vector<long long> pass = rewrite(code, from, returnAddressSets, barriers, temporaries, changed);
+            for (auto &index : moved)
+            {
+                index = pass[index - from];
+            }
+        }
+        return moved;
+    }
+
+private:
+    std::vector<RewriteRule> rules;
+
+    // instructions of the procedure referring to a cell, and SETs of its address
+    std::unordered_map<long long, long long> references;
+    std::unordered_map<long long, long long> addressesTaken;
+
+    static bool has_memory_operand(Opcode op)
+    {
+        return has_operand(op) && op != Opcode::SET && !is_jump(op);
+    }
+
+    void count(const Instruction &inst, long long delta)
+    {
+        if (has_memory_operand(inst.op))
+        {
+            references[inst.arg] += delta;
+        }
+        else if (inst.op == Opcode::SET)
+        {
+            addressesTaken[inst.arg] += delta;
+        }
+    }
+
+    bool match(const RewriteRule &rule, const std::vector<Instruction> &code, long long at, long long end,
+               const std::vector<char> &barrier, long long from, std::pair<long long, long long> temporaries,
+               std::vector<Instruction> &replacement)
+    {
+        long long length = rule.pattern.size();
+        if (at + length > end)
+        {
+            return false;
+        }
+        std::vector<long long> values(rule.symbols.size());
+        std::vector<bool> bound(rule.symbols.size(), false);
+        for (long long k = 0; k < length; k++)
+        {
+            const Instruction &inst = code[at + k];
+            const RewriteStep &step = rule.pattern[k];
+            if (inst.op != step.op || (k > 0 && barrier[at + k - from]))
+            {
+                return false;
+            }
+            if (!has_operand(step.op))
+            {
+                continue;
+            }
+            if (step.arg.terms.empty())
+            {
+                if (inst.arg != step.arg.constant)
+                {
+                    return false;
+                }
+                continue;
+            }
+            int symbol = step.arg.terms[0].first;
+            if (bound[symbol] && values[symbol] != inst.arg)
+            {
+                return false;
+            }
+            bound[symbol] = true;
+            values[symbol] = inst.arg;
+        }
+
+        for (size_t s = 0; s < values.size(); s++)
+        {
+            if (rule.cellSymbol[s] && values[s] < SCRATCH_CELLS)
+            {
+                return false;
+            }
+        }
+        for (int dead : rule.deadSymbols)
+        {
+            long long cell = values[dead];
+            if (cell < temporaries.first || cell >= temporaries.second || addressesTaken[cell] > 0)
+            {
+                return false;
+            }
+            long long inside = 0;
+            for (long long k = 0; k < length; k++)
+            {
+                inside += has_memory_operand(code[at + k].op) && code[at + k].arg == cell;
+            }
+            if (references[cell] != inside)
+            {
+                return false;
+            }
+            for (size_t s = 0; s < values.size(); s++)
+            {
+                if ((int)s != dead && values[s] == cell)
+                {
+                    return false;
+                }
+            }
+        }
+
+        replacement.clear();
+        for (const auto &step : rule.replacement)
+        {
+            Instruction inst = {step.op, 0};
+            if (has_operand(step.op) && !RewriteRule::evaluate(step.arg, values, inst.arg))
+            {
+                return false;
+            }
+            if (has_memory_operand(step.op) && inst.arg < 0)
+            {
+                return false;
+            }
+            replacement.push_back(inst);
+        }
+        return true;
+    }
+
+    std::vector<long long> rewrite(std::vector<Instruction> &code, long long from, std::vector<long long> &returnAddressSets,
+                                   const std::vector<long long> &barriers, std::pair<long long, long long> temporaries, bool &changed)
+    {
+        long long end = code.size();
+        std::vector<char> barrier(end - from + 1, 0);
+        barrier[0] = 1;
+        for (long long k = from; k < end; k++)
+        {
+            if (is_jump(code[k].op) && k + code[k].arg >= from && k + code[k].arg <= end)
+            {
+                barrier[k + code[k].arg - from] = 1;
+            }
+        }
+        std::vector<char> returnSet(end - from, 0);
+        for (long long set : returnAddressSets)
+        {
+            if (set >= from)
+            {
+                barrier[set - from] = 1;
+                returnSet[set - from] = 1;
+                if (code[set].arg >= from && code[set].arg <= end)
+                {
+                    barrier[code[set].arg - from] = 1;
+                }
+            }
+        }
+        for (long long index : barriers)
+        {
+            if (index >= from && index <= end)
+            {
+                barrier[index - from] = 1;
+            }
+        }
+
+        references.clear();
+        addressesTaken.clear();
+        for (long long k = from; k < end; k++)
+        {
+            count(code[k], 1);
+        }
+
+        std::vector<Instruction> out;
+        std::vector<long long> moved(end - from + 1);
+        std::vector<Instruction> replacement;
+        changed = false;
+        for (long long k = from; k < end;)
+        {
+            const RewriteRule *applied = nullptr;
+            for (const auto &rule : rules)
+            {
+                if (!returnSet[k - from] && match(rule, code, k, end, barrier, from, temporaries, replacement))
+                {
+                    applied = &rule;
+                    break;
+                }
+            }
+            if (!applied)
+            {
+                moved[k - from] = from + out.size();
+                out.push_back(code[k]);
+                k++;
+                continue;
+            }
+
+            long long length = applied->pattern.size();
+            for (long long i = 0; i < length; i++)
+            {
+                moved[k + i - from] = from + out.size();
+                count(code[k + i], -1);
+            }
+            for (const auto &inst : replacement)
+            {
+                count(inst, 1);
+                out.push_back(inst);
+            }
+            matches++;
+            removed += length - replacement.size();
+            changed = true;
+            k += length;
+        }
+        moved[end - from] = from + out.size();
+
+        // relink: jumps were never part of a window, so they were copied as is
+        for (long long k = from; k < end; k++)
+        {
+            if (is_jump(code[k].op))
+            {
+                long long target = k + code[k].arg;
+                long long newTarget = target >= from ? moved[target - from] : target;
+                out[moved[k - from] - from].arg = newTarget - moved[k - from];
+            }
+        }
+        for (auto &set : returnAddressSets)
+        {
+            if (set >= from)
+            {
+                set = moved[set - from];
+                Instruction &inst = out[set - from];
+                if (inst.arg >= from)
+                {
+                    inst.arg = moved[inst.arg - from];
+                }
+            }
+        }
+
+        code.resize(from);
+        code.insert(code.end(), out.begin(), out.end());
+        return moved;
+    }
+};
+
+#endif // PEEPHOLE_HPP
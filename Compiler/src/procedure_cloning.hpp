@@ -0,0 +1,847 @@
+#ifndef PROCEDURE_CLONING_HPP
+#define PROCEDURE_CLONING_HPP
+
+#include <cctype>
+#include <climits>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "ast.hpp"
+#include "ast_visitor.hpp"
+#include "interpreter.hpp"
+#include "loop_info.hpp"
+#include "mod_ref.hpp"
+#include "parse_context.hpp"
+
+// Specializes procedures for the constants their calls pass. When a scalar
+// argument holds a known constant at a call and the parameter it is bound to
+// is written neither by the procedure nor by anything it calls, under its own
+// name or that of another parameter bound to the same variable, the call goes
+// to a clone of the procedure with the parameter replaced by the constant.
+// Constants are then propagated through the clone: assignments of constant
+// expressions are folded into later uses, IFs and WHILEs with a constant
+// condition are resolved and FOR bounds become literals, so the code generator
+// unrolls loops and multiplies by constants as it would inline. Calls passing
+// the same constants share a clone, a constant parameter the clone no longer
+// mentions is not passed at all, and a clone left without calls is dropped.
+// An original left without calls is marked unused rather than dropped: the
+// code generator still checks it, so errors in code the clones folded away
+// are reported as without cloning. Clones are named <procedure>#<n> and
+// declared right after their original; source_names() turns these names back
+// into the original's in messages. The cloned code is limited to budget
+// estimated instructions.
+class ProcedureCloning
+{
+public:
+    long long budget = 2048;
+    long long cloned = 0;      // clones created
+    long long specialized = 0; // calls redirected to a clone
+    long long removed = 0;     // originals left without calls
+
+    explicit ProcedureCloning(ParseContext *context) : context(context) {}
+
+    // A message with the names of clones replaced by those of their originals.
+    static std::string source_names(const std::string &message)
+    {
+        std::string result;
+        for (size_t k = 0; k < message.size(); k++)
+        {
+            if (message[k] == '#' && k + 1 < message.size() && isdigit((unsigned char)message[k + 1]))
+            {
+                while (k + 1 < message.size() && isdigit((unsigned char)message[k + 1]))
+                {
+                    k++;
+                }
+                continue;
+            }
+            result += message[k];
+        }
+        return result;
+    }
+
+    void run(ProgramNode *root)
+    {
+        if (!root->procedures)
+        {
+            return;
+        }
+        this->root = root;
+        ModRefSummary summary;
+        summary.analyze(root);
+        for (const auto &proc : root->procedures->procedures)
+        {
+            std::string name = *proc->arguments->procedureName;
+            procedures[name] = proc;
+            for (const auto &access : summary.parameters[name])
+            {
+                written[name].push_back(access.written);
+            }
+        }
+        CallCounter before(root);
+
+        std::vector<ProcedureNode *> originals = root->procedures->procedures;
+        for (const auto &proc : originals)
+        {
+            Scope scope;
+            for (const auto &param : parameter_names(proc))
+            {
+                scope.parameters.insert(param);
+            }
+            Constants known;
+            propagate(proc->commands, known, scope);
+        }
+        if (root->main)
+        {
+            Constants known;
+            propagate(root->main->commands, known, Scope());
+        }
+        remove_unused(before.calls);
+    }
+
+private:
+    typedef std::unordered_map<std::string, long long> Constants;
+
+    // Parameters of the procedure being walked and whether its commands are
+    // rewritten (clones) or only followed to find constant arguments.
+    struct Scope
+    {
+        std::unordered_set<std::string> parameters;
+        bool substitute = false;
+    };
+
+    // Calls of every procedure.
+    class CallCounter : public AstVisitor
+    {
+    public:
+        std::unordered_map<std::string, long long> calls;
+        long long delta = 1;
+
+        CallCounter() = default;
+
+        explicit CallCounter(ProgramNode *root)
+        {
+            visit(root);
+        }
+
+        void visit_procedure_call(ProcedureCallNode *node) override
+        {
+            calls[*node->procedureName] += delta;
+        }
+    };
+
+    // Scalars a command may change: targets of assignments and READs,
+    // iterators, and arguments bound to parameters that may be written.
+    class WrittenNames : public AstVisitor
+    {
+    public:
+        std::unordered_set<std::string> names;
+
+        explicit WrittenNames(const std::unordered_map<std::string, std::vector<bool>> &written) : written(written) {}
+
+        void visit_assign(AssignNode *node) override
+        {
+            add(node->identifier);
+        }
+
+        void visit_read(ReadNode *node) override
+        {
+            add(node->identifier);
+        }
+
+        void visit_for_to(ForToNode *node) override
+        {
+            names.insert(node->pidentifier->getName());
+            visit(node->commands);
+        }
+
+        void visit_for_downto(ForDownToNode *node) override
+        {
+            names.insert(node->pidentifier->getName());
+            visit(node->commands);
+        }
+
+        void visit_procedure_call(ProcedureCallNode *node) override
+        {
+            if (!node->arguments)
+            {
+                return;
+            }
+            auto it = written.find(*node->procedureName);
+            const auto &args = node->arguments->arguments;
+            for (size_t i = 0; i < args.size(); i++)
+            {
+                if (it == written.end() || i >= it->second.size() || it->second[i])
+                {
+                    names.insert(args[i]->getName());
+                }
+            }
+        }
+
+    private:
+        const std::unordered_map<std::string, std::vector<bool>> &written;
+
+        void add(IdentifierNode *target)
+        {
+            if (!target->isElement)
+            {
+                names.insert(target->getName());
+            }
+        }
+    };
+
+    // Every name a body mentions.
+    class UsedNames : public AstVisitor
+    {
+    public:
+        std::unordered_set<std::string> names;
+
+        void visit_identifier(IdentifierNode *node) override
+        {
+            names.insert(node->getName());
+            visit(node->index_var);
+        }
+    };
+
+    ParseContext *context; // owns the names of the clones
+    ProgramNode *root = nullptr;
+    std::unordered_map<std::string, ProcedureNode *> procedures;
+    std::unordered_map<std::string, std::vector<bool>> written;  // per parameter: may be written
+    std::unordered_map<std::string, std::vector<bool>> omitted;  // per parameter of a clone: no longer passed
+    std::unordered_map<std::string, std::string> clones;         // procedure and constants -> clone
+    std::unordered_map<std::string, long long> cloneNumbers;
+    std::unordered_set<std::string> cloneNames;
+    long long used = 0;
+
+    static std::vector<std::string> parameter_names(const ProcedureNode *proc)
+    {
+        std::vector<std::string> names;
+        if (proc->arguments->arguments)
+        {
+            for (const auto &arg : proc->arguments->arguments->arguments)
+            {
+                names.push_back(*arg->argumentName);
+            }
+        }
+        return names;
+    }
+
+    // Parameters may share their variable with another one, so only locals
+    // and the constant parameters of a clone are followed.
+    static bool tracked(const std::string &name, const Scope &scope, const Constants &known)
+    {
+        return !scope.parameters.count(name) || (scope.substitute && known.count(name));
+    }
+
+    static bool value_of(const ValueNode *value, const Constants &known, long long &result)
+    {
+        if (!value->identifier)
+        {
+            result = value->value;
+            return true;
+        }
+        if (value->identifier->isElement)
+        {
+            return false;
+        }
+        auto it = known.find(value->identifier->getName());
+        if (it == known.end())
+        {
+            return false;
+        }
+        result = it->second;
+        return true;
+    }
+
+    // Folds an expression with the generated code's arithmetic, giving up
+    // where it would overflow.
+    static bool evaluate(const ExpressionNode *expression, const Constants &known, long long &result)
+    {
+        if (expression->kind == NodeKind::Value)
+        {
+            return value_of(static_cast<const ValueNode *>(expression), known, result);
+        }
+        if (expression->kind != NodeKind::BinaryExpression)
+        {
+            return false;
+        }
+        const BinaryExpressionNode *binary = static_cast<const BinaryExpressionNode *>(expression);
+        long long a, b;
+        if (!value_of(binary->left, known, a) || !value_of(binary->right, known, b))
+        {
+            return false;
+        }
+        char op = binary->op[0];
+        if ((op == '+' && __builtin_add_overflow(a, b, &result)) || (op == '-' && __builtin_sub_overflow(a, b, &result)) ||
+            (op == '*' && __builtin_mul_overflow(a, b, &result)) || (op == '/' && a == LLONG_MIN && b == -1))
+        {
+            return false;
+        }
+        result = Interpreter::apply(op, a, b);
+        return true;
+    }
+
+    static bool decide(const ConditionNode *condition, bool &result)
+    {
+        long long a, b;
+        if (condition->left->identifier || condition->right->identifier)
+        {
+            return false;
+        }
+        a = condition->left->value;
+        b = condition->right->value;
+        const std::string &op = condition->op;
+        result = op == "=" ? a == b : op == "!=" ? a != b : op == "<" ? a < b : op == ">" ? a > b : op == "<=" ? a <= b : a >= b;
+        return true;
+    }
+
+    static void substitute(IdentifierNode *identifier, const Constants &known)
+    {
+        if (identifier->isElement && identifier->index_var)
+        {
+            auto it = known.find(identifier->index_var->getName());
+            if (it != known.end())
+            {
+                delete identifier->index_var;
+                identifier->index_var = nullptr;
+                identifier->index_const = it->second;
+            }
+        }
+    }
+
+    static void substitute(ValueNode *value, const Constants &known)
+    {
+        if (!value->identifier)
+        {
+            return;
+        }
+        long long constant;
+        if (value_of(value, known, constant))
+        {
+            delete value->identifier;
+            value->identifier = nullptr;
+            value->value = constant;
+            return;
+        }
+        substitute(value->identifier, known);
+    }
+
+    static void substitute(ExpressionNode *expression, const Constants &known)
+    {
+        if (expression->kind == NodeKind::Value)
+        {
+            substitute(static_cast<ValueNode *>(expression), known);
+        }
+        else if (expression->kind == NodeKind::BinaryExpression)
+        {
+            substitute(static_cast<BinaryExpressionNode *>(expression)->left, known);
+            substitute(static_cast<BinaryExpressionNode *>(expression)->right, known);
+        }
+    }
+
+    static void substitute(ConditionNode *condition, const Constants &known)
+    {
+        substitute(condition->left, known);
+        substitute(condition->right, known);
+    }
+
+    void forget_written(CommandsNode *commands, Constants &known)
+    {
+        WrittenNames names(written);
+        names.visit(commands);
+        for (const auto &name : names.names)
+        {
+            known.erase(name);
+        }
+    }
+
+    // Replaces commands[i] by the commands of arm, which it owned.
+    static void splice(std::vector<CommandNode *> &commands, size_t i, CommandsNode *arm)
+    {
+        std::vector<CommandNode *> taken;
+        if (arm)
+        {
+            taken.swap(arm->commands);
+        }
+        delete commands[i];
+        commands.erase(commands.begin() + i);
+        commands.insert(commands.begin() + i, taken.begin(), taken.end());
+    }
+
+    // Walks commands in order, keeping the scalars known to hold a constant,
+    // and specializes the calls passing some.
+    void propagate(CommandsNode *commands, Constants &known, const Scope &scope)
+    {
+        if (!commands)
+        {
+            return;
+        }
+        std::vector<CommandNode *> &list = commands->commands;
+        size_t i = 0;
+        while (i < list.size())
+        {
+            CommandNode *cmd = list[i];
+            switch (cmd->kind)
+            {
+            case NodeKind::Assign:
+            {
+                AssignNode *assign = static_cast<AssignNode *>(cmd);
+                if (scope.substitute)
+                {
+                    substitute(assign->expression, known);
+                    substitute(assign->identifier, known);
+                }
+                if (!assign->identifier->isElement)
+                {
+                    std::string name = assign->identifier->getName();
+                    long long value;
+                    if (tracked(name, scope, known) && evaluate(assign->expression, known, value))
+                    {
+                        known[name] = value;
+                    }
+                    else
+                    {
+                        known.erase(name);
+                    }
+                }
+                break;
+            }
+            case NodeKind::Read:
+            {
+                ReadNode *read = static_cast<ReadNode *>(cmd);
+                if (scope.substitute)
+                {
+                    substitute(read->identifier, known);
+                }
+                if (!read->identifier->isElement)
+                {
+                    known.erase(read->identifier->getName());
+                }
+                break;
+            }
+            case NodeKind::Write:
+                if (scope.substitute)
+                {
+                    substitute(static_cast<WriteNode *>(cmd)->node, known);
+                }
+                break;
+            case NodeKind::If:
+            {
+                IfNode *ifNode = static_cast<IfNode *>(cmd);
+                bool taken;
+                if (scope.substitute)
+                {
+                    substitute(ifNode->condition, known);
+                    if (decide(ifNode->condition, taken))
+                    {
+                        splice(list, i, taken ? ifNode->thenCommands : ifNode->elseCommands);
+                        continue;
+                    }
+                }
+                Constants otherwise = known;
+                propagate(ifNode->thenCommands, known, scope);
+                propagate(ifNode->elseCommands, otherwise, scope);
+                for (auto it = known.begin(); it != known.end();)
+                {
+                    auto other = otherwise.find(it->first);
+                    it = other == otherwise.end() || other->second != it->second ? known.erase(it) : ++it;
+                }
+                break;
+            }
+            case NodeKind::While:
+            {
+                WhileNode *whileNode = static_cast<WhileNode *>(cmd);
+                forget_written(whileNode->commands, known);
+                bool taken;
+                if (scope.substitute)
+                {
+                    substitute(whileNode->condition, known);
+                    if (decide(whileNode->condition, taken) && !taken)
+                    {
+                        splice(list, i, nullptr);
+                        continue;
+                    }
+                }
+                Constants inside = known;
+                propagate(whileNode->commands, inside, scope);
+                break;
+            }
+            case NodeKind::RepeatUntil:
+            {
+                RepeatUntilNode *repeat = static_cast<RepeatUntilNode *>(cmd);
+                forget_written(repeat->commands, known);
+                if (scope.substitute)
+                {
+                    substitute(repeat->condition, known);
+                }
+                Constants inside = known;
+                propagate(repeat->commands, inside, scope);
+                break;
+            }
+            case NodeKind::ForTo:
+            case NodeKind::ForDownTo:
+            {
+                ValueNode *from, *to;
+                CommandsNode *body;
+                std::string iterator;
+                if (cmd->kind == NodeKind::ForTo)
+                {
+                    ForToNode *forTo = static_cast<ForToNode *>(cmd);
+                    from = forTo->fromValue, to = forTo->toValue, body = forTo->commands;
+                    iterator = forTo->pidentifier->getName();
+                }
+                else
+                {
+                    ForDownToNode *forDownTo = static_cast<ForDownToNode *>(cmd);
+                    from = forDownTo->fromValue, to = forDownTo->toValue, body = forDownTo->commands;
+                    iterator = forDownTo->pidentifier->getName();
+                }
+                if (scope.substitute)
+                {
+                    substitute(from, known);
+                    substitute(to, known);
+                }
+                forget_written(body, known);
+                known.erase(iterator);
+                Constants inside = known;
+                propagate(body, inside, scope);
+                break;
+            }
+            case NodeKind::ProcedureCall:
+            {
+                ProcedureCallNode *call = static_cast<ProcedureCallNode *>(cmd);
+                specialize(call, known);
+                WrittenNames names(written);
+                names.visit(call);
+                for (const auto &name : names.names)
+                {
+                    known.erase(name);
+                }
+                break;
+            }
+            default:
+                break;
+            }
+            i++;
+        }
+    }
+
+    void specialize(ProcedureCallNode *call, const Constants &known)
+    {
+        auto callee = procedures.find(*call->procedureName);
+        if (callee == procedures.end() || !call->arguments)
+        {
+            return;
+        }
+        std::vector<IdentifierNode *> &args = call->arguments->arguments;
+        const std::vector<bool> &mayWrite = written[callee->first];
+        std::vector<std::string> params = parameter_names(callee->second);
+        if (args.size() != params.size() || mayWrite.size() != params.size())
+        {
+            return; // reported by the code generator
+        }
+
+        Constants constants;
+        std::string key = callee->first + "(";
+        for (size_t i = 0; i < args.size(); i++)
+        {
+            auto it = known.find(args[i]->getName());
+            bool constant = it != known.end() && !mayWrite[i];
+            for (size_t j = 0; j < args.size() && constant; j++)
+            {
+                constant = args[j]->getName() != args[i]->getName() || !mayWrite[j];
+            }
+            if (constant)
+            {
+                constants[params[i]] = it->second;
+                key += std::to_string(it->second);
+            }
+            key += i + 1 < args.size() ? "," : ")";
+        }
+        if (constants.empty())
+        {
+            return;
+        }
+
+        auto clone = clones.find(key);
+        if (clone == clones.end())
+        {
+            std::string name = create_clone(callee->second, constants);
+            if (name.empty())
+            {
+                return;
+            }
+            clone = clones.insert({key, name}).first;
+        }
+        const std::vector<bool> &omit = omitted[clone->second];
+        for (size_t i = args.size(); i-- > 0;)
+        {
+            if (omit[i])
+            {
+                delete args[i];
+                args.erase(args.begin() + i);
+            }
+        }
+        call->procedureName = procedures[clone->second]->arguments->procedureName;
+        specialized++;
+    }
+
+    // Returns the name of the clone, or "" when it does not fit the budget.
+    std::string create_clone(ProcedureNode *original, const Constants &constants)
+    {
+        long long size = LoopInfo("", original->commands).size;
+        if (used + size > budget)
+        {
+            return "";
+        }
+        used += size;
+        std::string originalName = *original->arguments->procedureName;
+        std::string name = originalName + "#" + std::to_string(++cloneNumbers[originalName]);
+
+        ProcedureNode *clone = copy(original);
+        clone->arguments->procedureName = context->intern(name.c_str(), name.size());
+        Scope scope;
+        scope.substitute = true;
+        for (const auto &param : parameter_names(clone))
+        {
+            scope.parameters.insert(param);
+        }
+        Constants known = constants;
+        propagate(clone->commands, known, scope);
+
+        UsedNames uses;
+        uses.visit(clone->commands);
+        std::vector<ArgumentNode *> &params = clone->arguments->arguments->arguments;
+        std::vector<bool> omit(params.size(), false);
+        std::vector<bool> mayWrite;
+        for (size_t i = 0; i < params.size(); i++)
+        {
+            omit[i] = constants.count(*params[i]->argumentName) && !uses.names.count(*params[i]->argumentName);
+            if (!omit[i])
+            {
+                mayWrite.push_back(written[originalName][i]);
+            }
+        }
+        for (size_t i = params.size(); i-- > 0;)
+        {
+            if (omit[i])
+            {
+                delete params[i];
+                params.erase(params.begin() + i);
+            }
+        }
+        written[name] = mayWrite;
+        omitted[name] = omit;
+        procedures[name] = clone;
+        cloneNames.insert(name);
+
+        auto &list = root->procedures->procedures;
+        for (size_t k = 0; k < list.size(); k++)
+        {
+            if (list[k] == original)
+            {
+                list.insert(list.begin() + k + 1, clone);
+                break;
+            }
+        }
+        cloned++;
+        return name;
+    }
+
+    // Drops the clones and marks unused the originals that were called before
+    // cloning but are no longer called, except from other unused ones;
+    // callers follow their callees, so one backward pass sees them all.
+    void remove_unused(const std::unordered_map<std::string, long long> &before)
+    {
+        CallCounter after(root);
+        auto &list = root->procedures->procedures;
+        for (size_t k = list.size(); k-- > 0;)
+        {
+            std::string name = *list[k]->arguments->procedureName;
+            auto it = before.find(name);
+            bool wasCalled = (it != before.end() && it->second > 0) || cloneNames.count(name);
+            if (!wasCalled || after.calls[name] > 0)
+            {
+                continue;
+            }
+            CallCounter inside;
+            inside.delta = -1;
+            inside.calls.swap(after.calls);
+            inside.visit(list[k]->commands);
+            inside.calls.swap(after.calls);
+            if (cloneNames.count(name))
+            {
+                delete list[k];
+                list.erase(list.begin() + k);
+                cloned--;
+            }
+            else
+            {
+                list[k]->unused = true;
+                removed++;
+            }
+        }
+    }
+
+    // Deep copies; names are interned, so they are shared.
+    static IdentifierNode *copy(const IdentifierNode *node)
+    {
+        if (!node)
+        {
+            return nullptr;
+        }
+        IdentifierNode *result = new IdentifierNode(node->name);
+        result->index_var = copy(node->index_var);
+        result->index_const = node->index_const;
+        result->start = node->start;
+        result->end = node->end;
+        result->isArray = node->isArray;
+        result->isElement = node->isElement;
+        result->setLineNumber(node->getLineNumber());
+        return result;
+    }
+
+    static ValueNode *copy(const ValueNode *node)
+    {
+        ValueNode *result = node->identifier ? new ValueNode(copy(node->identifier)) : new ValueNode(node->value);
+        result->setLineNumber(node->getLineNumber());
+        return result;
+    }
+
+    static ExpressionNode *copy(const ExpressionNode *node)
+    {
+        if (node->kind == NodeKind::BinaryExpression)
+        {
+            const BinaryExpressionNode *binary = static_cast<const BinaryExpressionNode *>(node);
+            ExpressionNode *result = new BinaryExpressionNode(copy(binary->left), binary->op, copy(binary->right));
+            result->setLineNumber(node->getLineNumber());
+            return result;
+        }
+        return copy(static_cast<const ValueNode *>(node));
+    }
+
+    static ConditionNode *copy(const ConditionNode *node)
+    {
+        ConditionNode *result = new ConditionNode(copy(node->left), node->op, copy(node->right));
+        result->setLineNumber(node->getLineNumber());
+        return result;
+    }
+
+    static CommandsNode *copy(const CommandsNode *node)
+    {
+        if (!node)
+        {
+            return nullptr;
+        }
+        CommandsNode *result = new CommandsNode();
+        for (const auto &cmd : node->commands)
+        {
+            result->addCommand(copy(cmd));
+        }
+        result->setLineNumber(node->getLineNumber());
+        return result;
+    }
+
+    static CommandNode *copy(const CommandNode *node)
+    {
+        CommandNode *result = nullptr;
+        switch (node->kind)
+        {
+        case NodeKind::Assign:
+        {
+            const AssignNode *assign = static_cast<const AssignNode *>(node);
+            result = new AssignNode(copy(assign->identifier), copy(assign->expression), assign->ignore);
+            break;
+        }
+        case NodeKind::If:
+        {
+            const IfNode *ifNode = static_cast<const IfNode *>(node);
+            result = new IfNode(copy(ifNode->condition), copy(ifNode->thenCommands), copy(ifNode->elseCommands));
+            break;
+        }
+        case NodeKind::While:
+        {
+            const WhileNode *whileNode = static_cast<const WhileNode *>(node);
+            result = new WhileNode(copy(whileNode->condition), copy(whileNode->commands));
+            break;
+        }
+        case NodeKind::RepeatUntil:
+        {
+            const RepeatUntilNode *repeat = static_cast<const RepeatUntilNode *>(node);
+            result = new RepeatUntilNode(copy(repeat->condition), copy(repeat->commands));
+            break;
+        }
+        case NodeKind::ForTo:
+        {
+            const ForToNode *forTo = static_cast<const ForToNode *>(node);
+            result = new ForToNode(forTo->pidentifier->name, copy(forTo->fromValue), copy(forTo->toValue), copy(forTo->commands));
+            break;
+        }
+        case NodeKind::ForDownTo:
+        {
+            const ForDownToNode *forDownTo = static_cast<const ForDownToNode *>(node);
+            result = new ForDownToNode(forDownTo->pidentifier->name, copy(forDownTo->fromValue), copy(forDownTo->toValue),
+                                       copy(forDownTo->commands));
+            break;
+        }
+        case NodeKind::ProcedureCall:
+        {
+            const ProcedureCallNode *call = static_cast<const ProcedureCallNode *>(node);
+            ProcedureCallArguments *args = nullptr;
+            if (call->arguments)
+            {
+                args = new ProcedureCallArguments();
+                for (const auto &arg : call->arguments->arguments)
+                {
+                    args->arguments.push_back(copy(arg));
+                }
+            }
+            result = new ProcedureCallNode(call->procedureName, args);
+            break;
+        }
+        case NodeKind::Write:
+            result = new WriteNode(copy(static_cast<const WriteNode *>(node)->node));
+            break;
+        case NodeKind::Read:
+            result = new ReadNode(copy(static_cast<const ReadNode *>(node)->identifier));
+            break;
+        default:
+            break;
+        }
+        result->setLineNumber(node->getLineNumber());
+        return result;
+    }
+
+    static ProcedureNode *copy(const ProcedureNode *node)
+    {
+        ArgumentsDeclarationNode *params = nullptr;
+        if (node->arguments->arguments)
+        {
+            params = new ArgumentsDeclarationNode();
+            for (const auto &arg : node->arguments->arguments->arguments)
+            {
+                ArgumentNode *param = new ArgumentNode(arg->argumentName, arg->isArray);
+                param->setLineNumber(arg->getLineNumber());
+                params->arguments.push_back(param);
+            }
+        }
+        ProcedureHeadNode *head = new ProcedureHeadNode(node->arguments->procedureName, params);
+        head->setLineNumber(node->arguments->getLineNumber());
+        DeclarationsNode *declarations = nullptr;
+        if (node->declarations)
+        {
+            declarations = new DeclarationsNode();
+            for (const auto &decl : node->declarations->declarations)
+            {
+                declarations->declarations.push_back(copy(decl));
+            }
+            declarations->setLineNumber(node->declarations->getLineNumber());
+        }
+        ProcedureNode *result = new ProcedureNode(head, declarations, copy(node->commands));
+        result->setLineNumber(node->getLineNumber());
+        return result;
+    }
+};
+
+#endif // PROCEDURE_CLONING_HPP
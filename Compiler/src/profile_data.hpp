@@ -0,0 +1,193 @@
+#ifndef PROFILE_DATA_HPP
+#define PROFILE_DATA_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <utility>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include "ast.hpp"
+#include "ast_visitor.hpp"
+
+// Numbers every command of the program in source order. The numbers key the
+// profile, so they only depend on the source and not on the generated layout.
+class NodeNumbering : public AstVisitor
+{
+public:
+    std::unordered_map<const AstNode *, int> ids;
+
+    void visit_commands(CommandsNode *node) override
+    {
+        for (const auto &cmd : node->commands)
+        {
+            int id = ids.size() + 1;
+            ids[cmd] = id;
+            visit(cmd);
+        }
+    }
+};
+
+// One counter of a command, read off the execution count of the instruction
+// at index. Counters used by the code generator:
+//   if:     "test" (condition evaluated), "then" (then arm entered)
+//   while:  "test" (condition evaluated), "body" (loop body entered)
+//   for:    as while, and "remainder-test" and "remainder-body" for the
+//           remainder loop of partial unrolling; "entries" (loop entered) and
+//           "iterations" (body run, whatever the unrolling)
+//   assign: "runs" (assignment of a product, quotient or remainder run)
+// Counters of a command generated more than once add up.
+struct BlockCounter
+{
+    int node;
+    std::string counter;
+    long long index;
+};
+
+// Execution counts per command and counter, summed over profiling runs.
+class ProfileData
+{
+public:
+    std::map<std::pair<int, std::string>, long long> counts;
+
+    void add(int node, const std::string &counter, long long count)
+    {
+        counts[{node, counter}] += count;
+    }
+
+    // -1 when the profile has no such counter.
+    long long get(int node, const std::string &counter) const
+    {
+        auto it = counts.find({node, counter});
+        return it == counts.end() ? -1 : it->second;
+    }
+
+    void write(const std::string &fileName) const
+    {
+        std::ofstream out(fileName);
+        out << "# node counter count\n";
+        for (const auto &entry : counts)
+        {
+            out << entry.first.first << " " << entry.first.second << " " << entry.second << "\n";
+        }
+        if (!out)
+        {
+            throw std::runtime_error("Could not write profile " + fileName);
+        }
+    }
+
+    // Without mustExist a missing file reads as an empty profile.
+    static ProfileData read(const std::string &fileName, bool mustExist = true)
+    {
+        ProfileData profile;
+        std::ifstream in(fileName);
+        if (!in)
+        {
+            if (mustExist)
+            {
+                throw std::runtime_error("Could not open profile " + fileName);
+            }
+            return profile;
+        }
+        std::string line;
+        int lineNumber = 0;
+        while (std::getline(in, line))
+        {
+            lineNumber++;
+            if (line.empty() || line[0] == '#')
+            {
+                continue;
+            }
+            std::istringstream fields(line);
+            int node;
+            std::string counter;
+            long long count;
+            if (!(fields >> node >> counter >> count))
+            {
+                throw std::runtime_error("Malformed profile " + fileName + " at line: " + std::to_string(lineNumber));
+            }
+            profile.add(node, counter, count);
+        }
+        return profile;
+    }
+};
+
+// Where the counters of a program compiled with -fprofile-generate are read
+// off (output.mr.blocks), one "<node> <counter> <instruction>" per line.
+class BlockMap
+{
+public:
+    std::vector<BlockCounter> counters;
+
+    void write(const std::string &fileName) const
+    {
+        std::ofstream out(fileName);
+        out << "# node counter instruction\n";
+        for (const auto &block : counters)
+        {
+            out << block.node << " " << block.counter << " " << block.index << "\n";
+        }
+        if (!out)
+        {
+            throw std::runtime_error("Could not write block map " + fileName);
+        }
+    }
+
+    static BlockMap read(const std::string &fileName)
+    {
+        std::ifstream in(fileName);
+        if (!in)
+        {
+            throw std::runtime_error("Could not open block map " + fileName);
+        }
+        BlockMap map;
+        std::string line;
+        int lineNumber = 0;
+        while (std::getline(in, line))
+        {
+            lineNumber++;
+            if (line.empty() || line[0] == '#')
+            {
+                continue;
+            }
+            std::istringstream fields(line);
+            BlockCounter block;
+            if (!(fields >> block.node >> block.counter >> block.index))
+            {
+                throw std::runtime_error("Malformed block map " + fileName + " at line: " + std::to_string(lineNumber));
+            }
+            map.counters.push_back(block);
+        }
+        return map;
+    }
+
+    // See DebugMap::remap.
+    void remap(long long from, const std::vector<long long> &moved)
+    {
+        for (auto &block : counters)
+        {
+            if (block.index >= from)
+            {
+                block.index = moved[block.index - from];
+            }
+        }
+    }
+
+    // Adds the execution counts of one run to the profile.
+    void collect(const std::vector<long long> &executed, ProfileData &profile) const
+    {
+        for (const auto &block : counters)
+        {
+            if (block.index < 0 || block.index >= (long long)executed.size())
+            {
+                throw std::runtime_error("Block map does not match the program");
+            }
+            profile.add(block.node, block.counter, executed[block.index]);
+        }
+    }
+};
+
+#endif // PROFILE_DATA_HPP
@@ -0,0 +1,106 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdio>
+
+#include "instruction.hpp"
+#include "machine.hpp"
+#include "debug_map.hpp"
+
+// Runs a program on the local machine, counting executions per instruction,
+// and attributes the executed cost to source lines and procedures through the
+// debug map written with -g.
+class Profiler
+{
+public:
+    Profiler(const std::vector<Instruction> &program, const DebugMap &debugMap)
+        : program(program), debugMap(debugMap), machine(program, true)
+    {
+    }
+
+    void run(std::istream &in, std::ostream &out)
+    {
+        machine.run(in, out);
+    }
+
+    void report(const std::string &sourceFile, std::ostream &out)
+    {
+        std::map<int, long long> lineCost;
+        std::map<int, long long> lineHits;
+        std::map<std::string, long long> procedureCost;
+
+        for (size_t k = 0; k < program.size(); k++)
+        {
+            long long runs = machine.executed[k];
+            if (runs == 0)
+            {
+                continue;
+            }
+            long long cost = runs * instruction_cost(program[k].op);
+            const DebugEntry *entry = debugMap.find(k);
+            int line = entry ? entry->line : 0;
+            std::string procedure = entry ? (entry->procedure.empty() ? "PROGRAM" : entry->procedure) : "?";
+            lineCost[line] += cost;
+            lineHits[line] = std::max(lineHits[line], runs);
+            procedureCost[procedure] += cost;
+        }
+
+        char text[128];
+        std::snprintf(text, sizeof(text), "Total cost: %lld in %lld steps\n\n", machine.cost, machine.steps);
+        out << text;
+
+        out << "Cost per procedure:\n";
+        for (const auto &procedure : procedureCost)
+        {
+            std::snprintf(text, sizeof(text), "  %-24s %14lld %6.1f%%\n", procedure.first.c_str(), procedure.second,
+                          share(procedure.second));
+            out << text;
+        }
+
+        out << "\nCost per source line (hits: executions of the line's most executed instruction):\n";
+        std::snprintf(text, sizeof(text), "%14s %7s %12s %6s\n", "cost", "%", "hits", "line");
+        out << text;
+
+        std::ifstream source(sourceFile);
+        std::string sourceLine;
+        int lineNumber = 0;
+        while (std::getline(source, sourceLine))
+        {
+            lineNumber++;
+            auto it = lineCost.find(lineNumber);
+            if (it != lineCost.end())
+            {
+                std::snprintf(text, sizeof(text), "%14lld %6.1f%% %12lld %6d | ", it->second, share(it->second),
+                              lineHits[lineNumber], lineNumber);
+            }
+            else
+            {
+                std::snprintf(text, sizeof(text), "%14s %7s %12s %6d | ", "", "", "", lineNumber);
+            }
+            out << text << sourceLine << "\n";
+        }
+        if (lineCost.count(0))
+        {
+            std::snprintf(text, sizeof(text), "%14lld %6.1f%% %12s %6s | (no source line)\n", lineCost[0],
+                          share(lineCost[0]), "", "");
+            out << text;
+        }
+    }
+
+private:
+    const std::vector<Instruction> &program;
+    const DebugMap &debugMap;
+    Machine machine;
+
+    double share(long long cost) const
+    {
+        return machine.cost ? 100.0 * cost / machine.cost : 0.0;
+    }
+};
+
+#endif // PROFILER_HPP
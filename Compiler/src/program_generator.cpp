@@ -0,0 +1,192 @@
+// Generator of synthetic programs for measuring how the compiler scales. Every
+// shape grows one dimension of the input and keeps the rest small:
+//
+//   g++ -std=c++11 -O2 -o program_generator src/program_generator.cpp
+//   ./program_generator <shape> <size> > program.imp
+//
+// The programs are valid and terminate, so the generated code can be run as
+// well; scalability.sh compiles them at growing sizes.
+
+#include <iostream>
+#include <string>
+#include <cstdlib>
+
+// Identifiers may only contain lowercase letters and underscores, so numbers
+// are written in base 26 after a prefix.
+static std::string name(const std::string &prefix, long long n)
+{
+    std::string digits;
+    do
+    {
+        digits.insert(digits.begin(), char('a' + n % 26));
+        n /= 26;
+    } while (n > 0);
+    return prefix + "_" + digits;
+}
+
+// A chain of procedures, each calling the one before it.
+static void procedures(std::ostream &out, long long size)
+{
+    for (long long k = 0; k < size; k++)
+    {
+        out << "PROCEDURE " << name("p", k) << "(a, b) IS\n"
+            << "  t\n"
+            << "BEGIN\n"
+            << "  t:=a+" << k % 7 + 1 << ";\n"
+            << "  b:=b+t;\n";
+        if (k > 0)
+        {
+            out << "  " << name("p", k - 1) << "(a, b);\n";
+        }
+        out << "END\n";
+    }
+    out << "PROGRAM IS\n"
+        << "  a, b\n"
+        << "BEGIN\n"
+        << "  READ a;\n"
+        << "  b:=0;\n";
+    if (size > 0)
+    {
+        out << "  " << name("p", size - 1) << "(a, b);\n";
+    }
+    out << "  WRITE b;\n"
+        << "END\n";
+}
+
+// Alternately nested IFs and WHILEs, each WHILE running once.
+static void nesting(std::ostream &out, long long size)
+{
+    out << "PROGRAM IS\n"
+        << "  a, b\n"
+        << "BEGIN\n"
+        << "  READ a;\n"
+        << "  b:=0;\n";
+    for (long long k = 0; k < size; k++)
+    {
+        if (k % 2 == 0)
+        {
+            out << "IF a>" << -k - 1 << " THEN\n";
+        }
+        else
+        {
+            out << "b:=1;\nWHILE b>0 DO\nb:=b-1;\n";
+        }
+    }
+    out << "a:=a+1;\n";
+    for (long long k = size - 1; k >= 0; k--)
+    {
+        out << (k % 2 == 0 ? "ENDIF\n" : "ENDWHILE\n");
+    }
+    out << "  WRITE a;\n"
+        << "END\n";
+}
+
+// Many variables declared in main, each assigned once.
+static void declarations(std::ostream &out, long long size)
+{
+    out << "PROGRAM IS\n"
+        << "  a";
+    for (long long k = 0; k < size; k++)
+    {
+        out << (k % 8 == 0 ? ",\n  " : ", ") << name("v", k);
+    }
+    out << "\nBEGIN\n"
+        << "  READ a;\n";
+    for (long long k = 0; k < size; k++)
+    {
+        out << "  " << name("v", k) << ":=" << (k == 0 ? "a" : name("v", k - 1)) << "+1;\n";
+    }
+    out << "  WRITE " << (size > 0 ? name("v", size - 1) : "a") << ";\n"
+        << "END\n";
+}
+
+// A long straight-line main body over a few variables and one array.
+static void statements(std::ostream &out, long long size)
+{
+    static const char *const ops[] = {"+", "-", "*", "/", "%"};
+    out << "PROGRAM IS\n"
+        << "  a, b, c, t[0:15]\n"
+        << "BEGIN\n"
+        << "  READ a;\n"
+        << "  b:=1;\n"
+        << "  c:=2;\n";
+    for (long long k = 0; k < size; k++)
+    {
+        switch (k % 4)
+        {
+        case 0:
+            out << "  b:=a" << ops[k / 4 % 5] << "c;\n";
+            break;
+        case 1:
+            out << "  t[" << k % 16 << "]:=b+" << k % 100 << ";\n";
+            break;
+        case 2:
+            out << "  c:=t[" << (k + 5) % 16 << "]-b;\n";
+            break;
+        default:
+            out << "  IF c>b THEN a:=c; ELSE a:=b; ENDIF\n";
+        }
+    }
+    out << "  WRITE a;\n"
+        << "END\n";
+}
+
+// Many calls to the same small procedure.
+static void calls(std::ostream &out, long long size)
+{
+    out << "PROCEDURE step(a, b) IS\n"
+        << "BEGIN\n"
+        << "  b:=b+a;\n"
+        << "END\n"
+        << "PROGRAM IS\n"
+        << "  a, b\n"
+        << "BEGIN\n"
+        << "  READ a;\n"
+        << "  b:=0;\n";
+    for (long long k = 0; k < size; k++)
+    {
+        out << "  step(a, b);\n";
+    }
+    out << "  WRITE b;\n"
+        << "END\n";
+}
+
+struct Shape
+{
+    const char *name;
+    void (*generate)(std::ostream &, long long);
+    const char *description;
+};
+
+static const Shape SHAPES[] = {
+    {"procedures", procedures, "<size> procedures, each calling the previous one"},
+    {"nesting", nesting, "IF and WHILE nested <size> deep"},
+    {"declarations", declarations, "<size> variables declared and assigned in main"},
+    {"statements", statements, "<size> straight-line commands in main"},
+    {"calls", calls, "<size> calls of one procedure"},
+};
+
+int main(int argc, char **argv)
+{
+    if (argc == 3)
+    {
+        char *end;
+        long long size = std::strtoll(argv[2], &end, 10);
+        for (const auto &shape : SHAPES)
+        {
+            if (*end == '\0' && size >= 0 && argv[1] == std::string(shape.name))
+            {
+                shape.generate(std::cout, size);
+                return 0;
+            }
+        }
+    }
+    std::cerr << "Usage: program_generator <shape> <size>\n"
+                 "Shapes:\n";
+    for (const auto &shape : SHAPES)
+    {
+        std::cerr << "  " << shape.name << std::string(14 - std::string(shape.name).size(), ' ') << shape.description
+                  << "\n";
+    }
+    return 1;
+}
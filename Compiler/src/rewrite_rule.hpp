@@ -0,0 +1,260 @@
+#ifndef REWRITE_RULE_HPP
+#define REWRITE_RULE_HPP
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <stdexcept>
+#include <cctype>
+
+#include "instruction.hpp"
+
+// One line of the rewrite table produced by the superoptimizer.
+struct RewriteTableEntry
+{
+    const char *pattern;
+    const char *replacement;
+    const char *dead; // temporaries and scratch cells not read after the pattern
+};
+
+// Operand of a rule: constant + sum of coefficient * symbol.
+struct RewriteOperand
+{
+    long long constant = 0;
+    std::vector<std::pair<int, long long>> terms; // symbol, coefficient
+
+    bool isSymbol() const
+    {
+        return constant == 0 && terms.size() == 1 && terms[0].second == 1;
+    }
+};
+
+struct RewriteStep
+{
+    Opcode op;
+    RewriteOperand arg;
+};
+
+// A pattern of instructions with symbolic operands and an equivalent, cheaper
+// replacement. Symbols are lower case names bound to the operands matched by
+// the pattern; the replacement may combine them ("SET b+k", "SET -c"). Dead
+// symbols name temporaries whose value is not used after the pattern, dead
+// numbers scratch cells the code generator always writes before reading.
+//
+// Symbols used as memory operands in the pattern, and SET operands written as
+// "&a", are bound only to addresses past the scratch cells.
+//
+// Text form: "SET c; STORE t; LOAD x; SUB t" -> "SET -c; ADD x", dead "t".
+class RewriteRule
+{
+public:
+    std::vector<RewriteStep> pattern;
+    std::vector<RewriteStep> replacement;
+    std::vector<std::string> symbols;
+    std::vector<bool> cellSymbol; // bound to an address past the scratch cells
+    std::vector<int> deadSymbols;
+    std::vector<long long> deadCells;
+
+    static RewriteRule parse(const std::string &pattern, const std::string &replacement, const std::string &dead)
+    {
+        RewriteRule rule;
+        rule.pattern = rule.parseSteps(pattern, true);
+        size_t bound = rule.symbols.size();
+        rule.replacement = rule.parseSteps(replacement, false);
+
+        std::istringstream fields(dead);
+        std::string name;
+        while (fields >> name)
+        {
+            if (std::isdigit((unsigned char)name[0]))
+            {
+                rule.deadCells.push_back(std::stoll(name));
+            }
+            else
+            {
+                rule.deadSymbols.push_back(rule.symbol(name, false));
+            }
+        }
+        if (rule.symbols.size() != bound)
+        {
+            throw std::runtime_error("Unbound symbol in rewrite rule: " + replacement + " / " + dead);
+        }
+        return rule;
+    }
+
+    static long long cost(const std::vector<RewriteStep> &steps)
+    {
+        long long total = 0;
+        for (const auto &step : steps)
+        {
+            total += instruction_cost(step.op);
+        }
+        return total;
+    }
+
+    // Value of an operand for the given symbol values; false on overflow.
+    static bool evaluate(const RewriteOperand &arg, const std::vector<long long> &values, long long &result)
+    {
+        long long sum = arg.constant;
+        for (const auto &term : arg.terms)
+        {
+            long long product;
+            if (__builtin_mul_overflow(values[term.first], term.second, &product) ||
+                __builtin_add_overflow(sum, product, &sum))
+            {
+                return false;
+            }
+        }
+        result = sum;
+        return true;
+    }
+
+    std::string format(const std::vector<RewriteStep> &steps) const
+    {
+        std::string text;
+        for (const auto &step : steps)
+        {
+            text += (text.empty() ? "" : "; ") + std::string(opcode_name(step.op));
+            if (has_operand(step.op))
+            {
+                text += " " + formatOperand(step.arg);
+            }
+        }
+        return text;
+    }
+
+    std::string formatOperand(const RewriteOperand &arg) const
+    {
+        std::string text;
+        for (const auto &term : arg.terms)
+        {
+            if (term.second < 0)
+            {
+                text += "-";
+            }
+            else if (!text.empty())
+            {
+                text += "+";
+            }
+            if (term.second != 1 && term.second != -1)
+            {
+                text += std::to_string(term.second < 0 ? -term.second : term.second) + "*";
+            }
+            text += symbols[term.first];
+        }
+        if (arg.constant != 0 || text.empty())
+        {
+            text += (arg.constant >= 0 && !text.empty() ? "+" : "") + std::to_string(arg.constant);
+        }
+        return text;
+    }
+
+    int symbol(const std::string &name, bool cell)
+    {
+        for (size_t i = 0; i < symbols.size(); i++)
+        {
+            if (symbols[i] == name)
+            {
+                cellSymbol[i] = cellSymbol[i] || cell;
+                return i;
+            }
+        }
+        symbols.push_back(name);
+        cellSymbol.push_back(cell);
+        return symbols.size() - 1;
+    }
+
+private:
+    std::vector<RewriteStep> parseSteps(const std::string &text, bool isPattern)
+    {
+        std::vector<RewriteStep> steps;
+        std::istringstream parts(text);
+        std::string part;
+        while (std::getline(parts, part, ';'))
+        {
+            std::istringstream fields(part);
+            std::string name, arg;
+            if (!(fields >> name))
+            {
+                continue;
+            }
+            RewriteStep step;
+            if (!parse_opcode(name, step.op) || is_jump(step.op) || step.op == Opcode::RTRN)
+            {
+                throw std::runtime_error("Bad instruction in rewrite rule: " + part);
+            }
+            if (has_operand(step.op))
+            {
+                if (!(fields >> arg))
+                {
+                    throw std::runtime_error("Missing operand in rewrite rule: " + part);
+                }
+                step.arg = parseOperand(arg, isPattern && step.op != Opcode::SET);
+                if (isPattern && !step.arg.isSymbol() && !step.arg.terms.empty())
+                {
+                    throw std::runtime_error("Patterns take a symbol or a number: " + part);
+                }
+            }
+            steps.push_back(step);
+        }
+        return steps;
+    }
+
+    RewriteOperand parseOperand(const std::string &text, bool cell)
+    {
+        RewriteOperand arg;
+        size_t i = 0;
+        if (text[0] == '&')
+        {
+            cell = true;
+            i++;
+        }
+        while (i < text.size())
+        {
+            long long sign = 1;
+            if (text[i] == '+' || text[i] == '-')
+            {
+                sign = text[i] == '-' ? -1 : 1;
+                i++;
+            }
+            size_t start = i;
+            if (i < text.size() && std::isdigit((unsigned char)text[i]))
+            {
+                while (i < text.size() && std::isdigit((unsigned char)text[i]))
+                {
+                    i++;
+                }
+                long long number = std::stoll(text.substr(start, i - start));
+                if (i < text.size() && text[i] == '*')
+                {
+                    i++;
+                    start = i;
+                    while (i < text.size() && std::isalpha((unsigned char)text[i]))
+                    {
+                        i++;
+                    }
+                    arg.terms.push_back({symbol(text.substr(start, i - start), cell), sign * number});
+                }
+                else
+                {
+                    arg.constant += sign * number;
+                }
+            }
+            else
+            {
+                while (i < text.size() && std::isalpha((unsigned char)text[i]))
+                {
+                    i++;
+                }
+                if (start == i)
+                {
+                    throw std::runtime_error("Bad operand in rewrite rule: " + text);
+                }
+                arg.terms.push_back({symbol(text.substr(start, i - start), cell), sign});
+            }
+        }
+        return arg;
+    }
+};
+
+#endif // REWRITE_RULE_HPP
@@ -0,0 +1,73 @@
+#ifndef REWRITE_TABLE_HPP
+#define REWRITE_TABLE_HPP
+
+// Generated by superoptimizer.cpp (./run.sh superopt), do not edit.
+// Every replacement is the cheapest sequence of at most 4 instructions over
+// the operands of its pattern that matched it on all tests.
+
+#include "rewrite_rule.hpp"
+
+static const RewriteTableEntry REWRITE_TABLE[] = {
+    // store followed by a load of the same variable: cost 20 -> 10
+    {"STORE x; LOAD x", "STORE x", ""},
+    // load followed by a store of the same variable: cost 20 -> 10
+    {"LOAD x; STORE x", "LOAD x", ""},
+    // the same constant stored twice: cost 110 -> 60
+    {"SET c; STORE x; SET c", "SET c; STORE x", ""},
+    // condition x ? 0: cost 80 -> 10
+    {"SET 0; STORE t; LOAD x; SUB t", "LOAD x", "t"},
+    // condition x ? 0, x a procedure argument: cost 90 -> 20
+    {"SET 0; STORE t; LOADI x; SUB t", "LOADI x", "t"},
+    // generate_substract x - constant: cost 80 -> 60
+    {"SET c; STORE t; LOAD x; SUB t", "SET -c; ADD x", "t"},
+    // generate_addition x + constant: cost 80 -> 60
+    {"SET c; STORE t; LOAD x; ADD t", "SET c; ADD x", "t"},
+    // generate_substract argument - constant: cost 90 -> 70
+    {"SET c; STORE t; LOADI x; SUB t", "SET -c; ADDI x", "t"},
+    // generate_addition argument + constant: cost 90 -> 70
+    {"SET c; STORE t; LOADI x; ADD t", "SET c; ADDI x", "t"},
+    // generate_substract constant - y: cost 80 -> 60
+    {"LOAD y; STORE t; SET c; SUB t", "SET c; SUB y", "t"},
+    // generate_addition constant + y: cost 80 -> 60
+    {"LOAD y; STORE t; SET c; ADD t", "SET c; ADD y", "t"},
+    // generate_substract constant - argument: cost 90 -> 70
+    {"LOADI y; STORE t; SET c; SUB t", "SET c; SUBI y", "t"},
+    // generate_addition constant + argument: cost 90 -> 70
+    {"LOADI y; STORE t; SET c; ADD t", "SET c; ADDI y", "t"},
+    // generate_substract of two constants: cost 120 -> 50
+    {"SET d; STORE t; SET c; SUB t", "SET c-d", "t"},
+    // generate_addition of two constants: cost 120 -> 50
+    {"SET d; STORE t; SET c; ADD t", "SET d+c", "t"},
+    // generate_substract x - y: cost 40 -> 20
+    {"LOAD y; STORE t; LOAD x; SUB t", "LOAD x; SUB y", "t"},
+    // generate_addition x + y: cost 40 -> 20
+    {"LOAD y; STORE t; LOAD x; ADD t", "LOAD y; ADD x", "t"},
+    // generate_substract x - argument: cost 50 -> 30
+    {"LOADI y; STORE t; LOAD x; SUB t", "LOAD x; SUBI y", "t"},
+    // generate_addition x + argument: cost 50 -> 30
+    {"LOADI y; STORE t; LOAD x; ADD t", "LOAD x; ADDI y", "t"},
+    // generate_substract argument - y: cost 50 -> 30
+    {"LOAD y; STORE t; LOADI x; SUB t", "LOADI x; SUB y", "t"},
+    // generate_addition argument + y: cost 50 -> 30
+    {"LOAD y; STORE t; LOADI x; ADD t", "LOAD y; ADDI x", "t"},
+    // generate_substract of two arguments: cost 60 -> 40
+    {"LOADI y; STORE t; LOADI x; SUB t", "LOADI x; SUBI y", "t"},
+    // generate_addition of two arguments: cost 60 -> 40
+    {"LOADI y; STORE t; LOADI x; ADD t", "LOADI y; ADDI x", "t"},
+    // address of a[k]: cost 120 -> 50
+    {"SET k; STORE 1; SET b; ADD 1", "SET k+b", "1"},
+    // address of a[i]: cost 80 -> 60
+    {"LOAD i; STORE 1; SET b; ADD 1", "SET b; ADD i", "1"},
+    // address of a[i], i an argument: cost 90 -> 70
+    {"LOADI i; STORE 1; SET b; ADD 1", "SET b; ADDI i", "1"},
+    // address of a[k], a an argument: cost 80 -> 60
+    {"SET k; STORE 1; LOAD p; ADD 1", "SET k; ADD p", "1"},
+    // address of a[i], a an argument: cost 40 -> 20
+    {"LOAD i; STORE 1; LOAD p; ADD 1", "LOAD i; ADD p", "1"},
+    // address of a[i], a and i arguments: cost 50 -> 30
+    {"LOADI i; STORE 1; LOAD p; ADD 1", "LOAD p; ADDI i", "1"},
+    // generate_load_to_RAX of an element at a known address: cost 70 -> 10
+    {"SET &a; LOADI 0", "LOAD a", ""},
+};
+
+#endif // REWRITE_TABLE_HPP
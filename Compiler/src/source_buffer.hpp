@@ -0,0 +1,108 @@
+#ifndef SOURCE_BUFFER_HPP
+#define SOURCE_BUFFER_HPP
+
+#include <string>
+#include <stdexcept>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Program source handed to the scanner without copying. Flex scans a buffer in
+// place as long as it ends with two NUL bytes, so the file is mapped on top of
+// an anonymous zeroed region that is at least two bytes longer than the file.
+// The mapping is private and writable because flex temporarily writes NULs
+// into the buffer; only the touched pages get copied.
+class SourceBuffer
+{
+public:
+    static const size_t PADDING = 2;
+
+    explicit SourceBuffer(const std::string &fileName) : name(fileName)
+    {
+        int fd = ::open(fileName.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            throw std::runtime_error("Could not open input file " + fileName);
+        }
+
+        struct stat st;
+        if (::fstat(fd, &st) < 0)
+        {
+            ::close(fd);
+            throw std::runtime_error("Could not open input file " + fileName);
+        }
+        length = st.st_size;
+
+        long page = ::sysconf(_SC_PAGESIZE);
+        mappedLength = ((length + PADDING + page - 1) / page) * page;
+        void *base = ::mmap(nullptr, mappedLength, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED)
+        {
+            ::close(fd);
+            throw std::runtime_error("Could not map input file " + fileName);
+        }
+        if (length > 0 && ::mmap(base, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED)
+        {
+            ::munmap(base, mappedLength);
+            ::close(fd);
+            throw std::runtime_error("Could not map input file " + fileName);
+        }
+        ::close(fd);
+        buffer = static_cast<char *>(base);
+    }
+
+    // Source text that is already in memory, e.g. received over a socket.
+    SourceBuffer(const std::string &sourceName, const char *text, size_t size) : name(sourceName), length(size)
+    {
+        buffer = new char[length + PADDING];
+        std::memcpy(buffer, text, length);
+        std::memset(buffer + length, 0, PADDING);
+    }
+
+    ~SourceBuffer()
+    {
+        if (mappedLength > 0)
+        {
+            ::munmap(buffer, mappedLength);
+        }
+        else
+        {
+            delete[] buffer;
+        }
+    }
+
+    SourceBuffer(const SourceBuffer &) = delete;
+    SourceBuffer &operator=(const SourceBuffer &) = delete;
+
+    const std::string &getName() const
+    {
+        return name;
+    }
+
+    char *data() const
+    {
+        return buffer;
+    }
+
+    size_t size() const
+    {
+        return length;
+    }
+
+    // Size of the buffer including the two terminating NULs, as flex expects it.
+    size_t scanSize() const
+    {
+        return length + PADDING;
+    }
+
+private:
+    std::string name;
+    char *buffer = nullptr;
+    size_t length = 0;
+    size_t mappedLength = 0;
+};
+
+#endif // SOURCE_BUFFER_HPP
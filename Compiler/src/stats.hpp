@@ -0,0 +1,235 @@
+#ifndef STATS_HPP
+#define STATS_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <cstdio>
+#include <algorithm>
+#include <ostream>
+
+#include <sys/resource.h>
+
+// Number of heap allocations made by the current thread. Incremented by the
+// replacement operator new in parser.y; a compilation runs on one thread, so
+// differences of this counter are per compilation.
+extern thread_local long long thread_allocations;
+
+// Heap bytes the current thread holds, counted by the same operators from the
+// usable size of every block, and the most it has held since the last
+// HeapMeter started.
+extern thread_local long long thread_heap_bytes;
+extern thread_local long long thread_heap_peak;
+
+inline long long peak_rss_kb()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// Per-compilation measurements for -ftime-report: wall time, allocations and
+// peak resident set size per phase, plus named event counters.
+class CompileStats
+{
+public:
+    struct Phase
+    {
+        std::string name;
+        double milliseconds;
+        long long allocations;
+        long long peakRssKb;
+    };
+
+    // One optimization pass; runs is 0 for a pass that was off. Instructions
+    // removed and cost saved are only known for passes rewriting code, and
+    // the cost counts every instruction as executed once.
+    struct Pass
+    {
+        std::string name;
+        std::string kind;
+        long long runs;
+        double milliseconds;
+        long long instructionsRemoved;
+        long long costSaved;
+    };
+
+    std::vector<Phase> phases;
+    std::map<std::string, long long> counters;
+    std::vector<Pass> passes;
+
+    void addPhase(const std::string &name, double milliseconds, long long allocations)
+    {
+        phases.push_back({name, milliseconds, allocations, peak_rss_kb()});
+    }
+
+    void count(const std::string &name, long long amount = 1)
+    {
+        counters[name] += amount;
+    }
+
+    void print_table(std::ostream &out) const
+    {
+        char line[128];
+        double totalMs = 0;
+        long long totalAllocations = 0;
+        std::snprintf(line, sizeof(line), "%-32s %12s %12s %14s\n", "Phase", "Wall ms", "Allocations", "Peak RSS KB");
+        out << line;
+        for (const auto &phase : phases)
+        {
+            std::snprintf(line, sizeof(line), "%-32s %12.3f %12lld %14lld\n", phase.name.c_str(), phase.milliseconds,
+                          phase.allocations, phase.peakRssKb);
+            out << line;
+            totalMs += phase.milliseconds;
+            totalAllocations += phase.allocations;
+        }
+        std::snprintf(line, sizeof(line), "%-32s %12.3f %12lld\n", "total", totalMs, totalAllocations);
+        out << line;
+
+        if (!counters.empty())
+        {
+            out << "\n";
+            std::snprintf(line, sizeof(line), "%-45s %12s\n", "Counter", "Value");
+            out << line;
+            for (const auto &counter : counters)
+            {
+                std::snprintf(line, sizeof(line), "%-45s %12lld\n", counter.first.c_str(), counter.second);
+                out << line;
+            }
+        }
+
+        if (!passes.empty())
+        {
+            out << "\n";
+            std::snprintf(line, sizeof(line), "%-20s %-12s %6s %12s %12s %12s\n", "Pass", "Kind", "Runs", "Wall ms",
+                          "Removed", "Cost saved");
+            out << line;
+            for (const auto &pass : passes)
+            {
+                if (pass.kind == "instruction")
+                {
+                    std::snprintf(line, sizeof(line), "%-20s %-12s %6lld %12.3f %12lld %12lld\n", pass.name.c_str(),
+                                  pass.kind.c_str(), pass.runs, pass.milliseconds, pass.instructionsRemoved,
+                                  pass.costSaved);
+                }
+                else
+                {
+                    std::snprintf(line, sizeof(line), "%-20s %-12s %6lld %12.3f %12s %12s\n", pass.name.c_str(),
+                                  pass.kind.c_str(), pass.runs, pass.milliseconds, "-", "-");
+                }
+                out << line;
+            }
+        }
+    }
+
+    void print_json(std::ostream &out, const std::string &fileName) const
+    {
+        out << "{\"file\": \"" << escape(fileName) << "\", \"phases\": [";
+        for (size_t i = 0; i < phases.size(); i++)
+        {
+            char number[32];
+            std::snprintf(number, sizeof(number), "%.3f", phases[i].milliseconds);
+            out << (i ? ", " : "") << "{\"name\": \"" << escape(phases[i].name) << "\", \"ms\": " << number
+                << ", \"allocations\": " << phases[i].allocations << ", \"peak_rss_kb\": " << phases[i].peakRssKb << "}";
+        }
+        out << "], \"counters\": {";
+        bool first = true;
+        for (const auto &counter : counters)
+        {
+            out << (first ? "" : ", ") << "\"" << escape(counter.first) << "\": " << counter.second;
+            first = false;
+        }
+        out << "}, \"passes\": [";
+        for (size_t i = 0; i < passes.size(); i++)
+        {
+            char number[32];
+            std::snprintf(number, sizeof(number), "%.3f", passes[i].milliseconds);
+            out << (i ? ", " : "") << "{\"name\": \"" << escape(passes[i].name) << "\", \"kind\": \"" << passes[i].kind
+                << "\", \"runs\": " << passes[i].runs << ", \"ms\": " << number;
+            if (passes[i].kind == "instruction")
+            {
+                out << ", \"instructions_removed\": " << passes[i].instructionsRemoved
+                    << ", \"cost_saved\": " << passes[i].costSaved;
+            }
+            out << "}";
+        }
+        out << "]}";
+    }
+
+private:
+    static std::string escape(const std::string &text)
+    {
+        std::string escaped;
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\')
+            {
+                escaped.push_back('\\');
+            }
+            escaped.push_back(c);
+        }
+        return escaped;
+    }
+};
+
+// Heap use of the enclosing scope for -fmem-report: the most the thread held
+// above what it held on entry, and what it still holds above that.
+class HeapMeter
+{
+public:
+    HeapMeter() : base(thread_heap_bytes), outerPeak(thread_heap_peak)
+    {
+        thread_heap_peak = thread_heap_bytes;
+    }
+
+    ~HeapMeter()
+    {
+        thread_heap_peak = std::max(outerPeak, thread_heap_peak);
+    }
+
+    HeapMeter(const HeapMeter &) = delete;
+    HeapMeter &operator=(const HeapMeter &) = delete;
+
+    long long peak() const
+    {
+        return thread_heap_peak - base;
+    }
+
+    long long retained() const
+    {
+        return thread_heap_bytes - base;
+    }
+
+private:
+    long long base;
+    long long outerPeak;
+};
+
+// Measures the enclosing scope as one phase. Does nothing without stats.
+class PhaseTimer
+{
+public:
+    PhaseTimer(CompileStats *stats, const std::string &name)
+        : stats(stats), name(name), allocations(thread_allocations), start(std::chrono::steady_clock::now())
+    {
+    }
+
+    ~PhaseTimer()
+    {
+        if (stats)
+        {
+            auto end = std::chrono::steady_clock::now();
+            stats->addPhase(name, std::chrono::duration<double, std::milli>(end - start).count(),
+                            thread_allocations - allocations);
+        }
+    }
+
+private:
+    CompileStats *stats;
+    std::string name;
+    long long allocations;
+    std::chrono::steady_clock::time_point start;
+};
+
+#endif // STATS_HPP
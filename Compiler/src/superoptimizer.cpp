@@ -0,0 +1,490 @@
+// Offline superoptimizer for the straight-line idioms emitted by the code
+// generator. For every fragment below it enumerates all sequences of up to
+// MAX_LENGTH instructions over the operands the fragment mentions, in order of
+// cost, keeps the cheapest one that behaves like the fragment on randomized and
+// edge-case inputs (including aliased operands) and prints the winners as
+// rewrite_table.hpp:
+//
+//   g++ -std=c++11 -O2 -o superoptimizer src/superoptimizer.cpp
+//   ./superoptimizer > src/rewrite_table.hpp
+//
+// (or ./run.sh superopt). The search is exhaustive, so a winner is the cheapest
+// sequence over its operands; equivalence is established by testing only.
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <utility>
+#include <random>
+#include <algorithm>
+
+#include "instruction.hpp"
+#include "rewrite_rule.hpp"
+
+static const int MAX_LENGTH = 4;
+static const int RANDOM_TESTS = 300;
+
+struct Fragment
+{
+    const char *pattern;
+    const char *dead;
+    const char *origin;
+};
+
+// Temporaries (t) come from getNewPid and are used only inside the fragment.
+// Cell 1 is written by every array access before it is read and last read by
+// the ADD 1 forming the address or the STOREI 1 storing through it.
+static const Fragment FRAGMENTS[] = {
+    {"STORE x; LOAD x", "", "store followed by a load of the same variable"},
+    {"LOAD x; STORE x", "", "load followed by a store of the same variable"},
+    {"SET c; STORE x; SET c", "", "the same constant stored twice"},
+
+    {"SET 0; STORE t; LOAD x; SUB t", "t", "condition x ? 0"},
+    {"SET 0; STORE t; LOADI x; SUB t", "t", "condition x ? 0, x a procedure argument"},
+    {"SET c; STORE t; LOAD x; SUB t", "t", "generate_substract x - constant"},
+    {"SET c; STORE t; LOAD x; ADD t", "t", "generate_addition x + constant"},
+    {"SET c; STORE t; LOADI x; SUB t", "t", "generate_substract argument - constant"},
+    {"SET c; STORE t; LOADI x; ADD t", "t", "generate_addition argument + constant"},
+    {"LOAD y; STORE t; SET c; SUB t", "t", "generate_substract constant - y"},
+    {"LOAD y; STORE t; SET c; ADD t", "t", "generate_addition constant + y"},
+    {"LOADI y; STORE t; SET c; SUB t", "t", "generate_substract constant - argument"},
+    {"LOADI y; STORE t; SET c; ADD t", "t", "generate_addition constant + argument"},
+    {"SET d; STORE t; SET c; SUB t", "t", "generate_substract of two constants"},
+    {"SET d; STORE t; SET c; ADD t", "t", "generate_addition of two constants"},
+    {"LOAD y; STORE t; LOAD x; SUB t", "t", "generate_substract x - y"},
+    {"LOAD y; STORE t; LOAD x; ADD t", "t", "generate_addition x + y"},
+    {"LOADI y; STORE t; LOAD x; SUB t", "t", "generate_substract x - argument"},
+    {"LOADI y; STORE t; LOAD x; ADD t", "t", "generate_addition x + argument"},
+    {"LOAD y; STORE t; LOADI x; SUB t", "t", "generate_substract argument - y"},
+    {"LOAD y; STORE t; LOADI x; ADD t", "t", "generate_addition argument + y"},
+    {"LOADI y; STORE t; LOADI x; SUB t", "t", "generate_substract of two arguments"},
+    {"LOADI y; STORE t; LOADI x; ADD t", "t", "generate_addition of two arguments"},
+
+    {"SET k; STORE 1; SET b; ADD 1", "1", "address of a[k]"},
+    {"LOAD i; STORE 1; SET b; ADD 1", "1", "address of a[i]"},
+    {"LOADI i; STORE 1; SET b; ADD 1", "1", "address of a[i], i an argument"},
+    {"SET k; STORE 1; LOAD p; ADD 1", "1", "address of a[k], a an argument"},
+    {"LOAD i; STORE 1; LOAD p; ADD 1", "1", "address of a[i], a an argument"},
+    {"LOADI i; STORE 1; LOAD p; ADD 1", "1", "address of a[i], a and i arguments"},
+    {"SET &a; LOADI 0", "", "generate_load_to_RAX of an element at a known address"},
+};
+
+// Machine state restricted to the handful of cells a fragment touches. Cells
+// never written read as a pseudo-random function of their address.
+class TestMachine
+{
+public:
+    explicit TestMachine(unsigned long long seed) : seed(seed) {}
+
+    std::vector<std::pair<long long, __int128>> cells;
+
+    __int128 read(long long address) const
+    {
+        for (const auto &cell : cells)
+        {
+            if (cell.first == address)
+            {
+                return cell.second;
+            }
+        }
+        unsigned long long h = (unsigned long long)address * 0x9E3779B97F4A7C15ULL ^ seed;
+        h ^= h >> 29;
+        h *= 0xBF58476D1CE4E5B9ULL;
+        h ^= h >> 32;
+        return (long long)(h % 2000001) - 1000000;
+    }
+
+    void write(long long address, __int128 value)
+    {
+        for (auto &cell : cells)
+        {
+            if (cell.first == address)
+            {
+                cell.second = value;
+                return;
+            }
+        }
+        cells.push_back({address, value});
+    }
+
+    // Returns false if an address does not fit in a cell.
+    bool run(const std::vector<Instruction> &code)
+    {
+        for (const auto &inst : code)
+        {
+            __int128 acc = read(0);
+            switch (inst.op)
+            {
+            case Opcode::LOAD:
+                write(0, read(inst.arg));
+                break;
+            case Opcode::STORE:
+                write(inst.arg, acc);
+                break;
+            case Opcode::ADD:
+                write(0, acc + read(inst.arg));
+                break;
+            case Opcode::SUB:
+                write(0, acc - read(inst.arg));
+                break;
+            case Opcode::LOADI:
+            case Opcode::STOREI:
+            case Opcode::ADDI:
+            case Opcode::SUBI:
+            {
+                __int128 address = read(inst.arg);
+                if (address < -((__int128)1 << 62) || address > ((__int128)1 << 62))
+                {
+                    return false;
+                }
+                if (inst.op == Opcode::LOADI)
+                {
+                    write(0, read((long long)address));
+                }
+                else if (inst.op == Opcode::STOREI)
+                {
+                    write((long long)address, acc);
+                }
+                else if (inst.op == Opcode::ADDI)
+                {
+                    write(0, acc + read((long long)address));
+                }
+                else
+                {
+                    write(0, acc - read((long long)address));
+                }
+                break;
+            }
+            case Opcode::SET:
+                write(0, inst.arg);
+                break;
+            case Opcode::HALF:
+                write(0, acc >= 0 ? acc / 2 : -((-(acc + 1)) / 2) - 1);
+                break;
+            default:
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    unsigned long long seed;
+};
+
+// One assignment of values to the symbols of a fragment.
+struct TestCase
+{
+    std::vector<long long> values;
+    std::vector<long long> deadAddresses;
+    unsigned long long seed;
+};
+
+class Superoptimizer
+{
+public:
+    explicit Superoptimizer(const Fragment &fragment)
+        : fragment(fragment), rule(RewriteRule::parse(fragment.pattern, fragment.pattern, fragment.dead))
+    {
+        build_tests();
+        build_alphabet();
+    }
+
+    // Returns false if nothing cheaper than the fragment exists.
+    bool search(std::vector<RewriteStep> &best)
+    {
+        bestCost = RewriteRule::cost(rule.pattern);
+        bestLength = rule.pattern.size() + 1;
+        found = false;
+        std::vector<RewriteStep> candidate;
+        extend(candidate, 0, best);
+        return found;
+    }
+
+    const RewriteRule &getRule() const
+    {
+        return rule;
+    }
+
+private:
+    const Fragment &fragment;
+    RewriteRule rule;
+    std::vector<TestCase> tests;
+    std::vector<std::vector<std::pair<long long, __int128>>> expected;
+    std::vector<RewriteStep> alphabet;
+    long long bestCost = 0;
+    size_t bestLength = 0;
+    bool found = false;
+
+    static RewriteOperand number(long long value)
+    {
+        RewriteOperand arg;
+        arg.constant = value;
+        return arg;
+    }
+
+    static RewriteOperand combination(const std::vector<std::pair<int, long long>> &terms)
+    {
+        RewriteOperand arg;
+        arg.terms = terms;
+        return arg;
+    }
+
+    bool isDeadSymbol(int symbol) const
+    {
+        return std::find(rule.deadSymbols.begin(), rule.deadSymbols.end(), symbol) != rule.deadSymbols.end();
+    }
+
+    // Cell symbols get distinct addresses, except that two live ones may name
+    // the same variable; constants get small edge values or large random ones.
+    void build_tests()
+    {
+        std::mt19937_64 random(12345);
+        std::vector<int> live;
+        for (size_t s = 0; s < rule.symbols.size(); s++)
+        {
+            if (rule.cellSymbol[s] && !isDeadSymbol(s))
+            {
+                live.push_back(s);
+            }
+        }
+        std::vector<std::pair<int, int>> aliases = {{-1, -1}};
+        for (size_t i = 0; i < live.size(); i++)
+        {
+            for (size_t j = i + 1; j < live.size(); j++)
+            {
+                aliases.push_back({live[i], live[j]});
+            }
+        }
+
+        const long long edges[] = {0, 1, -1, 2, -2, 3};
+        for (const auto &alias : aliases)
+        {
+            for (int t = 0; t < RANDOM_TESTS; t++)
+            {
+                TestCase test;
+                test.seed = random();
+                for (size_t s = 0; s < rule.symbols.size(); s++)
+                {
+                    if (rule.cellSymbol[s] || isDeadSymbol(s))
+                    {
+                        test.values.push_back(16 + 16 * s + (random() % 1000) * 1024);
+                    }
+                    else if (t % 2 == 0)
+                    {
+                        test.values.push_back(edges[random() % 6]);
+                    }
+                    else
+                    {
+                        test.values.push_back((long long)(random() % 2000001) - 1000000);
+                    }
+                }
+                if (alias.first >= 0)
+                {
+                    test.values[alias.second] = test.values[alias.first];
+                }
+                for (int s : rule.deadSymbols)
+                {
+                    test.deadAddresses.push_back(test.values[s]);
+                }
+                for (long long cell : rule.deadCells)
+                {
+                    test.deadAddresses.push_back(cell);
+                }
+                tests.push_back(test);
+            }
+        }
+
+        for (const auto &test : tests)
+        {
+            std::vector<Instruction> code;
+            instantiate(rule.pattern, test, code);
+            TestMachine machine(test.seed);
+            machine.run(code);
+            expected.push_back(machine.cells);
+        }
+    }
+
+    // Operands a replacement may use: the symbols and the scratch cells of the
+    // fragment, sums and differences of its constants and a few small numbers.
+    void build_alphabet()
+    {
+        std::vector<RewriteOperand> cells = {number(0)};
+        std::vector<RewriteOperand> constants = {number(0), number(1), number(-1)};
+        for (const auto &step : rule.pattern)
+        {
+            if (step.op != Opcode::SET && step.arg.terms.empty() && step.arg.constant != 0)
+            {
+                cells.push_back(step.arg);
+            }
+        }
+        for (long long cell : rule.deadCells)
+        {
+            cells.push_back(number(cell));
+        }
+        std::vector<int> constantSymbols;
+        for (size_t s = 0; s < rule.symbols.size(); s++)
+        {
+            cells.push_back(combination({{(int)s, 1}}));
+            constants.push_back(combination({{(int)s, 1}}));
+            if (!rule.cellSymbol[s] && !isDeadSymbol(s))
+            {
+                constantSymbols.push_back(s);
+                constants.push_back(combination({{(int)s, -1}}));
+            }
+        }
+        for (size_t i = 0; i < constantSymbols.size(); i++)
+        {
+            for (size_t j = i + 1; j < constantSymbols.size(); j++)
+            {
+                int a = constantSymbols[i], b = constantSymbols[j];
+                cells.push_back(combination({{a, 1}, {b, 1}}));
+                constants.push_back(combination({{a, 1}, {b, 1}}));
+                constants.push_back(combination({{a, 1}, {b, -1}}));
+                constants.push_back(combination({{b, 1}, {a, -1}}));
+            }
+        }
+
+        const Opcode memoryOps[] = {Opcode::LOAD, Opcode::STORE, Opcode::ADD, Opcode::SUB,
+                                    Opcode::LOADI, Opcode::STOREI, Opcode::ADDI, Opcode::SUBI};
+        for (Opcode op : memoryOps)
+        {
+            for (const auto &cell : cells)
+            {
+                alphabet.push_back({op, cell});
+            }
+        }
+        for (const auto &constant : constants)
+        {
+            alphabet.push_back({Opcode::SET, constant});
+        }
+        alphabet.push_back({Opcode::HALF, number(0)});
+        std::stable_sort(alphabet.begin(), alphabet.end(), [](const RewriteStep &a, const RewriteStep &b)
+                         { return instruction_cost(a.op) < instruction_cost(b.op); });
+    }
+
+    static bool instantiate(const std::vector<RewriteStep> &steps, const TestCase &test, std::vector<Instruction> &code)
+    {
+        code.clear();
+        for (const auto &step : steps)
+        {
+            Instruction inst = {step.op, 0};
+            if (has_operand(step.op) && !RewriteRule::evaluate(step.arg, test.values, inst.arg))
+            {
+                return false;
+            }
+            code.push_back(inst);
+        }
+        return true;
+    }
+
+    bool equivalent(const std::vector<RewriteStep> &candidate, size_t test)
+    {
+        std::vector<Instruction> code;
+        if (!instantiate(candidate, tests[test], code))
+        {
+            return false;
+        }
+        TestMachine machine(tests[test].seed);
+        if (!machine.run(code))
+        {
+            return false;
+        }
+        TestMachine reference(tests[test].seed);
+        reference.cells = expected[test];
+        const auto &dead = tests[test].deadAddresses;
+        for (const auto *written : {&machine.cells, &expected[test]})
+        {
+            for (const auto &cell : *written)
+            {
+                if (std::find(dead.begin(), dead.end(), cell.first) != dead.end())
+                {
+                    continue;
+                }
+                if (machine.read(cell.first) != reference.read(cell.first))
+                {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    bool verify(const std::vector<RewriteStep> &candidate)
+    {
+        for (size_t test = 0; test < tests.size(); test++)
+        {
+            if (!equivalent(candidate, test))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void extend(std::vector<RewriteStep> &candidate, long long cost, std::vector<RewriteStep> &best)
+    {
+        if (!candidate.empty() && (cost < bestCost || (cost == bestCost && candidate.size() < bestLength)) &&
+            equivalent(candidate, 0) && verify(candidate))
+        {
+            best = candidate;
+            bestCost = cost;
+            bestLength = candidate.size();
+            found = true;
+        }
+        if ((int)candidate.size() == MAX_LENGTH)
+        {
+            return;
+        }
+        for (const auto &step : alphabet)
+        {
+            long long next = cost + instruction_cost(step.op);
+            if (next > bestCost || (next == bestCost && candidate.size() + 1 >= bestLength))
+            {
+                break;
+            }
+            candidate.push_back(step);
+            extend(candidate, next, best);
+            candidate.pop_back();
+        }
+    }
+};
+
+static std::string quoted(const std::string &text)
+{
+    return "\"" + text + "\"";
+}
+
+int main()
+{
+    std::cout << "#ifndef REWRITE_TABLE_HPP\n"
+                 "#define REWRITE_TABLE_HPP\n"
+                 "\n"
+                 "// Generated by superoptimizer.cpp (./run.sh superopt), do not edit.\n"
+                 "// Every replacement is the cheapest sequence of at most "
+              << MAX_LENGTH << " instructions over\n"
+                 "// the operands of its pattern that matched it on all tests.\n"
+                 "\n"
+                 "#include \"rewrite_rule.hpp\"\n"
+                 "\n"
+                 "static const RewriteTableEntry REWRITE_TABLE[] = {\n";
+    for (const auto &fragment : FRAGMENTS)
+    {
+        Superoptimizer search(fragment);
+        std::vector<RewriteStep> best;
+        const RewriteRule &rule = search.getRule();
+        if (!search.search(best))
+        {
+            std::cerr << "no improvement: " << fragment.pattern << std::endl;
+            continue;
+        }
+        std::cout << "    // " << fragment.origin << ": cost " << RewriteRule::cost(rule.pattern) << " -> "
+                  << RewriteRule::cost(best) << "\n"
+                  << "    {" << quoted(fragment.pattern) << ", " << quoted(rule.format(best)) << ", "
+                  << quoted(fragment.dead) << "},\n";
+    }
+    std::cout << "};\n"
+                 "\n"
+                 "#endif // REWRITE_TABLE_HPP\n";
+    return 0;
+}
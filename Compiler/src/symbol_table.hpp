@@ -7,13 +7,15 @@
 #include <string>
 #include <stdexcept>
 #include <vector>
+#include <initializer_list>
 
 #include "ast.hpp"
 
 class SymbolTable
 {
 public:
-    long long pid = 3;                                                                        // RAX, RBX, RCX
+    static const long long FIRST_CELL = 3;                                                    // after RAX, RBX, RCX
+    long long pid = FIRST_CELL;
     std::unordered_map<std::string, long long> zmienna_pid;                                   // main -> a, b, c, d, x, y
     std::unordered_map<std::string, long long> tablica_indeks_pid;                            // main T
     std::unordered_map<std::string, long long> parametr_pid;                                  // gcd -> gcd::a, gcd::b, gcd::c
@@ -21,6 +23,10 @@ public:
     std::unordered_map<std::string, long long> tablica_param_pid;                             // gcd::x, gcd::y
     std::unordered_map<std::string, long long> funkcja_RBX;                                   // adres powrotu dla funkcji
     std::unordered_set<long long> iterator_pid;
+    std::unordered_map<std::string, std::pair<long long, long long>> frame_cells;             // gcd -> [RBX, end of locals)
+    std::unordered_map<std::string, std::vector<std::string>> frame_symbols;                  // gcd -> gcd::a, ..., gcd::y
+    long long lookupCount = 0;                                                                // -ftime-report
+    long long newPidCount = 0;
 
     std::string getName(std::string func, std::string var)
     {
@@ -41,6 +47,7 @@ public:
             for (const auto &proc : root->procedures->procedures)
             {
                 std::string procName = *proc->arguments->procedureName;
+                long long frameStart = pid;
                 funkcja_RBX[procName] = pid++;
                 if (proc->arguments)
                 {
@@ -53,8 +60,9 @@ public:
                             ensureUnique(name);
                         } catch (const std::runtime_error &e)
                         {
-                            throw SymbolTableError(e.what(), proc->arguments->getLineNumber());
+                            throw SymbolTableError(e.what(), arg->getLineNumber());
                         }
+                        frame_symbols[procName].push_back(name);
                         if (!arg->isArray)
                         {
                             parametr_pid[name] = pid++;
@@ -77,8 +85,9 @@ public:
                             ensureUnique(name);
                         } catch (const std::runtime_error &e)
                         {
-                            throw SymbolTableError(e.what(), proc->declarations->getLineNumber());
+                            throw SymbolTableError(e.what(), decl->getLineNumber());
                         }
+                        frame_symbols[procName].push_back(name);
                         if (!decl->isArray)
                         {
                             zmienna_pid[name] = pid++;
@@ -93,9 +102,11 @@ public:
                         }
                     }
                 }
+                frame_cells[procName] = {frameStart, pid};
             }
         }
 
+        frame_cells[""] = {pid, pid};
         if (root->main && root->main->declarations)
         {
             for (const auto &decl : root->main->declarations->declarations)
@@ -105,8 +116,9 @@ public:
                     ensureUnique(name);
                 } catch (const std::runtime_error &e)
                 {
-                    throw SymbolTableError(e.what(), root->main->getLineNumber());
+                    throw SymbolTableError(e.what(), decl->getLineNumber());
                 }
+                frame_symbols[""].push_back(name);
                 if (!decl->isArray)
                 {
                     zmienna_pid[name] = pid++;
@@ -120,11 +132,38 @@ public:
                     }
                 }
             }
+            frame_cells[""].second = pid;
         }
     }
 
+    // Moves the return address, parameters and locals of a procedure ("" for
+    // main) to start at base; cells allocated next follow them.
+    void place_frame(const std::string &procName, long long base)
+    {
+        auto &cells = frame_cells[procName];
+        long long shift = base - cells.first;
+        if (funkcja_RBX.find(procName) != funkcja_RBX.end())
+        {
+            funkcja_RBX[procName] += shift;
+        }
+        for (const auto &name : frame_symbols[procName])
+        {
+            for (auto *cellsOf : {&zmienna_pid, &parametr_pid, &tablica_indeks_pid, &tablica_param_pid})
+            {
+                auto it = cellsOf->find(name);
+                if (it != cellsOf->end())
+                {
+                    it->second += shift;
+                }
+            }
+        }
+        cells = {base, cells.second + shift};
+        pid = cells.second;
+    }
+
     std::pair<long long, bool> getPid(std::string name)
     {
+        lookupCount++;
         if (zmienna_pid.find(name) != zmienna_pid.end())
         {
             return {zmienna_pid[name], false};
@@ -167,6 +206,7 @@ public:
 
     std::pair<long long, bool> getArrPid(std::string name)
     {
+        lookupCount++;
         if (tablica_indeks_pid.find(name) != tablica_indeks_pid.end())
         {
             return {tablica_indeks_pid[name], false};
@@ -189,6 +229,7 @@ public:
 
     long long getNewPid()
     {
+        newPidCount++;
         return pid++;
     }
 };